@@ -1,9 +1,62 @@
 #if !defined(DSM_H)
 #define DSM_H
 
+#include <unistd.h>
 #include "dsm_arbiter.h"
 
 
+/*
+ *******************************************************************************
+ *                             Symbolic Constants                              *
+ *******************************************************************************
+*/
+
+
+// Alignment of dsm_malloc blocks.
+#define DSM_ALIGN_MIN				16
+
+// Alignment to avoid sharing a cache line between blocks.
+#define DSM_ALIGN_CACHE				64
+
+// Alignment to avoid sharing a page between blocks.
+#define DSM_ALIGN_PAGE				((size_t)sysconf(_SC_PAGESIZE))
+
+
+/*
+ *******************************************************************************
+ *                              Type Definitions                               *
+ *******************************************************************************
+*/
+
+
+// Comparisons for dsm_wait_until_op: Waits until (*addr <op> value).
+typedef enum {
+	DSM_CMP_EQ,
+	DSM_CMP_NE,
+	DSM_CMP_LT,
+	DSM_CMP_LE,
+	DSM_CMP_GT,
+	DSM_CMP_GE
+} dsm_cmp_t;
+
+
+// Write protocols of shared pages, for dsm_set_protocol.
+typedef enum {
+	DSM_PROTO_AUTO,         // Chosen from how the page is shared (default).
+	DSM_PROTO_UPDATE,       // Writes are sent to all hosts holding the page.
+	DSM_PROTO_INVALIDATE    // Other hosts drop the page, and fetch on access.
+} dsm_proto_t;
+
+
+// Orders in which the server grants queued writes, for dsm_cfg.grant_policy.
+typedef enum {
+	DSM_GRANT_FIFO,         // In the order requested (default).
+	DSM_GRANT_LOCAL,        // Up to grant_param in a row to one host.
+	DSM_GRANT_GID,          // Lowest GID first.
+	DSM_GRANT_FAIR          // Host granted least first, within a deadline.
+} dsm_grant_t;
+
+
 /*
  *******************************************************************************
  *                            Function Declarations                            *
@@ -33,6 +86,41 @@ int dsm_get_gid (void);
 // Blocks process until all other processes are synchronized at the same point.
 void dsm_barrier (void);
 
+/*
+ * Signals arrival at a barrier without blocking. The process may continue
+ * with local work, but must call dsm_barrier_wait before arriving again.
+*/
+void dsm_barrier_arrive (void);
+
+// Blocks until the barrier signalled by dsm_barrier_arrive is released.
+void dsm_barrier_wait (void);
+
+/*
+ * Returns a handle to named semaphore. Target created if nonexistent. The 
+ * name is resolved by the server once, and then cached.
+ * - sem_name: Named semaphore identifier.
+*/
+int dsm_sem_open (const char *sem_name);
+
+/*
+ * Performs a post (up) on a semaphore.
+ * - sem_id: The handle returned from dsm_sem_open.
+*/
+void dsm_sem_post (int sem_id);
+
+/*
+ * Performs a wait (down) on a semaphore.
+ * - sem_id: The handle returned from dsm_sem_open.
+*/
+void dsm_sem_wait (int sem_id);
+
+/*
+ * Issues a wait (down) on a semaphore without blocking. Returns a handle
+ * for dsm_sync_test and dsm_sync_wait. Only one request may be outstanding.
+ * - sem_id: The handle returned from dsm_sem_open.
+*/
+int dsm_sem_wait_async (int sem_id);
+
 /*
  * Performs a post (up) on named semaphore. Target created if nonexistant.
  * - sem_name: Named semaphore identifier.
@@ -45,6 +133,155 @@ void dsm_post_sem (const char *sem_name);
 */
 void dsm_wait_sem (const char *sem_name);
 
+/*
+ * Issues a wait (down) on named semaphore without blocking. Returns a handle
+ * for dsm_sync_test and dsm_sync_wait. Only one request may be outstanding.
+ * - sem_name: Named semaphore identifier.
+*/
+int dsm_wait_sem_async (const char *sem_name);
+
+/*
+ * Sleeps until a shared word equals the expected value. The word is rechecked
+ * whenever a local or remote write to it is applied.
+ * - addr:     Address of the (aligned) word. Must be in shared memory map.
+ * - expected: Value to wait for.
+*/
+void dsm_wait_until (volatile int *addr, int expected);
+
+/*
+ * Sleeps until (*addr <op> value) holds for a shared word.
+ * - addr:  Address of the (aligned) word. Must be in shared memory map.
+ * - op:    The comparison. See dsm_cmp_t.
+ * - value: Right-hand operand of the comparison.
+*/
+void dsm_wait_until_op (volatile int *addr, dsm_cmp_t op, int value);
+
+/*
+ * Returns a handle to named reader-writer lock. Target created if nonexistent.
+ * - name:          Named lock identifier.
+ * - prefer_writer: If nonzero, new readers queue behind waiting writers. Only
+ *                  applied by the process that creates the lock.
+*/
+int dsm_rwlock_open (const char *name, int prefer_writer);
+
+/*
+ * Acquires lock for reading (shared with other readers). Blocks until granted.
+ * - lock_id: The handle returned from dsm_rwlock_open.
+*/
+void dsm_rwlock_rdlock (int lock_id);
+
+/*
+ * Acquires lock for writing (exclusive). Blocks until granted.
+ * - lock_id: The handle returned from dsm_rwlock_open.
+*/
+void dsm_rwlock_wrlock (int lock_id);
+
+/*
+ * Releases a read or write lock held by the calling process.
+ * - lock_id: The handle returned from dsm_rwlock_open.
+*/
+void dsm_rwlock_unlock (int lock_id);
+
+/*
+ * Sends a buffer to the process with the given GID. Returns once the data is
+ * handed to the arbiter. The data bypasses the shared map and write order.
+ * - gid: Receiving process.
+ * - buf: The data.
+ * - len: Size of the data (in bytes).
+*/
+void dsm_send (int gid, const void *buf, size_t len);
+
+/*
+ * Blocks until len bytes from the process with the given GID are received.
+ * Data from each sender arrives in order, regardless of the send sizes. A
+ * buffer in the shared map is written once all data is received.
+ * - gid: Sending process.
+ * - buf: Buffer to receive into.
+ * - len: Number of bytes to receive.
+*/
+void dsm_recv (int gid, void *buf, size_t len);
+
+/*
+ * Copies len bytes at addr on the root process to addr on all processes. The
+ * data is pipelined along a chain of all processes (also those sharing a
+ * host) in chunks. Taking about len / bandwidth for any number of hosts needs
+ * peer data (see dsm_cfg): Chunks between hosts then go straight to the peer
+ * arbiter. Otherwise they go through the server, whose link carries them
+ * twice per host after the first. Must be called by all processes.
+ * - addr: Buffer to send (root) or receive into (others).
+ * - len:  Size of the buffer (in bytes).
+ * - root: GID of the sending process.
+*/
+void dsm_bcast (void *addr, size_t len, int root);
+
+/*
+ * Distributes consecutive blocks of len bytes from sendbuf on the root process
+ * to recvbuf on each process, in order of GID. Must be called by all processes.
+ * - sendbuf: Blocks for all processes (root only, otherwise ignored).
+ * - recvbuf: Buffer to receive the block into.
+ * - len:     Size of a block (in bytes).
+ * - root:    GID of the sending process.
+*/
+void dsm_scatter (const void *sendbuf, void *recvbuf, size_t len,
+	int root);
+
+/*
+ * Collects len bytes of sendbuf from each process into consecutive blocks of
+ * recvbuf on the root process, in order of GID. Must be called by all
+ * processes.
+ * - sendbuf: Block to send.
+ * - recvbuf: Buffer for all blocks (root only, otherwise ignored).
+ * - len:     Size of a block (in bytes).
+ * - root:    GID of the receiving process.
+*/
+void dsm_gather (const void *sendbuf, void *recvbuf, size_t len,
+	int root);
+
+/*
+ * Returns nonzero if the operation of the given handle has completed.
+ * - handle: The handle returned from dsm_wait_sem_async.
+*/
+int dsm_sync_test (int handle);
+
+/*
+ * Blocks until the operation of the given handle has completed.
+ * - handle: The handle returned from dsm_wait_sem_async.
+*/
+void dsm_sync_wait (int handle);
+
+/*
+ * Sets the range of the shared map the calling process allocates from, in
+ * place of an equal share of the map by GID. A block may then be as large as
+ * the range. Must be called before the first allocation. Default arenas
+ * together cover the map: A program that also carves offsets by hand sets the
+ * arenas of allocating processes to ranges outside those offsets.
+ * - addr: Start of the range (page aligned, in the shared map).
+ * - size: Size of the range (in bytes, a multiple of the page size).
+*/
+void dsm_set_arena (void *addr, size_t size);
+
+/*
+ * Allocates size bytes of shared memory. Each process allocates from its own
+ * arena (see dsm_set_arena), so allocation takes no write token. Returns NULL
+ * if size is zero, or the arena is exhausted. Panics before dsm_init.
+ * - size: Size (in bytes) of the block.
+*/
+void *dsm_malloc (size_t size);
+
+/*
+ * Allocates size bytes of shared memory, aligned to align. Blocks aligned to
+ * DSM_ALIGN_CACHE or DSM_ALIGN_PAGE share no cache line or page with others.
+ * - size:  Size (in bytes) of the block.
+ * - align: Alignment (a power of two, at most DSM_ALIGN_PAGE).
+*/
+void *dsm_malloc_aligned (size_t size, size_t align);
+
+/*
+ * Frees shared memory. Only the allocating process may free a block.
+ * - ptr: Block returned from dsm_malloc, or NULL.
+*/
+void dsm_free (void *ptr);
+
 /*
  * Creates a hole in the shared memory space. Returns a positive hole ID
  * on success, and -1 on error. Memory within this space will not be
@@ -58,12 +295,59 @@ int dsm_dig_hole (void *addr, size_t size);
 
 /*
  * Fills a hole in the shared memory space. Panics on error.
- * Filling a hole results in the hole memory space being
- * synchronized. The hole then no longer exists.
+ * Filling a hole results in the modified parts of the hole memory
+ * space being synchronized. The hole then no longer exists.
  * - id: The hole ID returned from dsm_dig_hole.
 */
 void dsm_fill_hole (int id);
 
+/*
+ * Fills several holes at once. Panics on error. The modified parts of all
+ * holes are synchronized as a single write, so the write token is requested
+ * (and the write acknowledged) once, rather than once per hole.
+ * - ids: The (distinct) hole IDs returned from dsm_dig_hole.
+ * - n:   The number of hole IDs.
+*/
+void dsm_fill_holes (const int *ids, size_t n);
+
+/*
+ * Fills a hole without blocking. Returns a handle for dsm_wait_fill. The
+ * arbiter writes the modified parts of the hole straight from the shared map
+ * once it holds the write token, so the caller may go on computing. The hole
+ * no longer exists, but its range must not be dug again before completion.
+ * The next fill, sync request or barrier first completes the fill.
+ * - id: The hole ID returned from dsm_dig_hole.
+*/
+int dsm_fill_hole_async (int id);
+
+/*
+ * Blocks until the fill of the given handle has completed.
+ * - handle: The handle returned from dsm_fill_hole_async.
+*/
+void dsm_wait_fill (int handle);
+
+/*
+ * Sets the write protocol of the pages spanning a range of the shared map.
+ * By default, each page switches between updates and invalidation by itself,
+ * depending on how it is shared. Only has effect if pages are fetched lazily
+ * (see dsm_cfg), as only such hosts can drop pages.
+ * - addr:  Start of the range (must be in shared memory map).
+ * - size:  The size (in bytes) of the range. Must be > 0.
+ * - proto: The protocol. See dsm_proto_t.
+*/
+void dsm_set_protocol (void *addr, size_t size, dsm_proto_t proto);
+
+/*
+ * Subscribes this host to the pages spanning a range of the shared map. If
+ * pages are fetched lazily (see dsm_cfg), the host otherwise only receives
+ * writes to pages its processes accessed, and these may be invalidated. The
+ * range is fetched now instead, and always updated. Other hosts receive
+ * writes to pages they don't hold, and need not acknowledge them.
+ * - addr:  Start of the range (must be in shared memory map).
+ * - size:  The size (in bytes) of the range. Must be > 0.
+*/
+void dsm_subscribe (void *addr, size_t size);
+
 // Disconnects from DSM. Unmaps shared memory. Collects local process forks.
 void dsm_exit (void);
 
@@ -36,6 +36,14 @@ typedef struct dsm_cfg {
     const char *d_addr;     // Daemon address.
     const char *d_port;     // Daemon port.
     size_t map_size;        // Desired memory map size (page multiple).
+    unsigned int bar_spin;  // Barrier polls before sleeping (0: sleep now).
+    unsigned int lease_writes; // Local writes per write lease (0: no leases).
+    unsigned int lease_ms;  // Write lease duration (0: held until revoked).
+    unsigned int page_owner; // Grant writes by page ownership (0: by token).
+    unsigned int lazy_pages; // Fetch pages on first access (0: replicate all).
+    unsigned int peer_data; // Send write data straight to peers (0: by server).
+    unsigned int grant_policy; // Write-grant order (see dsm_grant_t in dsm.h).
+    unsigned int grant_param; // Batch, or deadline in ms (0: default).
 } dsm_cfg;
 
 
@@ -0,0 +1,67 @@
+#if !defined(DSM_CTRL_H)
+#define DSM_CTRL_H
+
+#include <stdint.h>
+#include <signal.h>
+
+
+/*
+ *******************************************************************************
+ *                             Symbolic Constants                              *
+ *******************************************************************************
+*/
+
+
+// The name of the shared control file.
+#define DSM_CTRL_FILE_NAME			"dsm_ctrl"
+
+// The size of the shared control file.
+#define DSM_CTRL_FILE_SIZE			((unsigned int)DSM_PAGESIZE)
+
+// The maximum number of local processes with a control slot.
+#define DSM_CTRL_MAX_SLOTS			64
+
+// Watch offset of a slot whose process isn't waiting on a shared word.
+#define DSM_CTRL_NO_WATCH			(-1)
+
+// The number of invalidated pages kept in the control page.
+#define DSM_CTRL_INV_RING			256
+
+// Signal sent to processes with pages to invalidate (ignored by default).
+#define DSM_CTRL_INV_SIGNAL			SIGURG
+
+
+/*
+ *******************************************************************************
+ *                              Type Definitions                               *
+ *******************************************************************************
+*/
+
+
+// Per-process region of the control page. Assigned by arbiter at check-in.
+typedef struct dsm_ctrl_slot {
+	volatile int32_t pid;           // Owning process (zero if unassigned).
+	volatile uint32_t sync_done;    // Completed sync requests (futex word).
+	volatile int64_t watch;         // Map offset of awaited word (or NO_WATCH).
+	volatile uint32_t inv_seen;     // Invalidations applied by the process.
+	uint32_t reserved;              // Padding.
+} dsm_ctrl_slot;
+
+
+/* Control page shared between the arbiter and its local processes. Unlike the
+ * shared map, it is never protected. The arbiter is the only writer, except
+ * for the watch and inv_seen fields of a slot, written by the owning process.
+ * Invalidated pages are posted to a ring: Entry i (modulo the ring size) is
+ * the page of invalidation i. Processes that fell a whole ring behind drop
+ * all their pages.
+*/
+typedef struct dsm_ctrl {
+	volatile uint32_t bar_gen;      // Barrier generation (futex word).
+	uint32_t nslots;                // Number of assigned slots.
+	dsm_ctrl_slot slots[DSM_CTRL_MAX_SLOTS];
+	volatile uint32_t inv_seq;      // Invalidations posted.
+	volatile uint32_t inv_ring[DSM_CTRL_INV_RING];
+} dsm_ctrl;
+
+
+#endif
@@ -0,0 +1,78 @@
+#if !defined(DSM_HEAP_H)
+#define DSM_HEAP_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+
+/*
+ *******************************************************************************
+ *                             Symbolic Constants                              *
+ *******************************************************************************
+*/
+
+
+// Log2 of the smallest size class (16 bytes).
+#define DSM_HEAP_MIN_SHIFT			4
+
+
+/*
+ *******************************************************************************
+ *                              Type Definitions                               *
+ *******************************************************************************
+*/
+
+
+// Kinds of heap page.
+typedef enum {
+	DSM_HEAP_PAGE_FREE,                        // Unused.
+	DSM_HEAP_PAGE_SLAB,                        // Split into slots of a class.
+	DSM_HEAP_PAGE_RUN,                         // First page of a large block.
+	DSM_HEAP_PAGE_TAIL                         // Other page of a large block.
+} dsm_heap_page_t;
+
+
+// Type describing a heap page. Kept in private memory, never in the heap.
+typedef struct dsm_heap_page {
+	dsm_heap_page_t kind;                      // Kind of page.
+	unsigned int shift;                        // Log2 of slot size (slab).
+	unsigned int nused;                        // Slots in use (slab).
+	size_t npages;                             // Pages in block (run).
+	uint64_t *used;                            // Bitmap of used slots (slab).
+} dsm_heap_page;
+
+
+/* Type describing a heap over a range of pages. Small blocks are carved from
+ * slabs of power-of-two slots. Blocks over half a page get whole pages.
+*/
+typedef struct dsm_heap {
+	void *base;                                // First page of heap.
+	size_t pagesize;                           // Size of a page.
+	size_t npages;                             // Number of pages.
+	dsm_heap_page *pages;                      // Page descriptors.
+} dsm_heap;
+
+
+/*
+ *******************************************************************************
+ *                            Function Declarations                            *
+ *******************************************************************************
+*/
+
+
+// Creates a heap over npages pages at base. Exits fatally on error.
+dsm_heap *dsm_new_heap (void *base, size_t npages, size_t pagesize);
+
+/* Allocates size bytes aligned to align (a power of two, at most a page).
+ * Returns NULL if size is zero, or no space is left.
+*/
+void *dsm_heap_alloc (dsm_heap *heap, size_t size, size_t align);
+
+// Releases a block. Returns nonzero if ptr isn't an allocated block.
+int dsm_heap_release (dsm_heap *heap, void *ptr);
+
+// Frees a heap (the memory it manages is untouched).
+void dsm_free_heap (dsm_heap *heap);
+
+
+#endif
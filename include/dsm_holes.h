@@ -2,6 +2,18 @@
 #define DSM_HOLES_H
 
 #include <stdlib.h>
+#include <stdint.h>
+
+
+/*
+ *******************************************************************************
+ *                             Symbolic Constants                              *
+ *******************************************************************************
+*/
+
+
+// Granularity (in bytes) at which modifications inside a hole are tracked.
+#define DSM_HOLE_BLOCK_SIZE		64
 
 
 /*
@@ -16,10 +28,22 @@ typedef struct dsm_hole {
 	int id;                                    // Hole identifier.
 	off_t offset;                              // Starting offset of hole.
 	size_t size;                               // Size (in bytes) of hole.
-	struct dsm_hole *next;                     // Pointer to next node.
+	size_t block;                              // Tracked block size (bytes).
+	uint64_t *dirty;                           // Bitmap of modified blocks.
 } dsm_hole;
 
 
+/* Type describing a table of holes. Holes never overlap, and are kept sorted
+ * by offset, so lookups by address are a binary search. A zeroed table is
+ * empty. Hole pointers are invalidated by adding or removing holes.
+*/
+typedef struct dsm_hole_tab {
+	size_t length;                             // Number of holes.
+	size_t capacity;                           // Allocated hole slots.
+	dsm_hole *holes;                           // Holes (sorted by offset).
+} dsm_hole_tab;
+
+
 /*
  *******************************************************************************
  *                            Function Declarations                            *
@@ -28,28 +52,50 @@ typedef struct dsm_hole {
 
 
 // Creates a hole. Returns positive ID on success, or -1 on error.
-int dsm_new_hole (off_t offset, size_t size, dsm_hole **holes);
+int dsm_new_hole (off_t offset, size_t size, dsm_hole_tab *tab);
 
-// Frees a linked list of memory holes
-void dsm_free_holes (dsm_hole *holes);
+/* Creates a hole tracking modifications to the byte (not by block). For holes
+ * no one claimed, where a whole block may hold data of others. Returns
+ * positive ID on success, or -1 on error.
+*/
+int dsm_new_exact_hole (off_t offset, size_t size, dsm_hole_tab *tab);
+
+// Frees all holes in the table. The table is left empty.
+void dsm_free_holes (dsm_hole_tab *tab);
 
 /* Returns pointer to a hole if the memory space resides inside one.
  * Ext is added to the compared hole size. It allows accesses to the last
  * byte of the hole to not count as outside the hole.
 */
-dsm_hole *dsm_in_hole (off_t offset, size_t size, size_t ext, dsm_hole *holes);
+dsm_hole *dsm_in_hole (off_t offset, size_t size, size_t ext,
+	dsm_hole_tab *tab);
 
 // Returns a pointer to a hole given a hole identifier. Returns NULL on error.
-dsm_hole *dsm_get_hole (int id, dsm_hole *holes);
+dsm_hole *dsm_get_hole (int id, dsm_hole_tab *tab);
 
 // Returns nonzero if given memory range overlaps with a hole. 
-int dsm_overlaps_hole (off_t offset, size_t size, dsm_hole *holes);
+int dsm_overlaps_hole (off_t offset, size_t size, dsm_hole_tab *tab);
 
 // Removes a hole. Returns nonzero on error.
-int dsm_del_hole (int id, dsm_hole **holes);
+int dsm_del_hole (int id, dsm_hole_tab *tab);
+
+// Records a modification of the given range. Clipped to the hole.
+void dsm_mark_hole (dsm_hole *hole, off_t offset, size_t size);
+
+/* Finds the next run of modified blocks at or after block *pos_p. Sets the
+ * offset and size of the run (clipped to the hole), and advances *pos_p past
+ * it. Returns zero if there are no more runs.
+*/
+int dsm_next_dirty_run (dsm_hole *hole, size_t *pos_p, off_t *offset_p,
+	size_t *size_p);
+
+/* Sets the offset and size of the smallest range spanning all modified runs
+ * of the hole. Returns zero if nothing was modified.
+*/
+int dsm_dirty_range (dsm_hole *hole, off_t *offset_p, size_t *size_p);
 
 // [DEBUG] Prints all holes to output.
-void dsm_show_holes (dsm_hole *holes);
+void dsm_show_holes (dsm_hole_tab *tab);
 
 
 #endif
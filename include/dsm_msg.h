@@ -18,6 +18,17 @@
 // Fixed size for strings in messages.
 #define DSM_MSG_STR_SIZE             32
 
+// Maximum number of process identifiers in a batch of write-requests.
+#define DSM_MSG_MAX_PIDS             14
+
+// Maximum number of runs in a multi-range write, and the packed size of each.
+#define DSM_MSG_MAX_RUNS             16
+#define DSM_MSG_RUN_SIZE             16
+
+// Size of the buffer a multi-range write is built in (see dsm_init_runs).
+#define DSM_MSG_RUNS_BUF_SIZE        (DSM_MSG_MAX_RUNS * DSM_MSG_RUN_SIZE + \
+                                      DSM_MAX_DATA_SIZE)
+
 
 /*
  *******************************************************************************
@@ -35,18 +46,46 @@ typedef enum {
 	DSM_MSG_CNT_ALL,     // [S->A]       Resume any waiting processes.
 	DSM_MSG_REL_BAR,     // [S->A]       Resume processes waiting at barrier.
 	DSM_MSG_WRT_NOW,     // [S->A->P]    Approve process write request.
-	DSM_MSG_SET_GID,     // [S->A->P]    Set process global identifier.
+	DSM_MSG_WRT_REVOKE,  // [S->A]       End write lease (a writer is queued).
+	DSM_MSG_OWN_NOW,     // [S->A]       Approve page ownership request.
+	DSM_MSG_OWN_REVOKE,  // [S->A]       Drop page once unused (others want it).
+	DSM_MSG_PAGE_DATA,   // [S->A]       Contents of a fetched page.
+	DSM_MSG_INV_PAGE,    // [S->A]       Drop page (fetch it again on access).
+	DSM_MSG_SET_PEER,    // [S->A]       Connect to peer arbiter (or list end).
+	DSM_MSG_SET_GID,     // [S->A->P, A->A] Set process global identifier.
 
 	DSM_MSG_GET_SID,     // [A->D]       Request session connection details.
 	DSM_MSG_GOT_DATA,    // [A->S]       Arbiter has received all data.
+	DSM_MSG_OWN_DROP,    // [A->S]       Arbiter drops ownership of a page.
+	DSM_MSG_OWN_DATA,    // [A->S->A]    Data written to owned page(s).
+	DSM_MSG_SET_LAZY,    // [A->S]       Arbiter only holds pages it fetches.
+	DSM_MSG_ADD_PEER,    // [A->S, A->A] Arbiter sends write data to peers.
+	DSM_MSG_REQ_WRTS,    // [A->S]       Batch of process write-requests.
+	DSM_MSG_SET_GRANT,   // [A->S]       Set the write-grant policy.
+	DSM_MSG_SET_LEASE,   // [A->S]       Arbiter keeps write token as a lease.
 
 	DSM_MSG_ADD_PID,     // [P->A->S]    Process registration.
 	DSM_MSG_REQ_WRT,     // [P->A->S]    Process write-request.
-	DSM_MSG_HIT_BAR,     // [P->A->S]    Process blocked at barrier.
+	DSM_MSG_REQ_OWN,     // [P->A->S]    Process write-request for owned pages.
+	DSM_MSG_GET_PAGE,    // [P->A->S]    Process fetches page (reply: A->P).
+	DSM_MSG_SET_PROTO,   // [P->A->S]    Process sets protocol of pages.
+	DSM_MSG_SUBSCRIBE,   // [P->A->S]    Process subscribes to pages.
+	DSM_MSG_HIT_BAR,     // [P->A->S]    Process(es) blocked at barrier.
 	DSM_MSG_WRT_DATA,    // [P->A->S]    Process data transmission.
+	DSM_MSG_WRT_RUNS,    // [P->A->S]    Process data transmission (of runs).
 	DSM_MSG_WRT_END,     // [P->A->S]    Process end of data transmission.
-	DSM_MSG_POST_SEM,    // [P->A->S]    Process posts to named semaphore.
-	DSM_MSG_WAIT_SEM,    // [P->A->S]    Process waits on named semaphore.
+	DSM_MSG_POST_SEM,    // [P->A->S]    Process posts to semaphore.
+	DSM_MSG_WAIT_SEM,    // [P->A->S]    Process waits on semaphore.
+	DSM_MSG_OPEN_SEM,    // [P->A->S->A->P] Process resolves semaphore handle.
+	DSM_MSG_OPEN_RWL,    // [P->A->S->A->P] Process resolves lock handle.
+	DSM_MSG_RD_LOCK,     // [P->A->S->A] Arbiter requests/is granted read lock.
+	DSM_MSG_WR_LOCK,     // [P->A->S->A] Process requests/is granted write lock.
+	DSM_MSG_RW_UNLOCK,   // [P->A->S]    Process or arbiter releases lock.
+	DSM_MSG_RW_DRAIN,    // [S->A]       Stop sharing read lock (writer waits).
+	DSM_MSG_P2P_DATA,    // [P->A->(S->)A->P] Point-to-point data to a GID.
+	DSM_MSG_P2P_RECV,    // [P->A]       Process receives point-to-point data.
+	DSM_MSG_FILL_RUN,    // [P->A]       Process queues modified run of a hole.
+	DSM_MSG_FILL_END,    // [P->A]       Process has arbiter write queued runs.
 	DSM_MSG_EXIT,        // [P->A->S]    Process exiting.
 
 	DSM_MSG_MAX_VAL
@@ -70,27 +109,95 @@ typedef struct dsm_payload_sid {
 } dsm_payload_sid;     // PACKED SIZE = 36B
 
 
-// For: DSM_MSG_ + [ADD_PID, SET_GID, REQ_WRT, HIT_BAR, WRT_NOW].
+// For: DSM_MSG_ + [ADD_PID, SET_GID, REQ_WRT, HIT_BAR, WRT_NOW, FILL_END].
 typedef struct dsm_payload_proc {
 	int32_t pid;
-	int32_t gid;
+	union {
+		int32_t gid;
+		int32_t nproc;
+		int32_t seq;        // WRT_NOW (from server): Sequence number of grant.
+	};
 } dsm_payload_proc;    // PACKED SIZE = 8B
 
 
-// For: DSM_MSG_ + [GOT_DATA].
+// For: DSM_MSG_ + [GOT_DATA, WRT_END].
 typedef struct dsm_payload_task {
 	int32_t nproc;
-} dsm_payload_task;    // PACKED SIZE = 4B
+	int32_t seq;            // Sequence number of the write (see WRT_NOW).
+} dsm_payload_task;    // PACKED SIZE = 8B
+
+
+// For: DSM_MSG_ + [ADD_PEER, SET_PEER].
+typedef struct dsm_payload_peer {
+	char addr[DSM_MSG_STR_SIZE];
+	int32_t port;           // Port of the peer (SET_PEER: 0 ends the list).
+	int32_t npeers;         // SET_PEER: The number of peers in all.
+} dsm_payload_peer;    // PACKED SIZE = 40B
+
+
+// For: DSM_MSG_ + [REQ_WRTS].
+typedef struct dsm_payload_reqs {
+	int32_t npids;
+	int32_t pids[DSM_MSG_MAX_PIDS];
+} dsm_payload_reqs;    // PACKED SIZE = 60B
+
+
+// For: DSM_MSG_ + [SET_GRANT].
+typedef struct dsm_payload_grant {
+	int32_t policy;         // See dsm_grant_t.
+	int32_t param;          // Batch size or deadline (0: default).
+} dsm_payload_grant;   // PACKED SIZE = 8B
 
 
 // For: DSM_MSG_ + [POST_SEM, WAIT_SEM].
 typedef struct dsm_payload_sem {
-	char sem_name[DSM_MSG_STR_SIZE];
+	int32_t sem_id;
+	int32_t pid;
+} dsm_payload_sem;    // PACKED SIZE = 8B
+
+
+// For: DSM_MSG_ + [RD_LOCK, WR_LOCK, RW_UNLOCK, RW_DRAIN].
+typedef struct dsm_payload_lock {
+	int32_t lock_id;
 	int32_t pid;
-} dsm_payload_sem;    // PACKED SIZE = 36B
+} dsm_payload_lock;    // PACKED SIZE = 8B
 
 
-// For: DSM_MSG_ + [WRT_DATA].
+// For: DSM_MSG_ + [OPEN_SEM, OPEN_RWL].
+typedef struct dsm_payload_name {
+	int32_t pid;
+	int32_t id;
+	int32_t flags;
+	int64_t size;
+	unsigned char *buf;
+} dsm_payload_name;    // PACKED SIZE = 20B (buf is NOT packed)
+
+
+// For: DSM_MSG_ + [P2P_DATA, P2P_RECV].
+typedef struct dsm_payload_p2p {
+	int32_t src_gid;
+	int32_t dst_gid;
+	int64_t size;
+	unsigned char *buf;
+} dsm_payload_p2p;     // PACKED SIZE = 16B (buf is NOT packed)
+
+
+/* For: DSM_MSG_ + [REQ_OWN, OWN_NOW, OWN_REVOKE, OWN_DROP, GET_PAGE,
+ * INV_PAGE, SET_PROTO, SUBSCRIBE]. Processes give the range they write (or
+ * set the protocol of, or subscribe to). Otherwise these are single pages.
+*/
+typedef struct dsm_payload_own {
+	int32_t pid;
+	union {
+		int32_t proto;      // SET_PROTO: The protocol (see dsm_proto_t).
+		int32_t inv_seq;    // GET_PAGE reply: Invalidations posted before.
+	};
+	int64_t offset;
+	int64_t size;
+} dsm_payload_own;     // PACKED SIZE = 24B
+
+
+// For: DSM_MSG_ + [WRT_DATA, OWN_DATA, PAGE_DATA, FILL_RUN].
 typedef struct dsm_payload_data {
 	int64_t offset;
 	int64_t size;
@@ -98,6 +205,16 @@ typedef struct dsm_payload_data {
 } dsm_payload_data;    // PACKED SIZE = 16B (buf is NOT packed) 
 
 
+/* For: DSM_MSG_ + [WRT_RUNS]. The buffer holds the offset and size of each run
+ * (packed as 64-bit integers), followed by the data of all runs in order.
+*/
+typedef struct dsm_payload_runs {
+	int32_t nruns;
+	int64_t size;           // Size of the buffer (runs, then data).
+	unsigned char *buf;
+} dsm_payload_runs;    // PACKED SIZE = 12B (buf is NOT packed)
+
+
 /*
  *******************************************************************************
  *                         Type Definitions: Messages                          *
@@ -113,9 +230,17 @@ typedef struct dsm_msg {
 		dsm_payload_proc    proc;
 		dsm_payload_task    task;
 		dsm_payload_sem     sem;
+		dsm_payload_lock    lock;
+		dsm_payload_name    name;
 		dsm_payload_data    data;
+		dsm_payload_runs    runs;
+		dsm_payload_p2p     p2p;
+		dsm_payload_own     own;
+		dsm_payload_peer    peer;
+		dsm_payload_reqs    reqs;
+		dsm_payload_grant   grant;
 	};
-} dsm_msg;     // PACKED SIZE = 40B
+} dsm_msg;     // PACKED SIZE = 64B
 
 
 /*
@@ -145,6 +270,28 @@ void dsm_unpack_msg (dsm_msg *mp, unsigned char *b);
 // [DEBUG] Prints message.
 void dsm_show_msg (dsm_msg *mp);
 
+/* Starts an empty DSM_MSG_WRT_RUNS message, built in buf (which must hold
+ * DSM_MSG_RUNS_BUF_SIZE bytes). Add runs with dsm_add_run.
+*/
+void dsm_init_runs (dsm_msg *mp, unsigned char *buf);
+
+/* Adds as much of the run (size bytes of data at offset) to the message as
+ * fits. A run continuing the last one extends it. Returns the number of bytes
+ * added: Zero if the message is full.
+*/
+int64_t dsm_add_run (dsm_msg *mp, int64_t offset, int64_t size,
+	const unsigned char *data);
+
+// Completes the message: Its data then follows right after its runs.
+void dsm_end_runs (dsm_msg *mp);
+
+/* Reads the next run of a (completed, or received) DSM_MSG_WRT_RUNS message.
+ * Start with *index_p at zero. Returns the data of the run, or NULL once
+ * none remain. Exits fatally if the message is malformed.
+*/
+const unsigned char *dsm_next_run (dsm_msg *mp, int *index_p,
+	int64_t *offset_p, int64_t *size_p);
+
 // Assigns function to given message type. Exits on error.
 void dsm_setMsgFunc (dsm_msg_t type, dsm_msg_func func, dsm_msg_func *fmap);
 
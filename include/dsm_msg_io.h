@@ -15,21 +15,46 @@
  * [NON-REENTRANT] Receives message from socket and unpacks it. The message
  * pointer is then configured. This function is non-reentrant, meaning that it 
  * cannot be called recursively or in parallel without all but the latest
- * invoker losing information. This specifically affects messages of type
- * DSM_MSG_WRT_DATA, where the data is stored in a static buffer within
- * the function.
+ * invoker losing information. This specifically affects messages with
+ * attached data (DSM_MSG_WRT_*, DSM_MSG_OPEN_*, DSM_MSG_P2P_DATA), where
+ * the data is stored in a static buffer within the function.
 */
 void dsm_recv_msg (int fd, dsm_msg *m);
 
 /*
  * Packs message and writes it to the given socket. All messages have a
  * standard size of DSM_MSG_SIZE bytes, with a potential extension in the
- * case of DSM_MSG_WRT_DATA. In DSM_MSG_WRT_DATA, the buffer is appended to
- * the end of the message (at an offset of DSM_MSG_SIZE bytes). Data size is 
- * capped at DSM_MAX_DATA_SIZE. If a larger size is specified, then it is
- * automatically chunked and sent in a sequence of messages.
+ * case of DSM_MSG_WRT_DATA, DSM_MSG_OPEN_* and DSM_MSG_P2P_DATA. In these, the
+ * buffer is appended to the end of the message (at an offset of DSM_MSG_SIZE
+ * bytes). Data size is capped at DSM_MAX_DATA_SIZE. If a larger
+ * DSM_MSG_WRT_DATA size is specified, then it is automatically chunked and
+ * sent in a sequence of messages. Each message is written with its data at
+ * once. Messages queued for the socket (see dsm_queue_msg) are sent first.
 */
 void dsm_send_msg (int fd, dsm_msg *mp);
 
+/*
+ * [NON-REENTRANT] Like dsm_send_msg, but packs the message (and its data)
+ * onto a batch kept for the socket instead. The batch is written at once by
+ * dsm_flush_msgs, or before the next message sent to the socket.
+*/
+void dsm_queue_msg (int fd, dsm_msg *mp);
+
+// [NON-REENTRANT] Writes the batch of each socket with queued messages.
+void dsm_flush_msgs (void);
+
+/* Adds the run (size bytes of data at offset) to the DSM_MSG_WRT_RUNS message
+ * (see dsm_init_runs), which is sent to the socket each time it fills up.
+ * Runs that don't fit are split over messages.
+*/
+void dsm_send_run (int fd, dsm_msg *mp, int64_t offset, int64_t size,
+	const unsigned char *data);
+
+// Sends the rest of the DSM_MSG_WRT_RUNS message (if any runs), emptying it.
+void dsm_send_runs (int fd, dsm_msg *mp);
+
+// [NON-REENTRANT] Flushes, then frees all batches.
+void dsm_free_msgs (void);
+
 
 #endif
\ No newline at end of file
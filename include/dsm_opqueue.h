@@ -2,6 +2,7 @@
 #define DSM_OPQUEUE_H
 
 #include <stdlib.h>
+#include <stdint.h>
 
 /*
  *******************************************************************************
@@ -18,6 +19,19 @@
 // Minimum number of queuable items.
 #define DSM_MIN_OPQUEUE_SIZE	32
 
+// Grant policies (in the order of dsm_grant_t).
+#define DSM_OPQUEUE_FIFO		0
+#define DSM_OPQUEUE_LOCAL		1
+#define DSM_OPQUEUE_GID			2
+#define DSM_OPQUEUE_FAIR		3
+#define DSM_OPQUEUE_NPOLICIES	4
+
+// Default consecutive grants to one arbiter (DSM_OPQUEUE_LOCAL).
+#define DSM_OPQUEUE_DEF_BATCH	4
+
+// Default wait (in ms) after which a request goes first (DSM_OPQUEUE_FAIR).
+#define DSM_OPQUEUE_DEF_DEADLINE	50
+
 
 /*
  *******************************************************************************
@@ -33,12 +47,37 @@ typedef enum dsm_syncStep {
 	STEP_WAITING_SYNC_ACK        // Waiting for data received acks.
 } dsm_syncStep;
 
-// Describes the current server state, and contains queued write-requests.
+// Describes a queued write-request.
+typedef struct dsm_opentry {
+	uint32_t fd;                 // Arbiter of the process.
+	uint32_t pid;                // Process.
+	int32_t gid;                 // Global identifier (DSM_OPQUEUE_GID).
+	double time;                 // Time (in seconds) it was queued.
+} dsm_opentry;
+
+// Describes how long write-requests waited to be granted.
+typedef struct dsm_opstats {
+	unsigned long ngrants;       // Requests granted.
+	unsigned long nswitches;     // Grants to another arbiter than the last.
+	double wait_sum;             // Total time (in seconds) waited.
+	double wait_max;             // Longest time (in seconds) waited.
+} dsm_opstats;
+
+/* Describes the current server state, and contains queued write-requests. The
+ * first is granted (if any): The policy chooses which follows it.
+*/
 typedef struct dsm_opqueue {
 	dsm_syncStep step;
-	uint64_t *queue;
+	dsm_opentry *queue;
 	size_t length;
-	unsigned int head, tail;
+	size_t count;
+	int policy;                  // Grant policy (see DSM_OPQUEUE_FIFO).
+	unsigned int param;          // Batch (LOCAL), or deadline in ms (FAIR).
+	uint32_t last_fd;            // Arbiter granted last.
+	unsigned int run;            // Consecutive grants to it.
+	unsigned int *served;        // Grants per arbiter (FAIR), by fd.
+	size_t nserved;              // Capacity of served.
+	dsm_opstats stats;
 } dsm_opqueue;
 
 
@@ -49,26 +88,48 @@ typedef struct dsm_opqueue {
 */
 
 
-// Allocates and initializes an operation-queue.
+// Allocates and initializes an operation-queue (FIFO policy).
 dsm_opqueue *dsm_initOpQueue (size_t length);
 
 // Free's given operation-queue.
 void dsm_freeOpQueue (dsm_opqueue *oq);
 
+/* Sets the grant policy, and its parameter (0 for the default):
+ * - FIFO:  Requests are granted in the order queued.
+ * - LOCAL: Up to param requests of the last granted arbiter are granted in a
+ *          row (oldest first), before the oldest request of any other.
+ * - GID:   The request of the lowest global identifier is granted first.
+ * - FAIR:  The oldest request of the arbiter granted least is granted first,
+ *          unless one has waited param milliseconds: Then that goes first.
+*/
+void dsm_setOpQueuePolicy (dsm_opqueue *oq, int policy, unsigned int param);
+
 // Returns true (1) if the given operation-queue is empty.
 int dsm_isOpQueueEmpty (dsm_opqueue *oq);
 
+// Returns the number of operations in the operation-queue.
+size_t dsm_getOpQueueLength (dsm_opqueue *oq);
+
 // Returns head of operation-queue. Exits fatally on error.
 uint64_t dsm_getOpQueueHead (dsm_opqueue *oq);
 
+// Returns true (1) if another arbiter than that of the head has a request.
+int dsm_isOpQueueShared (dsm_opqueue *oq);
+
 // Enqueues {machine + process} in operation-queue for write.
-void dsm_enqueueOpQueue (uint32_t fd, uint32_t pid, dsm_opqueue *oq);
+void dsm_enqueueOpQueue (uint32_t fd, uint32_t pid, int32_t gid,
+	dsm_opqueue *oq);
 
-// Dequeues file-descriptor from operation queue. Panics on error.
+/* Dequeues head of operation queue (which is returned). The policy then
+ * chooses the next head. Panics on error.
+*/
 uint64_t dsm_dequeueOpQueue (dsm_opqueue *oq);
 
 // Prints the operation-queue.
 void dsm_showOpQueue (dsm_opqueue *oq);
 
+// Prints the grant policy, and how long requests waited under it.
+void dsm_showOpQueueStats (dsm_opqueue *oq);
+
 
-#endif
\ No newline at end of file
+#endif
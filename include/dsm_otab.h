@@ -0,0 +1,76 @@
+#if !defined(DSM_OTAB_H)
+#define DSM_OTAB_H
+
+#include <stdlib.h>
+
+
+/*
+ *******************************************************************************
+ *                             Symbolic Constants                              *
+ *******************************************************************************
+*/
+
+
+// Minimum number of pages in the ownership table.
+#define DSM_OTAB_MIN_PAGES			64
+
+
+/*
+ *******************************************************************************
+ *                              Type Definitions                               *
+ *******************************************************************************
+*/
+
+
+// Type describing an arbiter waiting to own a page.
+typedef struct dsm_owner_req {
+	int fd;                             // Requesting arbiter.
+	struct dsm_owner_req *next;         // Next queued request.
+} dsm_owner_req;
+
+
+// Type describing the ownership of a page.
+typedef struct dsm_owner {
+	int fd;                             // Owning arbiter (-1 if none).
+	int revoking;                       // Nonzero if owner was asked to drop.
+	dsm_owner_req *head;                // First waiting arbiter.
+	dsm_owner_req *tail;                // Last waiting arbiter.
+} dsm_owner;
+
+
+/* Type describing the page ownership table. Pages are owned by one arbiter
+ * at a time, and pass to waiting arbiters in the order they asked.
+*/
+typedef struct dsm_otab {
+	size_t length;                      // Number of pages in the table.
+	dsm_owner *pages;                   // Ownership, indexed by page.
+} dsm_otab;
+
+
+/*
+ *******************************************************************************
+ *                            Function Declarations                            *
+ *******************************************************************************
+*/
+
+
+// Initializes the ownership table. Returns pointer. Exits fatally on error.
+dsm_otab *dsm_initOwnerTable (void);
+
+/* Requests a page for the arbiter at fd. Returns nonzero if it now owns it.
+ * Otherwise the request is queued, and *revoke_p is set to the owner to ask
+ * to drop the page (-1 if it was already asked).
+*/
+int dsm_acquirePage (dsm_otab *otab, size_t page, int fd, int *revoke_p);
+
+/* Releases a page owned by the arbiter at fd. Returns the next owner (-1 if
+ * none). Sets *revoke_p to the next owner if others still wait on the page
+ * (so it must be asked to drop it in turn), or to -1 otherwise.
+*/
+int dsm_releasePage (dsm_otab *otab, size_t page, int fd, int *revoke_p);
+
+// Frees the ownership table.
+void dsm_freeOwnerTable (dsm_otab *otab);
+
+
+#endif
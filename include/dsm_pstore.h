@@ -0,0 +1,149 @@
+#if !defined(DSM_PSTORE_H)
+#define DSM_PSTORE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+
+/*
+ *******************************************************************************
+ *                             Symbolic Constants                              *
+ *******************************************************************************
+*/
+
+
+// Minimum number of pages (and holders) in the page store.
+#define DSM_PSTORE_MIN_LENGTH		64
+
+// Granularity (in bytes) at which writes to invalidated pages are tracked.
+#define DSM_PSTORE_WORD				8
+
+// Approximate cost (in bytes) of a message besides its data.
+#define DSM_PSTORE_MSG_COST			64
+
+// Shared writes to a page in update mode before invalidation is tried.
+#define DSM_PSTORE_PROBE_WRITES		16
+
+// Writes to a page in invalidate mode before its savings are checked.
+#define DSM_PSTORE_WINDOW_WRITES	64
+
+// Maximum backoff exponent of probes, after invalidation didn't pay off.
+#define DSM_PSTORE_MAX_BACKOFF		6
+
+// Page protocols (in the order of dsm_proto_t).
+#define DSM_PSTORE_AUTO				0
+#define DSM_PSTORE_UPDATE			1
+#define DSM_PSTORE_INVALIDATE		2
+
+
+/*
+ *******************************************************************************
+ *                              Type Definitions                               *
+ *******************************************************************************
+*/
+
+
+// Type describing the pages an arbiter holds.
+typedef struct dsm_holder {
+	int is_lazy;                        // Holds only the pages it fetched.
+	size_t nwords;                      // Number of words in the bitmap.
+	uint64_t *held;                     // Bitmap of held pages.
+	uint64_t *subscribed;               // Bitmap of pages never invalidated.
+} dsm_holder;
+
+
+// Type describing an invalidated copy: The words written since invalidation.
+typedef struct dsm_stale {
+	int fd;                             // Holder of the invalidated copy.
+	uint64_t *dirty;                    // Bitmap of words written since.
+	struct dsm_stale *next;             // Next invalidated copy of the page.
+} dsm_stale;
+
+
+/* Type describing a page of the page store. In update mode, writes are sent
+ * to all holders. In invalidate mode, lazy holders other than the writer
+ * drop their copy instead, and later fetch only the words written since.
+*/
+typedef struct dsm_pentry {
+	unsigned char *data;                // Copy (NULL if never written).
+	int mode;                           // Protocol set through the API.
+	int is_invalidate;                  // Protocol chosen if mode is AUTO.
+	unsigned int nwrites;               // Writes counted toward a switch.
+	unsigned int backoff;               // Probes are delayed by 2^backoff.
+	int64_t balance;                    // Bytes saved by invalidating.
+	dsm_stale *stale;                   // Invalidated copies.
+} dsm_pentry;
+
+
+// Type of the function called for each copy a write invalidates.
+typedef void (*dsm_inv_func)(int fd, size_t page);
+
+
+/* Type describing the page store: Copies of the written pages of the shared
+ * map, from which lazy arbiters fetch pages. Copies are only kept once a lazy
+ * arbiter has registered. Other arbiters hold all pages.
+*/
+typedef struct dsm_pstore {
+	size_t pagesize;                    // Size (in bytes) of a page.
+	unsigned int nlazy;                 // Number of lazy arbiters registered.
+	size_t npages;                      // Capacity of the page array.
+	dsm_pentry *pages;                  // Pages, indexed by page number.
+	size_t nholders;                    // Capacity of the holder array.
+	dsm_holder *holders;                // Holders, indexed by file-descriptor.
+} dsm_pstore;
+
+
+/*
+ *******************************************************************************
+ *                            Function Declarations                            *
+ *******************************************************************************
+*/
+
+
+// Initializes the page store. Returns pointer. Exits fatally on error.
+dsm_pstore *dsm_initPageStore (size_t pagesize);
+
+/* Copies data written by the arbiter at fd into the page store (if any lazy
+ * arbiter registered). Calls inv for each copy held by another lazy arbiter
+ * that the write invalidates, and updates the protocol of the written pages.
+*/
+void dsm_writePageStore (dsm_pstore *pstore, int fd, int64_t offset,
+	const unsigned char *buf, size_t size, dsm_inv_func inv);
+
+// Copies the given page to buf (zeroes if it was never written).
+void dsm_readPageStore (dsm_pstore *pstore, size_t page, unsigned char *buf);
+
+/* Sets start_p and size_p to the next run of the page that the arbiter at fd
+ * must fetch, after position *pos_p (initially zero). That is the whole page,
+ * unless its copy was invalidated: Then only the runs written since. Returns
+ * zero once there are no runs left.
+*/
+int dsm_nextPageRun (dsm_pstore *pstore, int fd, size_t page, size_t *pos_p,
+	size_t *start_p, size_t *size_p);
+
+// Sets the protocol of the given page (see DSM_PSTORE_AUTO).
+void dsm_setPageMode (dsm_pstore *pstore, size_t page, int mode);
+
+// Registers the arbiter at fd as lazy: It holds no pages until it fetches.
+void dsm_setLazyHolder (dsm_pstore *pstore, int fd);
+
+// Records that the (lazy) arbiter at fd fetched, and now holds the given page.
+void dsm_setHeldPage (dsm_pstore *pstore, int fd, size_t page);
+
+/* Subscribes the (lazy) arbiter at fd to the given page: Writes to it are
+ * forwarded once the page is held, and never invalidate it.
+*/
+void dsm_setSubscribedPage (dsm_pstore *pstore, int fd, size_t page);
+
+// Returns nonzero if the arbiter at fd holds any page of the given range.
+int dsm_holdsPageRange (dsm_pstore *pstore, int fd, int64_t offset,
+	size_t size);
+
+// Removes the arbiter at fd (it holds all pages again, if it reconnects).
+void dsm_remHolder (dsm_pstore *pstore, int fd);
+
+// Frees the page store.
+void dsm_freePageStore (dsm_pstore *pstore);
+
+
+#endif
@@ -25,6 +25,8 @@ typedef struct dsm_pstate {
     unsigned int is_stopped : 1;    // Process stopped (ongoing write).
     unsigned int is_blocked : 1;    // Process blocked (barrier or semaphore)
     unsigned int is_queued  : 1;    // Process queued for operation.
+    unsigned int is_waiting : 1;    // Process has sync request outstanding.
+    unsigned int is_filling : 1;    // Process has hole fill outstanding.
 } dsm_pstate;
 
 
@@ -32,8 +34,10 @@ typedef struct dsm_pstate {
 typedef struct dsm_proc {
     int gid;                        // Global process ID.
     int pid;                        // Local process ID.
+    int fd;                         // File-descriptor process is reached by.
     int sem_id;                     // ID of semaphore process is blocked on.
     dsm_pstate flags;               // Process mode flags.
+    struct dsm_proc *sem_next;      // Next process in semaphore wait queue.
 } dsm_proc;
 
 
@@ -89,6 +93,10 @@ void dsm_remProcessTableEntries (dsm_ptab *ptab, int fd);
 dsm_proc *dsm_getProcessTableEntryWithSemID (dsm_ptab *ptab, int sem_id, 
     int *fd_p);
 
+// Returns pointer to process with global ID. Returns NULL if none exists.
+dsm_proc *dsm_getProcessTableEntryWithGID (dsm_ptab *ptab, int gid, 
+    int *fd_p);
+
 // [DEBUG] Prints the process table.
 void dsm_showProcessTable (dsm_ptab *ptab);
 
@@ -0,0 +1,88 @@
+#if !defined(DSM_RWLOCK_H)
+#define DSM_RWLOCK_H
+
+#include "dsm_htab.h"
+
+
+/*
+ *******************************************************************************
+ *                             Symbolic Constants                              *
+ *******************************************************************************
+*/
+
+
+// Number of buckets in the reader-writer lock hash-table.
+#define DSM_RWLOCK_HTAB_LENGTH		32
+
+
+/*
+ *******************************************************************************
+ *                              Type Definitions                               *
+ *******************************************************************************
+*/
+
+
+// Type describing a queued lock request.
+typedef struct dsm_rwlock_req {
+	int fd;                             // Requesting arbiter.
+	int pid;                            // Requesting process.
+	int is_writer;                      // Nonzero if request is exclusive.
+	struct dsm_rwlock_req *next;        // Next queued request.
+} dsm_rwlock_req;
+
+
+/* Type describing a named reader-writer lock. Readers are counted per grant,
+ * where one grant may be shared by several processes of an arbiter.
+*/
+typedef struct dsm_rwlock_t {
+	int handle;                         // Lock handle.
+	int prefer_writer;                  // Queue new readers behind writers.
+	unsigned int nreaders;              // Number of read grants held.
+	unsigned int nwriters;              // Number of queued write requests.
+	int writer_fd;                      // Writing arbiter (-1 if none).
+	int writer_pid;                     // Writing process.
+	dsm_rwlock_req *head;               // First queued request.
+	dsm_rwlock_req *tail;               // Last queued request.
+	char name[];                        // Lock name.
+} dsm_rwlock_t;
+
+
+// Custom redefinition of dsm_htab.
+typedef dsm_htab dsm_rwlock_htab;
+
+
+/*
+ *******************************************************************************
+ *                            Function Declarations                            *
+ *******************************************************************************
+*/
+
+
+// Initializes lock hash table. Returns pointer. Exits fatally on error.
+dsm_rwlock_htab *dsm_initRWLockHashTable (void);
+
+// Registers new lock in table. Returns pointer. Exits fatally on error.
+dsm_rwlock_t *dsm_setRWLockHashTableEntry (dsm_rwlock_htab *htab,
+	const char *name, int prefer_writer);
+
+/* Requests the lock. Returns nonzero if granted immediately. Otherwise the
+ * request is queued, and is later returned by dsm_nextRWLockGrant.
+*/
+int dsm_acquireRWLock (dsm_rwlock_t *lock, int fd, int pid, int is_writer);
+
+// Releases a grant. It is a write grant if fd and pid match the writer.
+void dsm_releaseRWLock (dsm_rwlock_t *lock, int fd, int pid);
+
+/* Dequeues the next grantable request into the given pointers. Returns
+ * nonzero if one was granted. Call until zero after each release.
+*/
+int dsm_nextRWLockGrant (dsm_rwlock_t *lock, int *fd_p, int *pid_p,
+	int *is_writer_p);
+
+/* Returns nonzero if read grants must be returned once their readers leave,
+ * rather than be shared with new ones: A preferred writer is queued.
+*/
+int dsm_mustDrainRWLock (dsm_rwlock_t *lock);
+
+
+#endif
@@ -2,6 +2,7 @@
 #define DSM_SEM_HTAB_H
 
 #include "dsm_htab.h"
+#include "dsm_ptab.h"
 
 /*
  *******************************************************************************
@@ -24,7 +25,10 @@
 // Type describing a named semaphore.
 typedef struct dsm_sem_t {
     int sem_id;                         // Semaphore identifier.
+    int handle;                         // Semaphore handle.
     unsigned int value;                 // Semaphore value.
+    dsm_proc *head;                     // First (longest) waiting process.
+    dsm_proc *tail;                     // Last waiting process.
 } dsm_sem_t;
 
 
@@ -45,5 +49,11 @@ dsm_sem_htab *dsm_initSemHashTable (void);
 // Registers new semaphore in table. Returns pointer. Exits fatally on error.
 dsm_sem_t *dsm_setSemHashTableEntry (dsm_sem_htab *htab, char *sem_name);
 
+// Appends process to the semaphore wait queue. Exits fatally on error.
+void dsm_enqueueSemWaiter (dsm_sem_t *sem, dsm_proc *proc);
+
+// Removes and returns the longest waiting process. Returns NULL if none.
+dsm_proc *dsm_dequeueSemWaiter (dsm_sem_t *sem);
+
 
 #endif
\ No newline at end of file
@@ -21,5 +21,9 @@ void dsm_sigdefault (int signal, struct sigaction *old);
 void dsm_sigaction (int signal, void (*f)(int, siginfo_t *, void *),
 	struct sigaction *old);
 
+// Installs a handler for the given signal. Interrupted system calls restart.
+void dsm_sigaction_restart (int signal, void (*f)(int, siginfo_t *, void *),
+	struct sigaction *old);
+
 
 #endif
\ No newline at end of file
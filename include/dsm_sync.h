@@ -3,6 +3,7 @@
 
 #include <signal.h>
 #include "dsm_holes.h"
+#include "dsm_ctrl.h"
 
 
 /*
@@ -18,16 +19,28 @@ extern void *g_shared_map;
 // Size of the shared map.
 extern off_t g_map_size;
 
-// Pointer to shared memory holes list.
-extern dsm_hole *g_shm_holes;
+// Table of shared memory holes.
+extern dsm_hole_tab g_shm_holes;
 
 // Communication socket.
 extern int g_sock_io;
 
+// Boolean flag indicating if writes are granted by page ownership.
+extern unsigned int g_page_owner;
+
+// Boolean flag indicating if pages are fetched on first access.
+extern unsigned int g_lazy_pages;
+
+// Pointer to the shared control page.
+extern dsm_ctrl *g_ctrl;
+
+// Pointer to the control slot of the calling process.
+extern dsm_ctrl_slot *g_slot;
+
 /* Saved signal-handlers (to be restored after).
  * 0 - SIGSEGV
  * 1 - SIGILL
- * 2 - SIGTSTP
+ * 2 - DSM_CTRL_INV_SIGNAL
 */
 extern struct sigaction g_old_actions[3];
 
@@ -42,12 +55,35 @@ extern struct sigaction g_old_actions[3];
 // Initializes the decoder tables necessary for use in the sync handlers.
 void dsm_sync_init (void);
 
+/* Prepares to write the given range of the shared map: Messages the arbiter,
+ * waits for an acknowledgement. Under page ownership, the arbiter grants it
+ * once it owns all pages of the range. The range is then resident (pages
+ * aren't dropped while the write is granted). End the write with
+ * DSM_MSG_WRT_END.
+*/
+void dsm_sync_take (off_t offset, size_t size);
+
+/* Fetches the pages of the given range of the shared map that aren't resident
+ * yet (if fetched lazily), and makes them readable. Returns the number of
+ * pages fetched.
+*/
+unsigned int dsm_sync_fetch (off_t offset, size_t size);
+
+/* Writes the modified runs of the automatic hole as one write, and removes
+ * the hole. Does nothing if no automatic hole is open. The fault handler
+ * opens one ahead of streaming stores. Call before synchronizing.
+*/
+void dsm_sync_flush (void);
+
 // Handler: Synchronization action for SIGSEGV.
 void dsm_sync_sigsegv (int signal, siginfo_t *info, void *ucontext);
 
 // Handler: Synchronization action for SIGILL.
 void dsm_sync_sigill (int signal, siginfo_t *info, void *ucontext);
 
+// Handler: Drops pages invalidated by the arbiter (DSM_CTRL_INV_SIGNAL).
+void dsm_sync_siginv (int signal, siginfo_t *info, void *ucontext);
+
 // [DEBUG] Handler: Synchronization action for SIGCONT.
 void dsm_sync_sigcont (int signal, siginfo_t *info, void *ucontext);
 
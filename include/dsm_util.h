@@ -2,6 +2,7 @@
 #define DSM_UTIL_H
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <sys/poll.h>
 #include <semaphore.h>
 
@@ -77,6 +78,14 @@ int dsm_fork (void);
 // Returns the current wall time in seconds.
 double dsm_getWallTime (void);
 
+/* Sleeps while *addr == val (shared futex). Returns early on wake, signal,
+ * or if addr isn't readable (a shared page that was dropped).
+*/
+void dsm_futexWait (volatile uint32_t *addr, uint32_t val);
+
+// Wakes up to n waiters sleeping on addr (shared futex). Panics on error.
+void dsm_futexWake (volatile uint32_t *addr, int n);
+
 
 /*
  *******************************************************************************
@@ -122,7 +131,9 @@ off_t dsm_setSharedFileSize (int fd, off_t size);
 // Gets size of shared file. Panics on error.
 off_t dsm_getSharedFileSize (int fd);
 
-// Maps shared file of given size to memory with protections. Panics on error.
+/* Maps shared file of given size to memory with protections. Panics on error.
+ * The contents are left as is: Creators should zero the map themselves.
+*/
 void *dsm_mapSharedFile (int fd, size_t size, int prot);
 
 // Unlinks a shared memory file. Exits fatally on error.
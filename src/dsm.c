@@ -8,12 +8,15 @@
 #include <sys/mman.h>
 
 #include "dsm.h"
+#include "dsm_ctrl.h"
 #include "dsm_msg.h"
 #include "dsm_inet.h"
 #include "dsm_util.h"
 #include "dsm_signal.h"
 #include "dsm_sync.h"
 #include "dsm_holes.h"
+#include "dsm_heap.h"
+#include "dsm_htab.h"
 #include "dsm_msg_io.h"
 
 /*
@@ -29,6 +32,26 @@
 // The timeout (in microseconds) between connection attempts.
 #define DSM_SOCK_POLL_RATE			250000
 
+// Number of buckets in the semaphore handle cache.
+#define DSM_SEM_CACHE_LENGTH		16
+
+// Size of the chunks a broadcast is pipelined in.
+#define DSM_BCAST_CHUNK				(8 * DSM_MAX_DATA_SIZE)
+
+
+/*
+ *******************************************************************************
+ *                              Type Definitions                               *
+ *******************************************************************************
+*/
+
+
+// Semaphore handle cache entry.
+typedef struct dsm_sem_entry {
+	int sem_id;                     // Semaphore handle (issued by server).
+	char name[];                    // Semaphore name.
+} dsm_sem_entry;
+
 
 /*
  *******************************************************************************
@@ -43,12 +66,56 @@ void *g_shared_map;
 // Size of the shared map.
 off_t g_map_size;
 
-// Pointer to shared memory holes list.
-dsm_hole *g_shm_holes;
+// Table of shared memory holes.
+dsm_hole_tab g_shm_holes;
+
+// Boolean flag indicating if writes are granted by page ownership.
+unsigned int g_page_owner;
+
+// Boolean flag indicating if pages are fetched on first access.
+unsigned int g_lazy_pages;
+
+// Shared memory heap of the calling process (created on first allocation).
+static dsm_heap *g_heap;
+
+// Range of the map the heap is created over (see dsm_set_arena). If the size
+// is zero, an equal share of the map by GID.
+static void *g_arena_base;
+static size_t g_arena_size;
+
+// Pointer to the shared control page.
+dsm_ctrl *g_ctrl;
+
+// Pointer to the control slot of the calling process.
+dsm_ctrl_slot *g_slot;
+
+// Number of polls of the barrier generation before sleeping.
+static unsigned int g_bar_spin;
+
+// Barrier generation observed on arrival (valid if g_bar_arrived is set).
+static uint32_t g_bar_gen;
+
+// Boolean flag indicating if process arrived at barrier without waiting yet.
+static int g_bar_arrived;
+
+// Ticket of the most recently issued sync request (semaphore wait, lock).
+static uint32_t g_sync_ticket;
+
+// Ticket of the last asynchronous hole fill (valid if g_fill_pending is set).
+static uint32_t g_fill_ticket;
+
+// Boolean flag indicating if an asynchronous hole fill may be outstanding.
+static int g_fill_pending;
+
+// Semaphore handle cache (name to handle).
+static dsm_htab *g_sem_cache;
 
 // Number of local processes.
 static unsigned int g_lproc;
 
+// Total number of processes.
+static unsigned int g_nproc;
+
 // Rank of local process.
 static unsigned int g_lrank;
 
@@ -61,7 +128,7 @@ int g_sock_io = -1;
 /* Saved signal-handlers (to be restored after).
  * 0 - SIGSEGV
  * 1 - SIGILL
- * 2 - SIGTSTP
+ * 2 - DSM_CTRL_INV_SIGNAL
 */
 struct sigaction g_old_actions[3];
 
@@ -80,65 +147,130 @@ static void send_add_pid (void) {
 	dsm_send_msg(g_sock_io, &msg);
 }
 
-// Sends DSM_MSG_HIT_BAR to the arbiter.
+// Sends DSM_MSG_HIT_BAR to the arbiter. Writes out any automatic hole first.
 static void send_hit_bar (void) {
     dsm_msg msg = {.type = DSM_MSG_HIT_BAR};
+    dsm_sync_flush();
     msg.proc.pid = getpid();
     dsm_send_msg(g_sock_io, &msg);
 }
 
-// Sends payload for DSM_MSG_POST_SEM and DSM_MSG_WAIT_SEM to arbiter.
-static void send_sem_msg (dsm_msg_t type, const char *sem_name) {
+// Sends DSM_MSG_POST_SEM or WAIT_SEM to arbiter, after any automatic hole.
+static void send_sem_msg (dsm_msg_t type, int sem_id) {
     dsm_msg msg = {.type = type};
+    dsm_sync_flush();
     msg.sem.pid = getpid();
+    msg.sem.sem_id = sem_id;
+    dsm_send_msg(g_sock_io, &msg);
+}
 
-    // Semaphore name is truncated if too long.
-    snprintf(msg.sem.sem_name, DSM_MSG_STR_SIZE, "%s", sem_name);
+// Sends DSM_MSG_RD_LOCK, WR_LOCK or RW_UNLOCK, after any automatic hole.
+static void send_lock_msg (dsm_msg_t type, int lock_id) {
+    dsm_msg msg = {.type = type};
+    dsm_sync_flush();
+    msg.lock.pid = getpid();
+    msg.lock.lock_id = lock_id;
+    dsm_send_msg(g_sock_io, &msg);
+}
 
+// Sends DSM_MSG_OPEN_SEM or OPEN_RWL to arbiter. The name is attached as data.
+static void send_open_msg (dsm_msg_t type, const char *name, int flags) {
+    dsm_msg msg = {.type = type};
+	size_t size = strlen(name) + 1;
+
+	// Verify name fits in a single message.
+	if (size > DSM_MAX_DATA_SIZE) {
+		dsm_panicf("Name \"%.32s...\" exceeds %d bytes!", name,
+			DSM_MAX_DATA_SIZE - 1);
+	}
+
+    msg.name.pid = getpid();
+	msg.name.flags = flags;
+	msg.name.size = size;
+	msg.name.buf = (unsigned char *)name;
     dsm_send_msg(g_sock_io, &msg);
 }
 
-// Sends all data for a newly filled hole.
-static void send_hole_data (dsm_hole *hole) {
+/* Sends the modified data of the given (existing) holes, as one write of all
+ * their runs. Sends nothing if none of them were modified.
+*/
+static void send_hole_data (const int *ids, size_t n) {
+	unsigned char buf[DSM_MSG_RUNS_BUF_SIZE];
+	off_t offset, first = g_map_size, last = 0;
+	size_t pos, size, i;
+	dsm_hole *hole;
 	dsm_msg msg;
 
-	// Request write-authorization.
-	msg.type = DSM_MSG_REQ_WRT;
-	msg.proc.pid = getpid();
-	dsm_send_msg(g_sock_io, &msg);
-
-	// Receive write-authorization.
-	dsm_recv_msg(g_sock_io, &msg);
-	ASSERT_COND(msg.type == DSM_MSG_WRT_NOW && msg.proc.pid == getpid());
+	// Find the range spanning all modified runs. Nothing to send if none.
+	for (i = 0; i < n; i++) {
+		hole = dsm_get_hole(ids[i], &g_shm_holes);
+		if (dsm_dirty_range(hole, &offset, &size) != 0) {
+			first = MIN(first, offset);
+			last = MAX(last, offset + (off_t)size);
+		}
+	}
+	if (first >= last) {
+		return;
+	}
 
-	// Send data.
-	msg.type = DSM_MSG_WRT_DATA;
-	msg.data.offset = hole->offset;
-	msg.data.size = hole->size;
-	msg.data.buf = (void *)((intptr_t)g_shared_map + (intptr_t)hole->offset);
-	dsm_send_msg(g_sock_io, &msg);
+	// Request write-authorization (for the range).
+	dsm_sync_take(first, (size_t)(last - first));
+
+	// Send data of each modified run of each hole (as few messages as fit).
+	dsm_init_runs(&msg, buf);
+	for (i = 0; i < n; i++) {
+		hole = dsm_get_hole(ids[i], &g_shm_holes);
+		pos = 0;
+		while (dsm_next_dirty_run(hole, &pos, &offset, &size) != 0) {
+			dsm_send_run(g_sock_io, &msg, offset, size,
+				(unsigned char *)((intptr_t)g_shared_map + (intptr_t)offset));
+		}
+	}
+	dsm_send_runs(g_sock_io, &msg);
 	
 	// Signal end of data stream.
 	msg.type = DSM_MSG_WRT_END;
 	dsm_send_msg(g_sock_io, &msg);
 }
 
+// Queues the modified runs of a hole at the arbiter, and has it write them.
+static void send_fill_msgs (dsm_hole *hole) {
+	size_t pos = 0, size;
+	off_t offset;
+	dsm_msg msg;
+
+	// Queue each modified run.
+	while (dsm_next_dirty_run(hole, &pos, &offset, &size) != 0) {
+		msg.type = DSM_MSG_FILL_RUN;
+		msg.data.offset = offset;
+		msg.data.size = size;
+		dsm_send_msg(g_sock_io, &msg);
+	}
+
+	// Have the arbiter write them.
+	msg.type = DSM_MSG_FILL_END;
+	msg.proc.pid = getpid();
+	dsm_send_msg(g_sock_io, &msg);
+}
+
 // Sends exit message to arbiter.
 static void send_exit (void) {
     dsm_msg msg = {.type = DSM_MSG_EXIT};
     dsm_send_msg(g_sock_io, &msg);
 }
 
-// Receives DSM_POST_SEM from arbiter.
-static void recv_post_sem (const char *sem_name) {
+// Receives DSM_MSG_OPEN_SEM or OPEN_RWL from arbiter. Returns the handle.
+static int recv_open_msg (dsm_msg_t type) {
     dsm_msg msg;
-    UNUSED(sem_name);
 
     // Receive message.
     dsm_recv_msg(g_sock_io, &msg);
 
     // Verify.
-    ASSERT_COND(msg.type == DSM_MSG_POST_SEM && msg.sem.pid == getpid());
+    ASSERT_COND(msg.type == type && msg.name.pid == getpid());
+
+    // Return handle.
+    return msg.name.id;
 }
 
 // Receives DSM_MSG_SET_GID from arbiter. Sets the process global identifier.
@@ -163,12 +295,127 @@ static int recv_set_gid (void) {
 */
 
 
+// Blocks until the barrier generation differs from gen. Spins, then sleeps.
+static void wait_bar_gen (uint32_t gen) {
+
+	// Poll for a bit: Cheaper than a sleep if the release is imminent.
+	for (unsigned int i = 0; i < g_bar_spin; i++) {
+		if (__atomic_load_n(&g_ctrl->bar_gen, __ATOMIC_ACQUIRE) != gen) {
+			return;
+		}
+	}
+
+	// Sleep on the generation until the arbiter advances it.
+	while (__atomic_load_n(&g_ctrl->bar_gen, __ATOMIC_ACQUIRE) == gen) {
+		dsm_futexWait(&g_ctrl->bar_gen, gen);
+	}
+}
+
+// [HTAB]: Hashing routine for the semaphore handle cache.
+static unsigned int cache_hash (void *key) {
+	const char *sem_name = (const char *)key;
+	return DJBHash(sem_name, strlen(sem_name));
+}
+
+// [HTAB]: Freeing routine for the semaphore handle cache.
+static void cache_free (void *data) {
+	free(data);
+}
+
+// [HTAB]: Debugging/printing routine for the semaphore handle cache.
+static void cache_show (void *data) {
+	dsm_sem_entry *entry = (dsm_sem_entry *)data;
+	printf("ID: %s, Handle: %d", entry->name, entry->sem_id);
+}
+
+// [HTAB]: Key to data comparison routine for the semaphore handle cache.
+static int cache_comp (void *key, void *data) {
+	dsm_sem_entry *entry = (dsm_sem_entry *)data;
+	return (strcmp((const char *)key, entry->name) == 0);
+}
+
+// Returns nonzero if the sync request with the given ticket has completed.
+static int sync_ticket_done (uint32_t ticket) {
+	uint32_t done = __atomic_load_n(&g_slot->sync_done, __ATOMIC_ACQUIRE);
+	return (int32_t)(done - ticket) >= 0;
+}
+
+// Returns nonzero if (lhs <op> rhs) holds. Panics on unknown operator.
+static int cmp_holds (int lhs, dsm_cmp_t op, int rhs) {
+	switch (op) {
+		case DSM_CMP_EQ: return lhs == rhs;
+		case DSM_CMP_NE: return lhs != rhs;
+		case DSM_CMP_LT: return lhs < rhs;
+		case DSM_CMP_LE: return lhs <= rhs;
+		case DSM_CMP_GT: return lhs > rhs;
+		case DSM_CMP_GE: return lhs >= rhs;
+		default:
+			dsm_panicf("Unknown comparison: %d!", op);
+	}
+	return 0;
+}
+
+// Returns nonzero if a buffer overlaps the shared map.
+static int is_map_buf (const void *buf, size_t len) {
+	return (intptr_t)buf < (intptr_t)g_shared_map + (intptr_t)g_map_size &&
+		(intptr_t)buf + (intptr_t)len > (intptr_t)g_shared_map;
+}
+
+/* Returns nonzero if a buffer overlaps the shared map, and pages are fetched
+ * lazily. The kernel can't access such buffers, as it doesn't fault pages in
+ * (and they may be dropped at any time). They are copied instead.
+*/
+static int is_lazy_buf (const void *buf, size_t len) {
+	return g_lazy_pages != 0 && is_map_buf(buf, len);
+}
+
+// Panics if the given GID isn't a valid root for a collective operation.
+static void check_root (int root) {
+	if (root < 0 || (unsigned int)root >= g_nproc) {
+		dsm_panicf("Bad root: %d not in [0, %u)!", root, g_nproc);
+	}
+}
+
+/* Returns the ticket for a new sync request. Panics if one is outstanding. A
+ * hole fill is completed first: The arbiter tracks one request per process.
+*/
+static uint32_t next_sync_ticket (void) {
+	if (g_fill_pending != 0) {
+		dsm_wait_fill((int)g_fill_ticket);
+	}
+	if (!sync_ticket_done(g_sync_ticket)) {
+		dsm_panic("Can't issue request: A sync request is outstanding!");
+	}
+	return ++g_sync_ticket;
+}
+
+// Returns the control slot assigned to the calling process. Panics if none.
+static dsm_ctrl_slot *get_ctrl_slot (void) {
+	for (unsigned int i = 0; i < DSM_CTRL_MAX_SLOTS; i++) {
+		if (g_ctrl->slots[i].pid == getpid()) {
+			return g_ctrl->slots + i;
+		}
+	}
+	dsm_panicf("No control slot assigned to process %d!", getpid());
+	return NULL;
+}
+
 // Launches the arbiter and its cleanup daemon.
 static void fork_arbiter (dsm_cfg *cfg) {
 	int pid;
 	char proc_buf[6] = {0}, size_buf[11] = {0};
+	char writes_buf[11] = {0}, ms_buf[11] = {0}, owner_buf[2] = {0};
+	char lazy_buf[2] = {0}, peer_buf[2] = {0};
+	char policy_buf[11] = {0}, param_buf[11] = {0};
 	snprintf(proc_buf, 6, "%u", cfg->tproc);
 	snprintf(size_buf, 11, "%zu", cfg->map_size);
+	snprintf(writes_buf, 11, "%u", cfg->lease_writes);
+	snprintf(ms_buf, 11, "%u", cfg->lease_ms);
+	snprintf(owner_buf, 2, "%u", (cfg->page_owner != 0));
+	snprintf(lazy_buf, 2, "%u", (cfg->lazy_pages != 0));
+	snprintf(peer_buf, 2, "%u", (cfg->peer_data != 0));
+	snprintf(policy_buf, 11, "%u", cfg->grant_policy);
+	snprintf(param_buf, 11, "%u", cfg->grant_param);
 
 	// Fork once and exit to orphan arbiter to init.
 	if ((pid = dsm_fork()) == 0) {
@@ -177,7 +424,8 @@ static void fork_arbiter (dsm_cfg *cfg) {
 		if (dsm_fork() == 0) {
 			setsid();
 			execlp("dsm_arbiter", "dsm_arbiter", proc_buf, cfg->sid_name,
-				cfg->d_addr, cfg->d_port, size_buf, NULL);
+				cfg->d_addr, cfg->d_port, size_buf, writes_buf, ms_buf,
+				owner_buf, lazy_buf, peer_buf, policy_buf, param_buf, NULL);
 			dsm_panic("Bad execlp for dsm_arbiter. Can it be found in PATH?");
 		}
 
@@ -206,11 +454,34 @@ void *dsm_init2 (dsm_cfg *cfg) {
     // Verify: Initializer not already called.
     ASSERT_STATE(g_sock_io == -1 || g_shared_map == NULL);
 
+	// Peer data relies on the server ordering all writes (see dsm_cfg).
+	if (cfg->peer_data != 0 && (cfg->lease_writes != 0 ||
+		cfg->page_owner != 0 || cfg->lazy_pages != 0)) {
+		dsm_panic("Peer data excludes leases, page ownership and lazy pages!");
+	}
+
+	// Verify the write-grant policy.
+	if (cfg->grant_policy > DSM_GRANT_FAIR) {
+		dsm_panic("Unknown write-grant policy!");
+	}
+
 	// Fork and exec arbiter.
 	fork_arbiter(cfg);
 
-	// Set local process count.
+	// Set local and total process count.
 	g_lproc = cfg->lproc;
+	g_nproc = cfg->tproc;
+
+	// Set barrier spin count.
+	g_bar_spin = cfg->bar_spin;
+
+	// Set write mode (must match all other processes of the session).
+	g_page_owner = (cfg->page_owner != 0);
+	g_lazy_pages = (cfg->lazy_pages != 0);
+
+	// Initialize semaphore handle cache.
+	g_sem_cache = dsm_initHashTable(DSM_SEM_CACHE_LENGTH, cache_hash,
+		cache_free, cache_show, cache_comp);
 
 	// Perform local forks.
 	for (unsigned int rank = 1; rank < g_lproc; rank++) {
@@ -245,6 +516,11 @@ void *dsm_init2 (dsm_cfg *cfg) {
 	// Map shared file to memory.
 	g_shared_map = dsm_mapSharedFile(fd, g_map_size, PROT_READ|PROT_WRITE);
 
+	// Open and map the control file (created by arbiter).
+	fd = dsm_getSharedFile(DSM_CTRL_FILE_NAME, &first);
+	ASSERT_COND(first == 0);
+	g_ctrl = dsm_mapSharedFile(fd, DSM_CTRL_FILE_SIZE, PROT_READ|PROT_WRITE);
+
     // Send check-in message.
     send_add_pid();
 
@@ -254,16 +530,19 @@ void *dsm_init2 (dsm_cfg *cfg) {
     // Install signal handlers (save old ones).
     dsm_sigaction(SIGSEGV, dsm_sync_sigsegv, g_old_actions);
     dsm_sigaction(SIGILL, dsm_sync_sigill, g_old_actions + 1);
+    dsm_sigaction_restart(DSM_CTRL_INV_SIGNAL, dsm_sync_siginv,
+		g_old_actions + 2);
 
-	// Restore default behavior for SIGTSTP during session.
-	dsm_sigdefault(SIGTSTP, g_old_actions + 2);
-
-    // Protect shared page.
-    dsm_mprotect(g_shared_map, g_map_size, PROT_READ);
+    // Protect shared page (no pages are resident yet, if fetched lazily).
+    dsm_mprotect(g_shared_map, g_map_size, g_lazy_pages ? PROT_NONE :
+		PROT_READ);
 
     // Block until start signal (set_gid) is received.
     g_gid = recv_set_gid();
 
+	// Locate control slot (assigned by the arbiter at check-in).
+	g_slot = get_ctrl_slot();
+
     // Return shared map pointer.
     return g_shared_map;
 }
@@ -285,7 +564,15 @@ void *dsm_init (const char *sid, unsigned int lproc, unsigned int tproc,
 		.sid_name = sid,
 		.d_addr = "127.0.0.1",
 		.d_port = "4200",
-		.map_size = map_size
+		.map_size = map_size,
+		.bar_spin = 0,
+		.lease_writes = 0,
+		.lease_ms = 0,
+		.page_owner = 0,
+		.lazy_pages = 0,
+		.peer_data = 0,
+		.grant_policy = DSM_GRANT_FIFO,
+		.grant_param = 0
 	};
 
 	return dsm_init2(&cfg);
@@ -298,10 +585,93 @@ int dsm_get_gid (void) {
 
 // Blocks process until all other processes are synchronized at the same point.
 void dsm_barrier (void) {
-    send_hit_bar();
-    if (kill(getpid(), SIGTSTP) != 0) {
-		dsm_panic("Couldn't block on barrier!");
+	dsm_barrier_arrive();
+	dsm_barrier_wait();
+}
+
+/*
+ * Signals arrival at a barrier without blocking. The process may continue
+ * with local work, but must call dsm_barrier_wait before arriving again.
+*/
+void dsm_barrier_arrive (void) {
+
+	// Verify: Not already arrived.
+	ASSERT_STATE(g_bar_arrived == 0);
+
+	// Complete any outstanding hole fill, so it is visible past the barrier.
+	if (g_fill_pending != 0) {
+		dsm_wait_fill((int)g_fill_ticket);
+	}
+
+	// Generation must be read before arriving, or the release could be missed.
+	g_bar_gen = __atomic_load_n(&g_ctrl->bar_gen, __ATOMIC_ACQUIRE);
+	g_bar_arrived = 1;
+	send_hit_bar();
+}
+
+// Blocks until the barrier signalled by dsm_barrier_arrive is released.
+void dsm_barrier_wait (void) {
+
+	// Verify: Arrived at barrier.
+	ASSERT_STATE(g_bar_arrived == 1);
+
+	wait_bar_gen(g_bar_gen);
+	g_bar_arrived = 0;
+}
+
+/*
+ * Returns a handle to named semaphore. Target created if nonexistent. The 
+ * name is resolved by the server once, and then cached.
+ * - sem_name: Named semaphore identifier.
+*/
+int dsm_sem_open (const char *sem_name) {
+	dsm_sem_entry *entry;
+	size_t size;
+
+	// Return cached handle if known.
+	if ((entry = dsm_getHashTableEntry(g_sem_cache, (void *)sem_name)) 
+		!= NULL) {
+		return entry->sem_id;
 	}
+
+	// Otherwise resolve the handle at the server.
+	send_open_msg(DSM_MSG_OPEN_SEM, sem_name, 0);
+
+	// Cache it.
+	size = strlen(sem_name) + 1;
+	entry = dsm_zalloc(sizeof(dsm_sem_entry) + size);
+	entry->sem_id = recv_open_msg(DSM_MSG_OPEN_SEM);
+	memcpy(entry->name, sem_name, size);
+	dsm_setHashTableEntry(g_sem_cache, entry->name, entry);
+
+	return entry->sem_id;
+}
+
+/*
+ * Performs a post (up) on a semaphore.
+ * - sem_id: The handle returned from dsm_sem_open.
+*/
+void dsm_sem_post (int sem_id) {
+    send_sem_msg(DSM_MSG_POST_SEM, sem_id);
+}
+
+/*
+ * Performs a wait (down) on a semaphore.
+ * - sem_id: The handle returned from dsm_sem_open.
+*/
+void dsm_sem_wait (int sem_id) {
+	dsm_sync_wait(dsm_sem_wait_async(sem_id));
+}
+
+/*
+ * Issues a wait (down) on a semaphore without blocking. Returns a handle
+ * for dsm_sync_test and dsm_sync_wait. Only one request may be outstanding.
+ * - sem_id: The handle returned from dsm_sem_open.
+*/
+int dsm_sem_wait_async (int sem_id) {
+	uint32_t ticket = next_sync_ticket();
+    send_sem_msg(DSM_MSG_WAIT_SEM, sem_id);
+	return (int)ticket;
 }
 
 /*
@@ -309,7 +679,7 @@ void dsm_barrier (void) {
  * - sem_name: Named semaphore identifier.
 */
 void dsm_post_sem (const char *sem_name) {
-    send_sem_msg(DSM_MSG_POST_SEM, sem_name);
+	dsm_sem_post(dsm_sem_open(sem_name));
 }
 
 /*
@@ -317,10 +687,396 @@ void dsm_post_sem (const char *sem_name) {
  * - sem_name: Named semaphore identifier.
 */
 void dsm_wait_sem (const char *sem_name) {
-    send_sem_msg(DSM_MSG_WAIT_SEM, sem_name);
-    recv_post_sem(sem_name);
+	dsm_sem_wait(dsm_sem_open(sem_name));
+}
+
+/*
+ * Issues a wait (down) on named semaphore without blocking. Returns a handle
+ * for dsm_sync_test and dsm_sync_wait. Only one request may be outstanding.
+ * - sem_name: Named semaphore identifier.
+*/
+int dsm_wait_sem_async (const char *sem_name) {
+	return dsm_sem_wait_async(dsm_sem_open(sem_name));
+}
+
+/*
+ * Sleeps until a shared word equals the expected value. The word is rechecked
+ * whenever a local or remote write to it is applied.
+ * - addr:     Address of the (aligned) word. Must be in shared memory map.
+ * - expected: Value to wait for.
+*/
+void dsm_wait_until (volatile int *addr, int expected) {
+	dsm_wait_until_op(addr, DSM_CMP_EQ, expected);
+}
+
+/*
+ * Sleeps until (*addr <op> value) holds for a shared word.
+ * - addr:  Address of the (aligned) word. Must be in shared memory map.
+ * - op:    The comparison. See dsm_cmp_t.
+ * - value: Right-hand operand of the comparison.
+*/
+void dsm_wait_until_op (volatile int *addr, dsm_cmp_t op, int value) {
+	intptr_t offset = (intptr_t)addr - (intptr_t)g_shared_map;
+	int current;
+
+	// Ensure word is aligned, and in shared memory space.
+	if (offset < 0 || offset + (intptr_t)sizeof(int) > (intptr_t)g_map_size ||
+		offset % sizeof(int) != 0) {
+		dsm_panicf("Bad wait address: %p not an aligned word in [%p->%p)!",
+			(void *)addr, g_shared_map,
+			(void *)((intptr_t)g_shared_map + (intptr_t)g_map_size));
+	}
+
+	// Write out any automatic hole, as others may be waiting on it.
+	dsm_sync_flush();
+
+	// Return immediately if the condition already holds.
+	if (cmp_holds(*addr, op, value)) {
+		return;
+	}
+
+	// Publish the watch before sampling, so the arbiter can't miss a write.
+	__atomic_store_n(&g_slot->watch, (int64_t)offset, __ATOMIC_SEQ_CST);
+
+	// Sleep until a write changes the word such that the condition holds.
+	while (!cmp_holds((current = __atomic_load_n(addr, __ATOMIC_SEQ_CST)),
+		op, value)) {
+		dsm_futexWait((volatile uint32_t *)addr, (uint32_t)current);
+	}
+
+	// Remove the watch.
+	__atomic_store_n(&g_slot->watch, DSM_CTRL_NO_WATCH, __ATOMIC_RELEASE);
+}
+
+/*
+ * Returns a handle to named reader-writer lock. Target created if nonexistent.
+ * - name:          Named lock identifier.
+ * - prefer_writer: If nonzero, new readers queue behind waiting writers. Only
+ *                  applied by the process that creates the lock.
+*/
+int dsm_rwlock_open (const char *name, int prefer_writer) {
+	send_open_msg(DSM_MSG_OPEN_RWL, name, prefer_writer != 0);
+	return recv_open_msg(DSM_MSG_OPEN_RWL);
+}
+
+/*
+ * Acquires lock for reading (shared with other readers). Blocks until granted.
+ * - lock_id: The handle returned from dsm_rwlock_open.
+*/
+void dsm_rwlock_rdlock (int lock_id) {
+	uint32_t ticket = next_sync_ticket();
+	send_lock_msg(DSM_MSG_RD_LOCK, lock_id);
+	dsm_sync_wait((int)ticket);
+}
+
+/*
+ * Acquires lock for writing (exclusive). Blocks until granted.
+ * - lock_id: The handle returned from dsm_rwlock_open.
+*/
+void dsm_rwlock_wrlock (int lock_id) {
+	uint32_t ticket = next_sync_ticket();
+	send_lock_msg(DSM_MSG_WR_LOCK, lock_id);
+	dsm_sync_wait((int)ticket);
+}
+
+/*
+ * Releases a read or write lock held by the calling process.
+ * - lock_id: The handle returned from dsm_rwlock_open.
+*/
+void dsm_rwlock_unlock (int lock_id) {
+	send_lock_msg(DSM_MSG_RW_UNLOCK, lock_id);
+}
+
+/*
+ * Sends a buffer to the process with the given GID. Returns once the data is
+ * handed to the arbiter. The data bypasses the shared map and write order.
+ * - gid: Receiving process.
+ * - buf: The data.
+ * - len: Size of the data (in bytes).
+*/
+void dsm_send (int gid, const void *buf, size_t len) {
+	dsm_msg msg = {.type = DSM_MSG_P2P_DATA};
+	unsigned char chunk[DSM_MAX_DATA_SIZE];
+	int is_copied = is_lazy_buf(buf, len);
+	size_t size;
+
+	msg.p2p.src_gid = g_gid;
+	msg.p2p.dst_gid = gid;
+
+	// Write out any automatic hole (the receiver may read the map next).
+	dsm_sync_flush();
+
+	// Send in chunks that fit a single message (copied, if need be).
+	for (size_t off = 0; off < len; off += size) {
+		size = MIN(len - off, DSM_MAX_DATA_SIZE);
+		msg.p2p.size = size;
+		msg.p2p.buf = (unsigned char *)buf + off;
+		if (is_copied) {
+			msg.p2p.buf = memcpy(chunk, msg.p2p.buf, size);
+		}
+		dsm_send_msg(g_sock_io, &msg);
+	}
+}
+
+/*
+ * Blocks until len bytes from the process with the given GID are received.
+ * Data from each sender arrives in order, regardless of the send sizes.
+ * - gid: Sending process.
+ * - buf: Buffer to receive into.
+ * - len: Number of bytes to receive.
+*/
+void dsm_recv (int gid, void *buf, size_t len) {
+	dsm_msg msg = {.type = DSM_MSG_P2P_RECV};
+	unsigned char *dst = buf;
+	size_t received = 0;
+
+	// Nothing to receive.
+	if (len == 0) {
+		return;
+	}
+
+	// Receive into a copy if the buffer is in the shared map: Writing to it
+	// (or fetching its pages) while data arrives would interleave the replies
+	// with the data.
+	if (is_map_buf(buf, len) && (dst = malloc(len)) == NULL) {
+		dsm_panic("dsm_recv: Allocation failed!");
+	}
+
+	// Register the receive with the arbiter.
+	msg.p2p.src_gid = gid;
+	msg.p2p.dst_gid = g_gid;
+	msg.p2p.size = len;
+	dsm_send_msg(g_sock_io, &msg);
+
+	// Collect the data as it is delivered.
+	while (received < len) {
+		dsm_recv_msg(g_sock_io, &msg);
+		ASSERT_COND(msg.type == DSM_MSG_P2P_DATA && msg.p2p.src_gid == gid &&
+			msg.p2p.size > 0 && (size_t)msg.p2p.size <= len - received);
+		memcpy(dst + received, msg.p2p.buf, msg.p2p.size);
+		received += msg.p2p.size;
+	}
+
+	// Copy the data into the buffer (once the socket is quiet).
+	if (dst != buf) {
+		memcpy(buf, dst, len);
+		free(dst);
+	}
+}
+
+/*
+ * Copies len bytes at addr on the root process to addr on all processes. The
+ * data is pipelined along a chain of all processes (also those sharing a
+ * host) in chunks. Taking about len / bandwidth for any number of hosts needs
+ * peer data (see dsm_cfg): Chunks between hosts then go straight to the peer
+ * arbiter. Otherwise they go through the server, whose link carries them
+ * twice per host after the first. Must be called by all processes.
+ * - addr: Buffer to send (root) or receive into (others).
+ * - len:  Size of the buffer (in bytes).
+ * - root: GID of the sending process.
+*/
+void dsm_bcast (void *addr, size_t len, int root) {
+	unsigned int n = g_nproc, pos;
+	int prev, next;
+	size_t size;
+
+	// Verify root.
+	check_root(root);
+
+	// Position in the chain starting at root.
+	pos = (g_gid - root + n) % n;
+	prev = (int)((g_gid + n - 1) % n);
+	next = (pos + 1 < n) ? (int)((g_gid + 1) % n) : -1;
+
+	// Receive each chunk from the predecessor, and forward it right away.
+	for (size_t off = 0; off < len; off += size) {
+		size = MIN(len - off, DSM_BCAST_CHUNK);
+
+		if (pos > 0) {
+			dsm_recv(prev, (unsigned char *)addr + off, size);
+		}
+
+		if (next != -1) {
+			dsm_send(next, (unsigned char *)addr + off, size);
+		}
+	}
+}
+
+/*
+ * Distributes consecutive blocks of len bytes from sendbuf on the root process
+ * to recvbuf on each process, in order of GID. Must be called by all processes.
+ * - sendbuf: Blocks for all processes (root only, otherwise ignored).
+ * - recvbuf: Buffer to receive the block into.
+ * - len:     Size of a block (in bytes).
+ * - root:    GID of the sending process.
+*/
+void dsm_scatter (const void *sendbuf, void *recvbuf, size_t len,
+	int root) {
+
+	// Verify root.
+	check_root(root);
+
+	// Not root: Receive own block.
+	if (g_gid != root) {
+		dsm_recv(root, recvbuf, len);
+		return;
+	}
+
+	// Root: Send each block to its process. Keep own block.
+	for (unsigned int i = 0; i < g_nproc; i++) {
+		const unsigned char *block = (const unsigned char *)sendbuf + i * len;
+		if ((int)i == root) {
+			memmove(recvbuf, block, len);
+		} else {
+			dsm_send(i, block, len);
+		}
+	}
+}
+
+/*
+ * Collects len bytes of sendbuf from each process into consecutive blocks of
+ * recvbuf on the root process, in order of GID. Must be called by all
+ * processes.
+ * - sendbuf: Block to send.
+ * - recvbuf: Buffer for all blocks (root only, otherwise ignored).
+ * - len:     Size of a block (in bytes).
+ * - root:    GID of the receiving process.
+*/
+void dsm_gather (const void *sendbuf, void *recvbuf, size_t len,
+	int root) {
+
+	// Verify root.
+	check_root(root);
+
+	// Not root: Send own block.
+	if (g_gid != root) {
+		dsm_send(root, sendbuf, len);
+		return;
+	}
+
+	// Root: Receive each block from its process. Copy own block.
+	for (unsigned int i = 0; i < g_nproc; i++) {
+		unsigned char *block = (unsigned char *)recvbuf + i * len;
+		if ((int)i == root) {
+			memmove(block, sendbuf, len);
+		} else {
+			dsm_recv(i, block, len);
+		}
+	}
+}
+
+/*
+ * Returns nonzero if the operation of the given handle has completed.
+ * - handle: The handle returned from dsm_wait_sem_async.
+*/
+int dsm_sync_test (int handle) {
+	return sync_ticket_done((uint32_t)handle);
+}
+
+/*
+ * Blocks until the operation of the given handle has completed.
+ * - handle: The handle returned from dsm_wait_sem_async.
+*/
+void dsm_sync_wait (int handle) {
+	uint32_t done;
+
+	// Sleep on the completion counter until the ticket is reached.
+	while ((int32_t)((done = __atomic_load_n(&g_slot->sync_done, 
+		__ATOMIC_ACQUIRE)) - (uint32_t)handle) < 0) {
+		dsm_futexWait(&g_slot->sync_done, done);
+	}
+}
+
+
+// Returns the heap of the process. Creates it over its arena on first use.
+static dsm_heap *get_heap (void) {
+	size_t pagesize = DSM_PAGESIZE;
+
+	// Verify the map exists (and so the number of processes is known).
+	if (g_shared_map == NULL) {
+		dsm_panic("Can't allocate shared memory before dsm_init!");
+	}
+
+	if (g_heap != NULL) {
+		return g_heap;
+	}
+
+	// By default: An equal share of the map, by GID.
+	if (g_arena_size == 0) {
+		g_arena_size = (size_t)g_map_size / pagesize / g_nproc * pagesize;
+		g_arena_base = (void *)((uintptr_t)g_shared_map +
+			g_gid * g_arena_size);
+	}
+
+	return (g_heap = dsm_new_heap(g_arena_base, g_arena_size / pagesize,
+		pagesize));
 }
 
+/*
+ * Sets the range of the shared map the calling process allocates from, in
+ * place of an equal share of the map by GID. A block may then be as large as
+ * the range. Must be called before the first allocation. Default arenas
+ * together cover the map: A program that also carves offsets by hand sets the
+ * arenas of allocating processes to ranges outside those offsets.
+ * - addr: Start of the range (page aligned, in the shared map).
+ * - size: Size of the range (in bytes, a multiple of the page size).
+*/
+void dsm_set_arena (void *addr, size_t size) {
+	intptr_t offset = (intptr_t)addr - (intptr_t)g_shared_map;
+	size_t pagesize = DSM_PAGESIZE;
+
+	// Verify the map exists, and nothing was allocated yet.
+	if (g_shared_map == NULL || g_heap != NULL) {
+		dsm_panic("Can't set arena: Call after dsm_init, before dsm_malloc!");
+	}
+
+	// Verify the range is whole pages of the map.
+	if (size == 0 || offset < 0 || offset % pagesize != 0 ||
+		size % pagesize != 0 || offset + size > (size_t)g_map_size) {
+		dsm_panicf("Bad arena: [%p->%p) not whole pages of [%p->%p)!",
+			addr, (void *)((intptr_t)addr + size), g_shared_map,
+			(void *)((intptr_t)g_shared_map + g_map_size));
+	}
+
+	g_arena_base = addr;
+	g_arena_size = size;
+}
+
+/*
+ * Allocates size bytes of shared memory. Each process allocates from its own
+ * arena (see dsm_set_arena), so allocation takes no write token. Returns NULL
+ * if size is zero, or the arena is exhausted. Panics before dsm_init.
+ * - size: Size (in bytes) of the block.
+*/
+void *dsm_malloc (size_t size) {
+	return dsm_malloc_aligned(size, DSM_ALIGN_MIN);
+}
+
+/*
+ * Allocates size bytes of shared memory, aligned to align. Blocks aligned to
+ * DSM_ALIGN_CACHE or DSM_ALIGN_PAGE share no cache line or page with others.
+ * - size:  Size (in bytes) of the block.
+ * - align: Alignment (a power of two, at most DSM_ALIGN_PAGE).
+*/
+void *dsm_malloc_aligned (size_t size, size_t align) {
+	return dsm_heap_alloc(get_heap(), size, align);
+}
+
+/*
+ * Frees shared memory. Only the allocating process may free a block.
+ * - ptr: Block returned from dsm_malloc, or NULL.
+*/
+void dsm_free (void *ptr) {
+
+	// Ignore NULL.
+	if (ptr == NULL) {
+		return;
+	}
+
+	if (g_heap == NULL || dsm_heap_release(g_heap, ptr) != 0) {
+		dsm_panicf("Bad dsm_free: %p wasn't allocated by this process!", ptr);
+	}
+}
 
 /*
  * Creates a hole in the shared memory space. Returns a positive hole ID
@@ -337,6 +1093,9 @@ int dsm_dig_hole (void *addr, size_t size) {
 	intptr_t length = (intptr_t)size;
 	int id;
 
+	// Write out any automatic hole, which may overlap the new one.
+	dsm_sync_flush();
+
 	// Ensure size is reasonable.
 	if (size == 0 || size > (size_t)g_map_size) {
 		dsm_panicf("Bad hole size: (%zu == 0 || %zu > (%zu <- max))!",
@@ -351,7 +1110,7 @@ int dsm_dig_hole (void *addr, size_t size) {
 	}
 
 	// Ensure hole doesn't overlap with another hole.
-	if (dsm_overlaps_hole(offset, size, g_shm_holes) != 0) {
+	if (dsm_overlaps_hole(offset, size, &g_shm_holes) != 0) {
 		dsm_panicf("Hole with range: [%p->%p) overlaps existing hole!",
 			addr, (intptr_t)addr + (intptr_t)size);
 	}
@@ -367,25 +1126,137 @@ int dsm_dig_hole (void *addr, size_t size) {
 
 /*
  * Fills a hole in the shared memory space. Panics on error.
- * Filling a hole results in the hole memory space being
- * synchronized. The hole then no longer exists.
+ * Filling a hole results in the modified parts of the hole memory
+ * space being synchronized. The hole then no longer exists.
  * - id: The hole ID returned from dsm_dig_hole.
 */
 void dsm_fill_hole (int id) {
+	dsm_fill_holes(&id, 1);
+}
+
+/*
+ * Fills several holes at once. Panics on error. The modified parts of all
+ * holes are synchronized as a single write, so the write token is requested
+ * (and the write acknowledged) once, rather than once per hole.
+ * - ids: The (distinct) hole IDs returned from dsm_dig_hole.
+ * - n:   The number of hole IDs.
+*/
+void dsm_fill_holes (const int *ids, size_t n) {
+
+	// Ensure holes exist.
+	for (size_t i = 0; i < n; i++) {
+		if (dsm_get_hole(ids[i], &g_shm_holes) == NULL) {
+			dsm_panicf("Can't fill hole! No hole exists with ID %d!", ids[i]);
+		}
+	}
+
+	// Synchronize data across all hole ranges (after any automatic hole).
+	dsm_sync_flush();
+	send_hole_data(ids, n);
+
+	// Ensure holes were successfully removed.
+	for (size_t i = 0; i < n; i++) {
+		if (dsm_del_hole(ids[i], &g_shm_holes) != 0) {
+			dsm_panicf("Can't fill hole! Bad deletion of ID %d!", ids[i]);
+		}
+	}
+}
+
+/*
+ * Fills a hole without blocking. Returns a handle for dsm_wait_fill. The
+ * arbiter writes the modified parts of the hole straight from the shared map
+ * once it holds the write token, so the caller may go on computing. The hole
+ * no longer exists, but its range must not be dug again before completion.
+ * The next fill, sync request or barrier first completes the fill.
+ * - id: The hole ID returned from dsm_dig_hole.
+*/
+int dsm_fill_hole_async (int id) {
+	uint32_t ticket = next_sync_ticket();
 	dsm_hole *hole;
 
+	// Write any automatic hole first. Removing it moves the others, so only
+	// look up the hole afterwards.
+	dsm_sync_flush();
+
 	// Ensure hole exists.
-	if ((hole = dsm_get_hole(id, g_shm_holes)) == NULL) {
+	if ((hole = dsm_get_hole(id, &g_shm_holes)) == NULL) {
 		dsm_panicf("Can't fill hole! No hole exists with ID %d!", id);
 	}
 
-	// Synchronize data across hole range.
-	send_hole_data(hole);
+	// Hand the modified runs to the arbiter.
+	send_fill_msgs(hole);
+	g_fill_ticket = ticket;
+	g_fill_pending = 1;
 
 	// Ensure hole was successfully removed.
 	if (dsm_del_hole(id, &g_shm_holes) != 0) {
 		dsm_panicf("Can't fill hole! Bad deletion of ID %d!", id);
 	}
+
+	return (int)ticket;
+}
+
+/*
+ * Blocks until the fill of the given handle has completed.
+ * - handle: The handle returned from dsm_fill_hole_async.
+*/
+void dsm_wait_fill (int handle) {
+	dsm_sync_wait(handle);
+
+	// The last fill is complete once any later one is.
+	if ((int32_t)((uint32_t)handle - g_fill_ticket) >= 0) {
+		g_fill_pending = 0;
+	}
+}
+
+/*
+ * Sets the write protocol of the pages spanning a range of the shared map.
+ * By default, each page switches between updates and invalidation by itself,
+ * depending on how it is shared. Only has effect if pages are fetched lazily
+ * (see dsm_cfg), as only such hosts can drop pages.
+ * - addr:  Start of the range (must be in shared memory map).
+ * - size:  The size (in bytes) of the range. Must be > 0.
+ * - proto: The protocol. See dsm_proto_t.
+*/
+void dsm_set_protocol (void *addr, size_t size, dsm_proto_t proto) {
+	intptr_t offset = (intptr_t)addr - (intptr_t)g_shared_map;
+	dsm_msg msg = {.type = DSM_MSG_SET_PROTO};
+
+	// Ensure range in shared memory space.
+	if (size == 0 || offset < 0 || offset + (intptr_t)size >
+		(intptr_t)g_map_size) {
+		dsm_panicf("Bad protocol range: [%p->%p) not in [%p->%p)!",
+			addr, (intptr_t)addr + (intptr_t)size, g_shared_map,
+			(intptr_t)g_shared_map + (intptr_t)g_map_size);
+	}
+
+	// Have the server apply it (it keeps the pages of lazy hosts).
+	msg.own.pid = getpid();
+	msg.own.proto = (int32_t)proto;
+	msg.own.offset = (int64_t)offset;
+	msg.own.size = (int64_t)size;
+	dsm_send_msg(g_sock_io, &msg);
+}
+
+// Subscribes this host to the pages of a range (see dsm.h).
+void dsm_subscribe (void *addr, size_t size) {
+	intptr_t offset = (intptr_t)addr - (intptr_t)g_shared_map;
+	dsm_msg msg = {.type = DSM_MSG_SUBSCRIBE};
+
+	// Ensure range in shared memory space.
+	if (size == 0 || offset < 0 || offset + (intptr_t)size >
+		(intptr_t)g_map_size) {
+		dsm_panicf("Bad subscription range: [%p->%p) not in [%p->%p)!",
+			addr, (intptr_t)addr + (intptr_t)size, g_shared_map,
+			(intptr_t)g_shared_map + (intptr_t)g_map_size);
+	}
+
+	// Fetch the pages (if lazy), then have the server keep them updated.
+	dsm_sync_fetch((off_t)offset, size);
+	msg.own.pid = getpid();
+	msg.own.offset = (int64_t)offset;
+	msg.own.size = (int64_t)size;
+	dsm_send_msg(g_sock_io, &msg);
 }
 
 // Disconnects from DSM. Unmaps shared memory. Collects local process forks.
@@ -394,7 +1265,6 @@ void dsm_exit (void) {
 	// Restore original signal handlers.
     dsm_sigaction_restore(SIGSEGV, g_old_actions);
     dsm_sigaction_restore(SIGILL, g_old_actions + 1);
-	dsm_sigaction_restore(SIGTSTP, g_old_actions + 2);
 
     // Verify: Initializer has been called.
     ASSERT_STATE(g_sock_io != -1 && g_shared_map != NULL);
@@ -402,6 +1272,9 @@ void dsm_exit (void) {
     // Exit synchronization.
     dsm_barrier();
 
+	// Restore the invalidation handler (nobody writes past the barrier).
+	dsm_sigaction_restore(DSM_CTRL_INV_SIGNAL, g_old_actions + 2);
+
     // Send exit message.
     send_exit();
 
@@ -417,11 +1290,29 @@ void dsm_exit (void) {
     }
 
 	// Free the shared memory holes.
-	dsm_free_holes(g_shm_holes);
+	dsm_free_holes(&g_shm_holes);
+
+	// Free the heap metadata (the next session has a default arena).
+	dsm_free_heap(g_heap);
+	g_heap = NULL;
+	g_arena_size = 0;
+
+	// Free the semaphore handle cache.
+	dsm_freeHashTable(g_sem_cache);
+	g_sem_cache = NULL;
 
     // Reset shared map pointer.
     g_shared_map = NULL;
 
+	// Unmap control file.
+	if (munmap(g_ctrl, DSM_CTRL_FILE_SIZE) == -1) {
+		dsm_panic("Couldn't unmap control file!");
+	}
+
+	// Reset control page and slot pointers.
+	g_ctrl = NULL;
+	g_slot = NULL;
+
 	// Collect zombies.
 	if (g_lrank == 0) {
 		while (--g_lproc) {
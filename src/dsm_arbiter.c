@@ -2,12 +2,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <signal.h>
+#include <limits.h>
 #include <sys/mman.h>
 #include <sys/wait.h>
 #include <semaphore.h>
 
 #include "dsm_arbiter.h"
+#include "dsm_ctrl.h"
 #include "dsm_util.h"
 #include "dsm_msg.h"
 #include "dsm_poll.h"
@@ -29,6 +30,159 @@
 // Minimum number of concurrent pollable connections.
 #define DSM_MIN_POLLABLE		32
 
+// Minimum number of semaphore cohorts.
+#define DSM_MIN_COHORTS			32
+
+// Consecutive local handoffs of a semaphore before it returns to server.
+#define DSM_MAX_HANDOFF			8
+
+// Minimum number of reader-writer lock cohorts.
+#define DSM_MIN_RWCOHORTS		32
+
+// Minimum number of point-to-point mailboxes.
+#define DSM_MIN_MAILBOXES		32
+
+// Poll timeout (ms) while local processes apply invalidations.
+#define DSM_INV_POLL_MS			1
+
+
+/*
+ *******************************************************************************
+ *                              Type Definitions                               *
+ *******************************************************************************
+*/
+
+
+// FIFO queue of waiting processes, linked through dsm_proc.sem_next.
+typedef struct dsm_waitq {
+    dsm_proc *head;                 // First (longest) waiting process.
+    dsm_proc *tail;                 // Last waiting process.
+} dsm_waitq;
+
+
+/* Local waiters on a semaphore (by handle). At most one local waiter (the 
+ * requester) has a wait outstanding at the server. Units released locally
+ * are handed to the other waiters, bounded by DSM_MAX_HANDOFF.
+*/
+typedef struct dsm_cohort {
+    int requester;                  // PID with wait at server (0 if none).
+    unsigned int nhandoff;          // Consecutive local handoffs.
+    dsm_waitq queue;                // Waiting processes.
+} dsm_cohort;
+
+
+// States of the read grant an arbiter holds on a reader-writer lock.
+typedef enum {
+    DSM_RD_NONE,                    // No read grant.
+    DSM_RD_REQUESTED,               // Read grant requested from server.
+    DSM_RD_HELD                     // Read grant held.
+} dsm_rd_state;
+
+
+/* Local users of a reader-writer lock (by handle). All local readers share a
+ * single read grant from the server, which is returned once the last of them
+ * unlocks. While draining (a writer is preferred), new readers are queued.
+*/
+typedef struct dsm_rwcohort {
+    dsm_rd_state rd_state;          // State of the read grant.
+    int draining;                   // Nonzero if read grant must be returned.
+    int writer;                     // Local PID holding write (0 if none).
+    unsigned int nreaders;          // Local readers sharing the read grant.
+    dsm_waitq queue;                // Readers waiting on the read grant.
+} dsm_rwcohort;
+
+
+// Point-to-point data buffered until the receiver asks for it.
+typedef struct dsm_p2p_chunk {
+    int src_gid;                    // Sending process.
+    size_t size;                    // Bytes not yet delivered.
+    size_t off;                     // Offset of first undelivered byte.
+    struct dsm_p2p_chunk *next;     // Next buffered chunk.
+    unsigned char data[];           // Data.
+} dsm_p2p_chunk;
+
+
+/* Point-to-point data for a local process (by GID), and its pending receive.
+ * Data from each sender is delivered in order, as a stream of bytes. With peer
+ * data, a remote process instead has the peer arbiter reaching it.
+*/
+typedef struct dsm_mailbox {
+    int is_routed;                  // Boolean flag: Remote, reached via peer.
+    int peer_fd;                    // Peer arbiter reaching the process.
+    int recv_fd;                    // Receiving process connection.
+    int recv_src;                   // GID the receive is from.
+    size_t recv_left;               // Bytes left to receive (0 if none).
+    dsm_p2p_chunk *head;            // First buffered chunk.
+    dsm_p2p_chunk *tail;            // Last buffered chunk.
+} dsm_mailbox;
+
+
+// Modified run of a hole, queued until the fill of the process is written.
+typedef struct dsm_fill_run {
+    int fd;                         // Connection of the filling process.
+    int64_t offset;                 // Offset of the run in the shared map.
+    int64_t size;                   // Size (in bytes) of the run.
+    struct dsm_fill_run *next;      // Next queued run.
+} dsm_fill_run;
+
+
+// Local write request, waiting on the local writer of a lease.
+typedef struct dsm_wrt_req {
+    int fd;                         // Connection of the requesting process.
+    int pid;                        // Requesting process.
+    struct dsm_wrt_req *next;       // Next waiting request.
+} dsm_wrt_req;
+
+
+/* Write lease: The write token, kept after a local write so that further
+ * local writes are granted without asking the server. It is handed back once
+ * no local process is writing, and it is revoked, used up, or expired.
+*/
+typedef struct dsm_lease {
+    int held;                       // Nonzero if the token is held.
+    int revoked;                    // Nonzero if the server wants it back.
+    int requested;                  // Nonzero if the server was asked for it.
+    int writer;                     // Local PID writing under it (0 if none).
+    unsigned int nwrites;           // Writes granted under it.
+    double expires;                 // Wall time it expires at (if timed).
+    dsm_wrt_req *head;              // First waiting local request.
+    dsm_wrt_req *tail;              // Last waiting local request.
+} dsm_lease;
+
+
+/* Local write request under page ownership. The pages of its range are pinned
+ * in ascending order before it is granted, so arbiters never wait in a cycle.
+*/
+typedef struct dsm_own_req {
+    int fd;                         // Connection of the requesting process.
+    int pid;                        // Requesting process.
+    size_t first;                   // First page of the range.
+    size_t pin;                     // Next page to pin (past last: granted).
+    size_t last;                    // Last page of the range.
+    struct dsm_own_req *next;       // Next waiting request.
+} dsm_own_req;
+
+
+// State of a page (under page ownership, or lazy replication).
+typedef struct dsm_page {
+    unsigned int is_owned : 1;      // This arbiter owns the page.
+    unsigned int is_requested : 1;  // Ownership was asked of the server.
+    unsigned int is_pinned : 1;     // Held for the first local request.
+    unsigned int is_revoked : 1;    // Server wants it back once unpinned.
+    unsigned int is_resident : 1;   // The page was fetched (lazy replication).
+    unsigned int is_fetching : 1;   // The page was asked of the server.
+    uint64_t readers;               // Slots of local processes that fetched it.
+} dsm_page;
+
+
+// Local process waiting on a page being fetched (lazy replication).
+typedef struct dsm_fetch_req {
+    int fd;                         // Connection of the requesting process.
+    int pid;                        // Requesting process.
+    size_t page;                    // The page.
+    struct dsm_fetch_req *next;     // Next waiting request.
+} dsm_fetch_req;
+
 
 /*
  *******************************************************************************
@@ -70,9 +224,72 @@ void *g_shared_map;
 // Size of the shared map.
 off_t g_map_size;
 
+// Pointer to the shared control page.
+dsm_ctrl *g_ctrl;
+
 // Global configuration settings (set through program arguments).
 dsm_cfg g_cfg;
 
+// Semaphore cohorts indexed by handle, and capacity.
+dsm_cohort *g_cohorts;
+unsigned int g_ncohorts;
+
+// Reader-writer lock cohorts indexed by handle, and capacity.
+dsm_rwcohort *g_rwcohorts;
+unsigned int g_nrwcohorts;
+
+// Point-to-point mailboxes indexed by GID, and capacity.
+dsm_mailbox *g_mailboxes;
+unsigned int g_nmailboxes;
+
+// Queued runs of outstanding hole fills (in arrival order).
+dsm_fill_run *g_fill_head;
+dsm_fill_run *g_fill_tail;
+
+// Write lease (if enabled, see dsm_cfg).
+dsm_lease g_lease;
+
+// Page states (if ownership or lazy replication enabled), and number of pages.
+dsm_page *g_pages;
+size_t g_npages;
+
+// Local write requests under page ownership (the first is the writer).
+dsm_own_req *g_own_head;
+dsm_own_req *g_own_tail;
+
+// Local processes waiting on pages being fetched.
+dsm_fetch_req *g_fetch_head;
+
+// Slots yet to apply invalidations, and the invalidation each must reach.
+uint64_t g_inv_acks;
+uint32_t g_inv_targets[DSM_CTRL_MAX_SLOTS];
+
+// Boolean flag indicating a remote write awaits those invalidations.
+int g_inv_deferred;
+
+// Sequence number of the write last granted here, and last ended elsewhere.
+int32_t g_wrt_seq, g_ack_seq;
+
+// Peer arbiters write data is sent to (if enabled, see dsm_cfg), count, and
+// capacity.
+int *g_peers;
+unsigned int g_npeers, g_peers_size;
+
+// Number of peers in all (-1 until the server says).
+int g_npeers_expected = -1;
+
+// Boolean flag indicating the session start waits on peers connecting.
+int g_cnt_deferred;
+
+// Boolean flag indicating the local GIDs were named to the peers.
+int g_routes_sent;
+
+// Number of peers that named all GIDs they reach.
+int g_npeers_routed;
+
+// Local write-requests not yet sent to the server (see flushWriteRequests).
+dsm_payload_reqs g_reqs;
+
 
 /*
  *******************************************************************************
@@ -87,13 +304,94 @@ static void send_easy_msg (int fd, dsm_msg_t type) {
     dsm_send_msg(fd, &msg);
 }
 
-// Sends message for payload: dsm_payload_task. Fills out number of processes.
-static void send_task_msg (int fd, dsm_msg_t type) {
+/* Queues message for payload: dsm_payload_task. Fills out number of
+ * processes. Sent with the batch of the poll iteration.
+*/
+static void send_task_msg (int fd, dsm_msg_t type, int32_t seq) {
     dsm_msg msg = {.type = type};
     msg.task.nproc = g_proc_tab->nproc;
-    dsm_send_msg(fd, &msg);
+    msg.task.seq = seq;
+    dsm_queue_msg(fd, &msg);
+}
+
+/*
+ *******************************************************************************
+ *                          Peer Function Definitions                          *
+ *******************************************************************************
+*/
+
+
+// Returns nonzero if fd reaches a peer arbiter.
+static int isPeer (int fd) {
+    for (unsigned int i = 0; i < g_npeers; i++) {
+        if (g_peers[i] == fd) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Registers a connection to a peer arbiter. Makes it pollable.
+static void addPeer (int fd) {
+
+    // Double capacity if full.
+    if (g_npeers >= g_peers_size) {
+        g_peers_size = MAX(DSM_PTAB_NFD, 2 * g_peers_size);
+        if ((g_peers = realloc(g_peers, g_peers_size * sizeof(int))) == NULL) {
+            dsm_panic("addPeer: Allocation failed!");
+        }
+    }
+
+    g_peers[g_npeers++] = fd;
+    dsm_setPollable(fd, POLLIN, g_pollSet);
+}
+
+// Unregisters a peer arbiter. Closes the connection.
+static void remPeer (int fd) {
+    for (unsigned int i = 0; i < g_npeers; i++) {
+        if (g_peers[i] == fd) {
+            g_peers[i] = g_peers[--g_npeers];
+            break;
+        }
+    }
+
+    dsm_removePollable(fd, g_pollSet);
+    close(fd);
+}
+
+// Queues a message for all peer arbiters.
+static void send_peer_msg (dsm_msg *mp) {
+    for (unsigned int i = 0; i < g_npeers; i++) {
+        dsm_queue_msg(g_peers[i], mp);
+    }
+}
+
+/* Queues local write data: Straight for all peers (if enabled), otherwise for
+ * the server, which forwards it.
+*/
+static void send_data_msg (dsm_msg *mp) {
+    if (g_cfg.peer_data != 0) {
+        send_peer_msg(mp);
+    } else {
+        dsm_queue_msg(g_sock_server, mp);
+    }
+}
+
+// Queues a DSM_MSG_WRT_RUNS message as write data (if any runs), emptying it.
+static void send_runs_msg (dsm_msg *mp) {
+    if (mp->runs.nruns > 0) {
+        dsm_end_runs(mp);
+        send_data_msg(mp);
+    }
+    dsm_init_runs(mp, mp->runs.buf);
 }
 
+// Returns nonzero if fd reaches a local process (not the server, or a peer).
+static int isLocal (int fd) {
+    return fd != g_sock_server && !isPeer(fd);
+}
+
+
 /*
  *******************************************************************************
  *                        Mapping Function Definitions                         *
@@ -101,8 +399,29 @@ static void send_task_msg (int fd, dsm_msg_t type) {
 */
 
 
-// Forward declaration of signalProcess.
-static void signalProcess (int pid, int signal);
+// Forward declaration of getControlSlot.
+static dsm_ctrl_slot *getControlSlot (int pid);
+
+// Wakes local processes waiting on a shared word within the written range.
+static void wakeWatchers (int64_t offset, int64_t size) {
+    int64_t watch;
+
+    // Order the write before reading the watches (pairs with dsm_wait_until).
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for (unsigned int i = 0; i < g_ctrl->nslots; i++) {
+        watch = __atomic_load_n(&g_ctrl->slots[i].watch, __ATOMIC_RELAXED);
+
+        // Skip slots not watching, or watching a word outside the range.
+        if (watch == DSM_CTRL_NO_WATCH || watch >= offset + size ||
+            watch + (int64_t)sizeof(uint32_t) <= offset) {
+            continue;
+        }
+
+        dsm_futexWake((volatile uint32_t *)((intptr_t)g_shared_map + watch),
+            INT_MAX);
+    }
+}
 
 // Sends the process it's GID.
 static void map_gid_all (int fd, dsm_proc *proc_p) {
@@ -116,34 +435,876 @@ static void map_gid_all (int fd, dsm_proc *proc_p) {
     dsm_send_msg(fd, &msg);
 }
 
-// Unsets blocked bit on process. Sends release message.
+// Names the GID of the process to the peer arbiters.
+static void map_gid_peers (int fd, dsm_proc *proc_p) {
+    dsm_msg msg = {.type = DSM_MSG_SET_GID};
+    UNUSED(fd);
+
+    msg.proc.pid = proc_p->pid;
+    msg.proc.gid = proc_p->gid;
+    send_peer_msg(&msg);
+}
+
+// Unsets blocked bit on process.
 static void map_rel_bar (int fd, dsm_proc *proc_p) {
     UNUSED(fd);
     
     // Unset blocked bit.
     proc_p->flags.is_blocked = 0;
 
-    // No process should be stopped or queued here. A barrier is a barrier.
-    ASSERT_COND(proc_p->flags.is_stopped == 0 && proc_p->flags.is_queued == 0);
+    // No process should be stopped here. It may have a write queued: With
+    // split-phase barriers, it can store between arriving and waiting.
+    ASSERT_COND(proc_p->flags.is_stopped == 0);
+}
+
+
+/*
+ *******************************************************************************
+ *                          Cohort Function Definitions                        *
+ *******************************************************************************
+*/
+
+
+// Returns the cohort for the given semaphore handle. Grows table if needed.
+static dsm_cohort *getCohort (int sem_id) {
+    unsigned int n = g_ncohorts;
+
+    // Verify handle.
+    ASSERT_COND(sem_id >= 0);
+
+    // Grow (zeroed) table if handle is out of range.
+    if ((unsigned int)sem_id >= g_ncohorts) {
+        g_ncohorts = MAX(DSM_MIN_COHORTS, MAX(2 * n, (unsigned int)sem_id + 1));
+        if ((g_cohorts = realloc(g_cohorts, g_ncohorts * sizeof(dsm_cohort)))
+            == NULL) {
+            dsm_panic("getCohort: Allocation failed!");
+        }
+        memset(g_cohorts + n, 0, (g_ncohorts - n) * sizeof(dsm_cohort));
+    }
 
-    // Allow process to continue.
-    signalProcess(proc_p->pid, SIGCONT);
+    return g_cohorts + sem_id;
+}
+
+// Returns the cohort for the given lock handle. Grows table if needed.
+static dsm_rwcohort *getRWCohort (int lock_id) {
+    unsigned int n = g_nrwcohorts;
+
+    // Verify handle.
+    ASSERT_COND(lock_id >= 0);
+
+    // Grow (zeroed) table if handle is out of range.
+    if ((unsigned int)lock_id >= g_nrwcohorts) {
+        g_nrwcohorts = MAX(DSM_MIN_RWCOHORTS, MAX(2 * n,
+            (unsigned int)lock_id + 1));
+        if ((g_rwcohorts = realloc(g_rwcohorts, g_nrwcohorts * 
+            sizeof(dsm_rwcohort))) == NULL) {
+            dsm_panic("getRWCohort: Allocation failed!");
+        }
+        memset(g_rwcohorts + n, 0, (g_nrwcohorts - n) * sizeof(dsm_rwcohort));
+    }
+
+    return g_rwcohorts + lock_id;
+}
+
+// Appends process to the wait queue.
+static void enqueueWaiter (dsm_waitq *queue, dsm_proc *proc_p) {
+    proc_p->sem_next = NULL;
+
+    if (queue->tail == NULL) {
+        queue->head = proc_p;
+    } else {
+        queue->tail->sem_next = proc_p;
+    }
+
+    queue->tail = proc_p;
+}
+
+/* Removes and returns the first waiter whose pid is (match != 0) or isn't
+ * (match == 0) the given pid. Returns NULL if there is none.
+*/
+static dsm_proc *dequeueWaiter (dsm_waitq *queue, int pid, int match) {
+    dsm_proc *prev = NULL, *proc_p = queue->head;
+
+    // Find first process satisfying the condition.
+    while (proc_p != NULL && (proc_p->pid == pid) != (match != 0)) {
+        prev = proc_p;
+        proc_p = proc_p->sem_next;
+    }
+
+    // Return NULL if none.
+    if (proc_p == NULL) {
+        return NULL;
+    }
+
+    // Unlink it.
+    if (prev == NULL) {
+        queue->head = proc_p->sem_next;
+    } else {
+        prev->sem_next = proc_p->sem_next;
+    }
+
+    if (queue->tail == proc_p) {
+        queue->tail = prev;
+    }
+
+    proc_p->sem_next = NULL;
+    return proc_p;
+}
+
+// Completes the sync request of a process: Counts it in its slot and wakes.
+static void completeWait (dsm_proc *proc_p) {
+    dsm_ctrl_slot *slot;
+
+    // Ensure process was waiting.
+    ASSERT_COND(proc_p->flags.is_waiting == 1);
+
+    // Unset waiting bit.
+    proc_p->flags.is_waiting = 0;
+
+    // Count the completion in the process slot, and wake it.
+    ASSERT_COND((slot = getControlSlot(proc_p->pid)) != NULL);
+    __atomic_add_fetch(&slot->sync_done, 1, __ATOMIC_RELEASE);
+    dsm_futexWake(&slot->sync_done, 1);
+}
+
+// Sends a wait to server for the cohort head, if waiters lack a request.
+static void requestCohort (dsm_cohort *cohort, int sem_id) {
+    dsm_msg msg = {.type = DSM_MSG_WAIT_SEM};
+
+    // Nothing to do if a request is outstanding, or nobody is waiting.
+    if (cohort->requester != 0 || cohort->queue.head == NULL) {
+        return;
+    }
+
+    // Request on behalf of the longest waiting process.
+    cohort->requester = cohort->queue.head->pid;
+    msg.sem.sem_id = sem_id;
+    msg.sem.pid = cohort->requester;
+    dsm_send_msg(g_sock_server, &msg);
+}
+
+// Requests a read grant from server for the queued readers, if none is held.
+static void requestReadGrant (dsm_rwcohort *rwc, int lock_id) {
+    dsm_msg msg = {.type = DSM_MSG_RD_LOCK};
+
+    // Nothing to do if a grant is held or requested, or nobody is waiting.
+    if (rwc->rd_state != DSM_RD_NONE || rwc->queue.head == NULL) {
+        return;
+    }
+
+    // Request on behalf of the longest waiting reader.
+    rwc->rd_state = DSM_RD_REQUESTED;
+    msg.lock.lock_id = lock_id;
+    msg.lock.pid = rwc->queue.head->pid;
+    dsm_send_msg(g_sock_server, &msg);
 }
 
 
 /*
  *******************************************************************************
- *                          Message Handler Functions                          *
+ *                         Mailbox Function Definitions                        *
  *******************************************************************************
 */
 
 
-// DSM_MSG_CNT_ALL: Resume all processes instruction.
-static void handler_cnt_all (int fd, dsm_msg *mp) {
-    UNUSED(mp);
+// Returns the mailbox for the given GID. Grows table if needed.
+static dsm_mailbox *getMailbox (int gid) {
+    unsigned int n = g_nmailboxes;
 
-    // Verify sender.
-    ASSERT_COND(fd == g_sock_server && g_started == 0);
+    // Verify GID.
+    ASSERT_COND(gid >= 0);
+
+    // Grow (zeroed) table if GID is out of range.
+    if ((unsigned int)gid >= g_nmailboxes) {
+        g_nmailboxes = MAX(DSM_MIN_MAILBOXES, MAX(2 * n, (unsigned int)gid + 1));
+        if ((g_mailboxes = realloc(g_mailboxes, g_nmailboxes * 
+            sizeof(dsm_mailbox))) == NULL) {
+            dsm_panic("getMailbox: Allocation failed!");
+        }
+        memset(g_mailboxes + n, 0, (g_nmailboxes - n) * sizeof(dsm_mailbox));
+    }
+
+    return g_mailboxes + gid;
+}
+
+// Buffers a copy of the point-to-point data in the mailbox.
+static void putMailbox (dsm_mailbox *mbox, dsm_msg *mp) {
+    size_t size = (size_t)mp->p2p.size;
+    dsm_p2p_chunk *chunk;
+
+    if ((chunk = malloc(sizeof(dsm_p2p_chunk) + size)) == NULL) {
+        dsm_panic("putMailbox: Allocation failed!");
+    }
+
+    chunk->src_gid = mp->p2p.src_gid;
+    chunk->size = size;
+    chunk->off = 0;
+    chunk->next = NULL;
+    memcpy(chunk->data, mp->p2p.buf, size);
+
+    if (mbox->tail == NULL) {
+        mbox->head = chunk;
+    } else {
+        mbox->tail->next = chunk;
+    }
+
+    mbox->tail = chunk;
+}
+
+// Sends buffered data from the expected sender while a receive is pending.
+static void deliverMailbox (dsm_mailbox *mbox, int gid) {
+    dsm_msg msg = {.type = DSM_MSG_P2P_DATA};
+    dsm_p2p_chunk *prev = NULL, *chunk = mbox->head;
+    size_t size;
+
+    while (mbox->recv_left > 0 && chunk != NULL) {
+
+        // Skip chunks of other senders.
+        if (chunk->src_gid != mbox->recv_src) {
+            prev = chunk;
+            chunk = chunk->next;
+            continue;
+        }
+
+        // Deliver as much of the chunk as is expected.
+        size = MIN(chunk->size, mbox->recv_left);
+        msg.p2p.src_gid = chunk->src_gid;
+        msg.p2p.dst_gid = gid;
+        msg.p2p.size = size;
+        msg.p2p.buf = chunk->data + chunk->off;
+        dsm_send_msg(mbox->recv_fd, &msg);
+
+        mbox->recv_left -= size;
+        chunk->off += size;
+
+        // Keep the remainder for the next receive.
+        if ((chunk->size -= size) > 0) {
+            break;
+        }
+
+        // Otherwise unlink and free the chunk.
+        if (prev == NULL) {
+            mbox->head = chunk->next;
+        } else {
+            prev->next = chunk->next;
+        }
+
+        if (mbox->tail == chunk) {
+            mbox->tail = prev;
+        }
+
+        free(chunk);
+        chunk = (prev == NULL) ? mbox->head : prev->next;
+    }
+}
+
+// Frees all mailboxes, and any data left in them.
+static void freeMailboxes (void) {
+    dsm_p2p_chunk *chunk;
+
+    for (unsigned int i = 0; i < g_nmailboxes; i++) {
+        while ((chunk = g_mailboxes[i].head) != NULL) {
+            g_mailboxes[i].head = chunk->next;
+            free(chunk);
+        }
+    }
+
+    free(g_mailboxes);
+}
+
+
+/*
+ *******************************************************************************
+ *                          Fill Function Definitions                          *
+ *******************************************************************************
+*/
+
+
+// Queues a modified run of a hole for the process reached by fd.
+static void putFillRun (int fd, int64_t offset, int64_t size) {
+    dsm_fill_run *run;
+
+    if ((run = malloc(sizeof(dsm_fill_run))) == NULL) {
+        dsm_panic("putFillRun: Allocation failed!");
+    }
+
+    *run = (dsm_fill_run) {
+        .fd = fd, .offset = offset, .size = size, .next = NULL
+    };
+
+    if (g_fill_tail == NULL) {
+        g_fill_head = run;
+    } else {
+        g_fill_tail->next = run;
+    }
+
+    g_fill_tail = run;
+}
+
+/* Sets the range spanning the runs queued for the process reached by fd.
+ * Returns zero if none are queued.
+*/
+static int getFillRange (int fd, int64_t *offset_p, int64_t *size_p) {
+    int64_t first = g_map_size, last = 0;
+
+    for (dsm_fill_run *run = g_fill_head; run != NULL; run = run->next) {
+        if (run->fd == fd) {
+            first = MIN(first, run->offset);
+            last = MAX(last, run->offset + run->size);
+        }
+    }
+
+    *offset_p = first;
+    *size_p = last - first;
+
+    return (first < last);
+}
+
+/* Sends the queued runs of the process reached by fd, under the write token
+ * just granted to it. The data is read straight from the shared map, which
+ * already holds it locally. The runs go out together, unless to owned pages.
+*/
+static void writeFillRuns (int fd) {
+    unsigned char buf[DSM_MSG_RUNS_BUF_SIZE];
+    dsm_msg msg = {.type = DSM_MSG_OWN_DATA}, runs;
+    dsm_fill_run *prev = NULL, *run = g_fill_head, *next;
+    const unsigned char *data;
+    int64_t n;
+
+    dsm_init_runs(&runs, buf);
+    while (run != NULL) {
+        next = run->next;
+
+        // Skip runs of other processes.
+        if (run->fd != fd) {
+            prev = run;
+            run = next;
+            continue;
+        }
+
+        // Send the run, and wake anyone waiting on it.
+        data = (unsigned char *)((intptr_t)g_shared_map + run->offset);
+        if (g_cfg.page_owner != 0) {
+            msg.data.offset = run->offset;
+            msg.data.size = run->size;
+            msg.data.buf = (unsigned char *)data;
+            send_data_msg(&msg);
+        } else {
+            // Add it to the runs message, sending each one filled up.
+            for (int64_t done = 0; done < run->size; done += n) {
+                if ((n = dsm_add_run(&runs, run->offset + done,
+                    run->size - done, data + done)) == 0) {
+                    send_runs_msg(&runs);
+                }
+            }
+        }
+        wakeWatchers(run->offset, run->size);
+
+        // Unlink and free the run.
+        if (prev == NULL) {
+            g_fill_head = next;
+        } else {
+            prev->next = next;
+        }
+
+        if (g_fill_tail == run) {
+            g_fill_tail = prev;
+        }
+
+        free(run);
+        run = next;
+    }
+    send_runs_msg(&runs);
+}
+
+
+/*
+ *******************************************************************************
+ *                          Lease Function Definitions                         *
+ *******************************************************************************
+*/
+
+
+// Forward declarations of grantWrite, and unpinPages.
+static void grantWrite (dsm_proc *proc_p, int fd);
+static void unpinPages (void);
+
+// Returns nonzero if the lease must be handed back once nobody is writing.
+static int isLeaseSpent (void) {
+    return g_lease.revoked || g_lease.nwrites >= g_cfg.lease_writes ||
+        (g_cfg.lease_ms > 0 && dsm_getWallTime() >= g_lease.expires);
+}
+
+// Returns the poll timeout (in milliseconds) until an idle lease expires.
+static int getLeaseTimeout (void) {
+    double left;
+
+    // No timeout unless a timed lease is held, and idle.
+    if (g_lease.held == 0 || g_lease.writer != 0 || g_cfg.lease_ms == 0) {
+        return -1;
+    }
+
+    left = g_lease.expires - dsm_getWallTime();
+    return (left <= 0.0) ? 0 : (int)(left * 1000.0) + 1;
+}
+
+/* Queues the pending write-requests for the server: As one batch if there
+ * are several, which the server grants back to back.
+*/
+static void flushWriteRequests (void) {
+    dsm_msg msg = {.type = DSM_MSG_REQ_WRTS};
+
+    if (g_reqs.npids == 0) {
+        return;
+    }
+
+    if (g_reqs.npids == 1) {
+        msg.type = DSM_MSG_REQ_WRT;
+        msg.proc.pid = g_reqs.pids[0];
+    } else {
+        msg.reqs = g_reqs;
+    }
+
+    dsm_queue_msg(g_sock_server, &msg);
+    memset(&g_reqs, 0, sizeof(g_reqs));
+}
+
+/* Has a write request sent to the server on behalf of a local process. Those
+ * of one poll iteration are sent together.
+*/
+static void sendWriteRequest (int pid) {
+    if (g_reqs.npids == DSM_MSG_MAX_PIDS) {
+        flushWriteRequests();
+    }
+    g_reqs.pids[g_reqs.npids++] = pid;
+}
+
+// Appends a local write request to the lease queue.
+static void putWriteRequest (int fd, int pid) {
+    dsm_wrt_req *req;
+
+    if ((req = malloc(sizeof(dsm_wrt_req))) == NULL) {
+        dsm_panic("putWriteRequest: Allocation failed!");
+    }
+
+    *req = (dsm_wrt_req) {.fd = fd, .pid = pid, .next = NULL};
+
+    if (g_lease.tail == NULL) {
+        g_lease.head = req;
+    } else {
+        g_lease.tail->next = req;
+    }
+
+    g_lease.tail = req;
+}
+
+// Removes the first local write request into the pointers. Returns 0 if none.
+static int takeWriteRequest (int *fd_p, int *pid_p) {
+    dsm_wrt_req *req = g_lease.head;
+
+    if (req == NULL) {
+        return 0;
+    }
+
+    if ((g_lease.head = req->next) == NULL) {
+        g_lease.tail = NULL;
+    }
+
+    *fd_p = req->fd;
+    *pid_p = req->pid;
+    free(req);
+
+    return 1;
+}
+
+/* Ends the write under the token at the server, and acknowledges it. With
+ * peer data, the peers are told too (they acknowledge it to the server).
+*/
+static void endWrite (void) {
+    dsm_msg msg = {.type = DSM_MSG_WRT_END};
+    msg.task.seq = g_wrt_seq;
+
+    if (g_cfg.peer_data != 0) {
+        send_peer_msg(&msg);
+        dsm_queue_msg(g_sock_server, &msg);
+        return;
+    }
+
+    dsm_queue_msg(g_sock_server, &msg);
+    send_task_msg(g_sock_server, DSM_MSG_GOT_DATA, g_wrt_seq);
+}
+
+/* Hands the lease back if it is spent and nobody is writing. Processes still
+ * waiting on it then ask the server instead.
+*/
+static void checkLease (void) {
+    int fd, pid;
+
+    if (g_lease.held == 0 || g_lease.writer != 0 || !isLeaseSpent()) {
+        return;
+    }
+
+    g_lease.held = 0;
+    endWrite();
+
+    // Ask for a new lease if processes wait on it (unless asked already).
+    if (g_lease.requested == 0 && takeWriteRequest(&fd, &pid) != 0) {
+        g_lease.requested = 1;
+        sendWriteRequest(pid);
+    }
+}
+
+/* Ends the write of the local writer. Under a lease, the token then passes
+ * to the next waiting local process, unless the lease is handed back. Under
+ * page ownership, the pages pass on instead.
+*/
+static void finishWrite (void) {
+    dsm_proc *proc_p;
+    int fd, pid;
+
+    g_lease.writer = 0;
+
+    // Under page ownership, there is no token.
+    if (g_cfg.page_owner != 0) {
+        unpinPages();
+        return;
+    }
+
+    // Without a lease, the token goes straight back.
+    if (g_lease.held == 0) {
+        endWrite();
+        return;
+    }
+
+    // Hand back a spent lease. Otherwise grant the next waiting process.
+    checkLease();
+    if (g_lease.held == 1 && takeWriteRequest(&fd, &pid) != 0) {
+        ASSERT_COND((proc_p = dsm_getProcessTableEntry(g_proc_tab, fd, pid))
+            != NULL);
+        grantWrite(proc_p, fd);
+    }
+}
+
+/* Hands the token to a local process. A fill is written here at once.
+ * Otherwise the process is told to write, and ends with DSM_MSG_WRT_END.
+*/
+static void grantWrite (dsm_proc *proc_p, int fd) {
+    dsm_msg msg = {.type = DSM_MSG_WRT_NOW};
+
+    // Unset as queued. This process has write go-ahead.
+    proc_p->flags.is_queued = 0;
+    g_lease.writer = proc_p->pid;
+    g_lease.nwrites++;
+
+    // If the process has a fill outstanding, the grant is for it. Write it.
+    if (proc_p->flags.is_filling == 1) {
+        proc_p->flags.is_filling = 0;
+        writeFillRuns(fd);
+        completeWait(proc_p);
+        finishWrite();
+        return;
+    }
+
+    // Otherwise tell the writer.
+    msg.proc.pid = proc_p->pid;
+    dsm_send_msg(fd, &msg);
+}
+
+/* Requests the token for a local process. Under a lease, it is granted here
+ * (or once the local writer is done). Otherwise the server is asked. With
+ * leases, only once: Others wait here for the lease that request brings.
+*/
+static void requestWrite (dsm_proc *proc_p, int fd) {
+
+    // Set process to queued.
+    proc_p->flags.is_queued = 1;
+
+    // Hand back the lease first if it is spent.
+    checkLease();
+
+    if (g_lease.requested != 0) {
+        putWriteRequest(fd, proc_p->pid);
+    } else if (g_lease.held == 0 || isLeaseSpent()) {
+        g_lease.requested = (g_cfg.lease_writes > 0);
+        sendWriteRequest(proc_p->pid);
+    } else if (g_lease.writer == 0) {
+        grantWrite(proc_p, fd);
+    } else {
+        putWriteRequest(fd, proc_p->pid);
+    }
+}
+
+
+/*
+ *******************************************************************************
+ *                        Ownership Function Definitions                       *
+ *******************************************************************************
+*/
+
+
+// Sends a page ownership message for the given page to the server.
+static void sendPageMsg (dsm_msg_t type, size_t page) {
+    dsm_msg msg = {.type = type};
+    msg.own.offset = (int64_t)(page * DSM_PAGESIZE);
+    msg.own.size = DSM_PAGESIZE;
+    dsm_send_msg(g_sock_server, &msg);
+}
+
+// Returns the index of the page at the given offset. Exits if out of range.
+static size_t getPageIndex (int64_t offset) {
+    ASSERT_COND(offset >= 0 && offset < (int64_t)g_map_size);
+    return (size_t)offset / DSM_PAGESIZE;
+}
+
+/* Drops ownership of a page. Local writes to it were forwarded already, so
+ * the server passes it on only after them. The page stays resident.
+*/
+static void dropPage (size_t page) {
+    g_pages[page].is_owned = g_pages[page].is_requested = 0;
+    g_pages[page].is_pinned = g_pages[page].is_revoked = 0;
+    sendPageMsg(DSM_MSG_OWN_DROP, page);
+}
+
+/* Pins the pages of the first local request in ascending order, asking the
+ * server for the next one not owned. Grants the request once all are pinned.
+*/
+static void pinPages (void) {
+    dsm_own_req *req = g_own_head;
+    dsm_proc *proc_p;
+    dsm_page *page;
+
+    // Nothing to do if nobody waits, or the first request is writing.
+    if (req == NULL || req->pin > req->last) {
+        return;
+    }
+
+    for (; req->pin <= req->last; req->pin++) {
+        page = g_pages + req->pin;
+
+        // Wait for a page not owned (asking for it once).
+        if (page->is_owned == 0) {
+            if (page->is_requested == 0) {
+                page->is_requested = 1;
+                sendPageMsg(DSM_MSG_REQ_OWN, req->pin);
+            }
+            return;
+        }
+
+        page->is_pinned = 1;
+    }
+
+    // All pages are pinned: Grant the write.
+    ASSERT_COND((proc_p = dsm_getProcessTableEntry(g_proc_tab, req->fd,
+        req->pid)) != NULL);
+    grantWrite(proc_p, req->fd);
+}
+
+/* Ends the write of the first local request: Unpins its pages, drops those
+ * the server wants back, and moves on to the next request.
+*/
+static void unpinPages (void) {
+    dsm_own_req *req = g_own_head;
+
+    ASSERT_COND(req != NULL && req->pin > req->last);
+
+    for (size_t i = req->first; i <= req->last; i++) {
+        g_pages[i].is_pinned = 0;
+        if (g_pages[i].is_revoked == 1) {
+            dropPage(i);
+        }
+    }
+
+    if ((g_own_head = req->next) == NULL) {
+        g_own_tail = NULL;
+    }
+    free(req);
+
+    pinPages();
+}
+
+// Queues a local request to write the given range, and pins what it can.
+static void requestPages (dsm_proc *proc_p, int fd, int64_t offset,
+    int64_t size) {
+    dsm_own_req *req;
+
+    if ((req = malloc(sizeof(dsm_own_req))) == NULL) {
+        dsm_panic("requestPages: Allocation failed!");
+    }
+
+    *req = (dsm_own_req) {
+        .fd = fd, .pid = proc_p->pid, .first = getPageIndex(offset),
+        .last = getPageIndex(offset + size - 1), .next = NULL
+    };
+    req->pin = req->first;
+
+    if (g_own_tail == NULL) {
+        g_own_head = req;
+    } else {
+        g_own_tail->next = req;
+    }
+
+    g_own_tail = req;
+
+    // Set process to queued.
+    proc_p->flags.is_queued = 1;
+
+    pinPages();
+}
+
+
+/*
+ *******************************************************************************
+ *                       Replication Function Definitions                      *
+ *******************************************************************************
+*/
+
+
+// Copies data received from the server into the map.
+static void writeMap (int64_t offset, int64_t size, const unsigned char *buf) {
+    size_t len;
+
+    // Ensure nothing is written off the shared map.
+    ASSERT_COND(offset >= 0 && offset <= (int64_t)g_map_size && size >= 0);
+    len = MIN((size_t)size, (size_t)g_map_size - (size_t)offset);
+
+    dsm_mprotect(g_shared_map, g_map_size, PROT_WRITE);
+    memcpy((void *)((intptr_t)g_shared_map + offset), buf, len);
+    dsm_mprotect(g_shared_map, g_map_size, PROT_READ);
+}
+
+// Writes each run of a DSM_MSG_WRT_RUNS message to the map (in one pass).
+static void writeRuns (dsm_msg *mp) {
+    const unsigned char *data;
+    int64_t offset, size;
+    int i = 0;
+
+    dsm_mprotect(g_shared_map, g_map_size, PROT_WRITE);
+    while ((data = dsm_next_run(mp, &i, &offset, &size)) != NULL) {
+        ASSERT_COND(offset >= 0 && offset <= (int64_t)g_map_size);
+        memcpy((void *)((intptr_t)g_shared_map + offset), data,
+            MIN((size_t)size, (size_t)g_map_size - (size_t)offset));
+    }
+    dsm_mprotect(g_shared_map, g_map_size, PROT_READ);
+}
+
+/* Tells a local process the given page is resident. Invalidations posted
+ * before don't apply to the copy it now maps.
+*/
+static void sendPageReply (int fd, int pid, size_t page) {
+    dsm_msg msg = {.type = DSM_MSG_GET_PAGE};
+    msg.own.pid = pid;
+    msg.own.inv_seq = (int32_t)g_ctrl->inv_seq;
+    msg.own.offset = (int64_t)(page * DSM_PAGESIZE);
+    msg.own.size = DSM_PAGESIZE;
+    dsm_send_msg(fd, &msg);
+}
+
+// Queues a local process on a page not resident, fetching it (once).
+static void fetchPage (int fd, int pid, size_t page) {
+    dsm_fetch_req *req;
+
+    if ((req = malloc(sizeof(dsm_fetch_req))) == NULL) {
+        dsm_panic("fetchPage: Allocation failed!");
+    }
+
+    *req = (dsm_fetch_req) {
+        .fd = fd, .pid = pid, .page = page, .next = g_fetch_head
+    };
+    g_fetch_head = req;
+
+    if (g_pages[page].is_fetching == 0) {
+        g_pages[page].is_fetching = 1;
+        sendPageMsg(DSM_MSG_GET_PAGE, page);
+    }
+}
+
+// Marks a fetched page resident, and replies to the processes waiting on it.
+static void setResident (size_t page) {
+    dsm_fetch_req **next_p = &g_fetch_head, *req;
+
+    g_pages[page].is_resident = 1;
+    g_pages[page].is_fetching = 0;
+
+    while ((req = *next_p) != NULL) {
+        if (req->page != page) {
+            next_p = &(req->next);
+            continue;
+        }
+        sendPageReply(req->fd, req->pid, page);
+        *next_p = req->next;
+        free(req);
+    }
+}
+
+/* Drops an invalidated page: Posts it to the control page, and signals the
+ * local processes that fetched it to drop it too.
+*/
+static void invalidatePage (size_t page) {
+    uint32_t seq = g_ctrl->inv_seq;
+    dsm_ctrl_slot *slot;
+
+    g_pages[page].is_resident = 0;
+
+    // Post the page, then publish it.
+    g_ctrl->inv_ring[seq % DSM_CTRL_INV_RING] = (uint32_t)page;
+    __atomic_store_n(&g_ctrl->inv_seq, ++seq, __ATOMIC_RELEASE);
+
+    // Signal readers. Those that are gone have nothing to apply.
+    for (unsigned int i = 0; i < g_ctrl->nslots; i++) {
+        slot = g_ctrl->slots + i;
+        if (((g_pages[page].readers >> i) & 1) == 0 || slot->pid == 0 ||
+            kill(slot->pid, DSM_CTRL_INV_SIGNAL) == -1) {
+            continue;
+        }
+        g_inv_acks |= (uint64_t)1 << i;
+        g_inv_targets[i] = seq;
+    }
+
+    g_pages[page].readers = 0;
+}
+
+/* Clears the slots that applied their invalidations (or are gone). Once all
+ * have, acknowledges the remote write that caused them.
+*/
+static void checkInvalidations (void) {
+    dsm_ctrl_slot *slot;
+
+    for (unsigned int i = 0; i < g_ctrl->nslots; i++) {
+        slot = g_ctrl->slots + i;
+        if (((g_inv_acks >> i) & 1) == 1 && (slot->pid == 0 ||
+            (int32_t)(__atomic_load_n(&slot->inv_seen, __ATOMIC_ACQUIRE) -
+            g_inv_targets[i]) >= 0 || kill(slot->pid, 0) == -1)) {
+            g_inv_acks &= ~((uint64_t)1 << i);
+        }
+    }
+
+    if (g_inv_acks == 0 && g_inv_deferred == 1) {
+        g_inv_deferred = 0;
+        send_task_msg(g_sock_server, DSM_MSG_GOT_DATA, g_ack_seq);
+    }
+}
+
+// Returns the poll timeout (ms): Short while invalidations are unapplied.
+static int getPollTimeout (void) {
+    int timeout = getLeaseTimeout();
+
+    if (g_inv_acks == 0) {
+        return timeout;
+    }
+
+    return (timeout == -1) ? DSM_INV_POLL_MS : MIN(timeout, DSM_INV_POLL_MS);
+}
+
+
+/*
+ *******************************************************************************
+ *                          Message Handler Functions                          *
+ *******************************************************************************
+*/
+
+
+// Starts the session: Sends each process its GID.
+static void startSession (void) {
 
 	// Set the started flag.
     g_started = 1;
@@ -151,6 +1312,9 @@ static void handler_cnt_all (int fd, dsm_msg *mp) {
 	// Destroy the shared file.
 	dsm_unlinkSharedFile(DSM_SHM_FILE_NAME);
 
+	// Destroy the control file.
+	dsm_unlinkSharedFile(DSM_CTRL_FILE_NAME);
+
     // Start global timer.
     g_seconds_elapsed = dsm_getWallTime();
 
@@ -158,6 +1322,56 @@ static void handler_cnt_all (int fd, dsm_msg *mp) {
     dsm_mapFuncToProcessTableEntries(g_proc_tab, map_gid_all);
 }
 
+/* Names the local GIDs to all peers, so that point-to-point data for them is
+ * sent straight here. An entry with GID -1 ends the list.
+*/
+static void send_route_msgs (void) {
+    dsm_msg msg = {.type = DSM_MSG_SET_GID};
+
+    dsm_mapFuncToProcessTableEntries(g_proc_tab, map_gid_peers);
+
+    msg.proc.pid = getpid();
+    msg.proc.gid = -1;
+    send_peer_msg(&msg);
+}
+
+/* Starts a session that waited on peers, once all of them have connected and
+ * named the GIDs they reach (after we named ours).
+*/
+static void checkPeers (void) {
+    if (g_cnt_deferred == 0 || (int)g_npeers != g_npeers_expected) {
+        return;
+    }
+
+    if (g_routes_sent == 0) {
+        g_routes_sent = 1;
+        send_route_msgs();
+    }
+
+    if ((int)g_npeers_routed == g_npeers_expected) {
+        g_cnt_deferred = 0;
+        startSession();
+    }
+}
+
+/* DSM_MSG_CNT_ALL: Resume all processes instruction. With peer data, local
+ * writes go to all peers: The session waits until they have connected.
+*/
+static void handler_cnt_all (int fd, dsm_msg *mp) {
+    UNUSED(mp);
+
+    // Verify sender.
+    ASSERT_COND(fd == g_sock_server && g_started == 0);
+
+    if (g_cfg.peer_data != 0) {
+        g_cnt_deferred = 1;
+        checkPeers();
+        return;
+    }
+
+    startSession();
+}
+
 // DSM_MSG_REL_BAR: Release processes waiting at barrier.
 static void handler_rel_bar (int fd, dsm_msg *mp) {
     UNUSED(mp);
@@ -165,8 +1379,14 @@ static void handler_rel_bar (int fd, dsm_msg *mp) {
     // Verify state + sender.
     ASSERT_STATE(g_started == 1 && fd == g_sock_server);
 
-    // For all processes: Unset blocked bit. Signal if not stopped.
+    // For all processes: Unset blocked bit.
     dsm_mapFuncToProcessTableEntries(g_proc_tab, map_rel_bar);
+
+    // Advance the barrier generation (publishes prior writes to the map).
+    __atomic_add_fetch(&g_ctrl->bar_gen, 1, __ATOMIC_RELEASE);
+
+    // Wake all processes sleeping on the generation.
+    dsm_futexWake(&g_ctrl->bar_gen, INT_MAX);
 }
 
 // DSM_MSG_WRT_NOW: Perform write-operation.
@@ -175,26 +1395,110 @@ static void handler_wrt_now (int fd, dsm_msg *mp) {
     dsm_proc *proc_p;
 
     // Verify state + sender.
-    ASSERT_STATE(g_started == 1 && fd == g_sock_server);
+    ASSERT_STATE(g_started == 1 && fd == g_sock_server);
+
+    // Locate writing process.
+    ASSERT_COND((proc_p = dsm_findProcessTableEntry(g_proc_tab, pid, &proc_fd))
+        != NULL);
+
+    // A lease is handed back before the server grants anything else.
+    ASSERT_COND(g_lease.held == 0);
+
+    // Keep the sequence number, to end the write with.
+    g_wrt_seq = mp->proc.seq;
+
+    // Keep the token as a lease, if enabled.
+    if (g_cfg.lease_writes > 0) {
+        g_lease.held = 1;
+        g_lease.requested = 0;
+        g_lease.revoked = 0;
+        g_lease.nwrites = 0;
+        g_lease.expires = dsm_getWallTime() + g_cfg.lease_ms / 1000.0;
+    }
+
+    // Hand the token to the writer.
+    grantWrite(proc_p, proc_fd);
+}
+
+// DSM_MSG_WRT_REVOKE: Another writer is queued at the server.
+static void handler_wrt_revoke (int fd, dsm_msg *mp) {
+    UNUSED(mp);
+
+    // Verify state + sender.
+    ASSERT_STATE(g_started == 1 && fd == g_sock_server);
+
+    // Ignore if no lease is held (the token was already handed back).
+    if (g_lease.held == 0) {
+        return;
+    }
+
+    // Hand the lease back once the local writer is done.
+    g_lease.revoked = 1;
+    checkLease();
+}
+
+// DSM_MSG_OWN_NOW: Server granted a page.
+static void handler_own_now (int fd, dsm_msg *mp) {
+    dsm_page *page;
+
+    // Verify state + sender.
+    ASSERT_STATE(g_started == 1 && fd == g_sock_server &&
+        g_cfg.page_owner != 0);
+
+    // Own the page, and go on pinning.
+    page = g_pages + getPageIndex(mp->own.offset);
+    page->is_owned = 1;
+    page->is_requested = 0;
+    pinPages();
+}
+
+// DSM_MSG_OWN_REVOKE: Another arbiter wants a page.
+static void handler_own_revoke (int fd, dsm_msg *mp) {
+    size_t i;
+
+    // Verify state + sender.
+    ASSERT_STATE(g_started == 1 && fd == g_sock_server &&
+        g_cfg.page_owner != 0);
 
-    // Locate writing process.
-    ASSERT_COND((proc_p = dsm_findProcessTableEntry(g_proc_tab, pid, &proc_fd))
-        != NULL);
+    // Verify page is owned.
+    ASSERT_COND(g_pages[i = getPageIndex(mp->own.offset)].is_owned == 1);
 
-    // Unset as queued. This process has write go-ahead.
-    proc_p->flags.is_queued = 0;
+    // Drop it once the local writer is done with it.
+    if (g_pages[i].is_pinned == 1) {
+        g_pages[i].is_revoked = 1;
+        return;
+    }
 
-    // Forward message to writer.
-    dsm_send_msg(proc_fd, mp);
+    dropPage(i);
 }
 
-// DSM_MSG_SET_GID: Set a process global-identifier.
+/* DSM_MSG_SET_GID: Set a process global-identifier. From a peer: It reaches
+ * the process with the GID (or has named all it reaches).
+*/
 static void handler_set_gid (int fd, dsm_msg *mp) {
     int pid = mp->proc.pid, gid = mp->proc.gid, proc_fd;
+    dsm_mailbox *mbox;
     dsm_proc *proc_p;
 
-    // Verify state and sender.
-    ASSERT_STATE(g_started == 0 && fd == g_sock_server);
+    // Verify state.
+    ASSERT_STATE(g_started == 0);
+
+    // If from a peer: Route point-to-point data for the GID to it.
+    if (isPeer(fd)) {
+        if (gid == -1) {
+            g_npeers_routed++;
+            checkPeers();
+            return;
+        }
+
+        mbox = getMailbox(gid);
+        mbox->is_routed = 1;
+        mbox->peer_fd = fd;
+        return;
+    }
+
+    // Verify sender.
+    ASSERT_COND(fd == g_sock_server);
 
     // Verify PID exists.
     ASSERT_COND((proc_p = 
@@ -224,6 +1528,12 @@ static void handler_add_pid (int fd, dsm_msg *mp) {
     // Set process as stopped by default (until start signal is received).
     proc_p->flags.is_stopped = 1;
 
+    // Assign the process a control slot.
+    ASSERT_COND(g_ctrl->nslots < DSM_CTRL_MAX_SLOTS);
+    g_ctrl->slots[g_ctrl->nslots].watch = DSM_CTRL_NO_WATCH;
+    g_ctrl->slots[g_ctrl->nslots].inv_seen = g_ctrl->inv_seq;
+    g_ctrl->slots[g_ctrl->nslots++].pid = pid;
+
     // Forward message to server.
     dsm_send_msg(g_sock_server, mp);
 }
@@ -240,11 +1550,29 @@ static void handler_req_wrt (int fd, dsm_msg *mp) {
     ASSERT_COND((proc_p = dsm_getProcessTableEntry(g_proc_tab, fd, pid))
 		!= NULL);
 
-    // Set process to queued.
-    proc_p->flags.is_queued = 1;
+    // Request the token (from the lease, or the server).
+    requestWrite(proc_p, fd);
+}
 
-    // Forward request to server.
-    dsm_send_msg(g_sock_server, mp);
+// DSM_MSG_REQ_OWN: Process requesting to write a range (page ownership).
+static void handler_req_own (int fd, dsm_msg *mp) {
+    int pid = mp->own.pid;
+    dsm_proc *proc_p;
+
+    // Verify state + sender + mode.
+    ASSERT_STATE(g_started == 1 && fd != g_sock_server &&
+        g_cfg.page_owner != 0);
+
+    // Verify PID is registered.
+    ASSERT_COND((proc_p = dsm_getProcessTableEntry(g_proc_tab, fd, pid))
+        != NULL);
+
+    // Verify range is in the shared map.
+    ASSERT_COND(mp->own.offset >= 0 && mp->own.size > 0 &&
+        mp->own.offset + mp->own.size <= (int64_t)g_map_size);
+
+    // Request the pages of the range.
+    requestPages(proc_p, fd, mp->own.offset, mp->own.size);
 }
 
 // DSM_MSG_HIT_BAR: Process is waiting on a barrier.
@@ -262,74 +1590,197 @@ static void handler_hit_bar (int fd, dsm_msg *mp) {
     // Set process to blocked.
     proc_p->flags.is_blocked = 1;
 
-    // Forward message to server.
+    // Wait until all local processes have arrived.
+    if ((g_proc_tab->nblocked += 1) < g_proc_tab->nproc) {
+        return;
+    }
+
+    // Forward a single aggregated arrival to server.
+    mp->proc.nproc = g_proc_tab->nblocked;
     dsm_send_msg(g_sock_server, mp);
+
+    // Reset barrier counter.
+    g_proc_tab->nblocked = 0;
 }
 
-// DSM_MSG_WRT_DATA: Process data message.
+// DSM_MSG_WRT_DATA, OWN_DATA: Process data message.
 static void handler_wrt_data (int fd, dsm_msg *mp) {
 
     // Verify state.
     ASSERT_STATE(g_started == 1);
 
-    // If it's coming from a local process, forward to server.
-    if (fd != g_sock_server) {
-        dsm_send_msg(g_sock_server, mp);
+    // If it's coming from a local process, forward to server (or peers).
+    // Writes to owned pages go out without the token.
+    if (isLocal(fd)) {
+        if (g_cfg.page_owner != 0) {
+            mp->type = DSM_MSG_OWN_DATA;
+        }
+        send_data_msg(mp);
+
+    } else {
+
+        // Otherwise synchronize the shared memory.
+        writeMap(mp->data.offset, mp->data.size, mp->data.buf);
+    }
+
+    // Local or remote, the data is now in the map. Wake anyone waiting on it.
+    wakeWatchers(mp->data.offset, mp->data.size);
+}
+
+// DSM_MSG_WRT_RUNS: Process data message (of several runs).
+static void handler_wrt_runs (int fd, dsm_msg *mp) {
+    dsm_msg msg = {.type = DSM_MSG_OWN_DATA};
+    const unsigned char *data;
+    int64_t offset, size;
+    int i = 0;
+
+    // Verify state.
+    ASSERT_STATE(g_started == 1);
 
+    // If it's coming from a local process, forward to server (or peers).
+    // Writes to owned pages go out without the token, as a message per run.
+    if (isLocal(fd) && g_cfg.page_owner != 0) {
+        while ((data = dsm_next_run(mp, &i, &offset, &size)) != NULL) {
+            msg.data.offset = offset;
+            msg.data.size = size;
+            msg.data.buf = (unsigned char *)data;
+            send_data_msg(&msg);
+        }
+    } else if (isLocal(fd)) {
+        send_data_msg(mp);
     } else {
-		
-		// Map_end is used to ensure nothing is written off shared map.
-		size_t len = 0, map_end = (size_t)g_shared_map + (size_t)g_map_size;
 
         // Otherwise synchronize the shared memory.
-        dsm_mprotect(g_shared_map, g_map_size, PROT_WRITE);
-        void *dest = (void *)((intptr_t)g_shared_map + mp->data.offset);
-        void *src = (void *)mp->data.buf;
-		len = MIN(MAX(len, map_end - (size_t)dest), 8);
-        memcpy(dest, src, len);
-        dsm_mprotect(g_shared_map, g_map_size, PROT_READ);
+        writeRuns(mp);
     }
 
+    // Local or remote, the data is now in the map. Wake anyone waiting on it.
+    i = 0;
+    while (dsm_next_run(mp, &i, &offset, &size) != NULL) {
+        wakeWatchers(offset, size);
+    }
 }
 
 // DSM_MSG_WRT_END: End of data transmission.
 static void handler_wrt_end (int fd, dsm_msg *mp) {
-	UNUSED(mp);
 
 	// Verify state.
 	ASSERT_STATE(g_started == 1);
 
-	// If internal: Forward to server.
-	if (fd != g_sock_server) {
-		dsm_send_msg(g_sock_server, mp);
+	// If internal: The local writer is done.
+	if (isLocal(fd)) {
+		finishWrite();
+		return;
+	}
+
+	// Otherwise acknowledge the remote write to server (once local processes
+	// dropped the pages it invalidated).
+	g_ack_seq = mp->task.seq;
+	if (g_inv_acks != 0) {
+		g_inv_deferred = 1;
+		return;
 	}
+	send_task_msg(g_sock_server, DSM_MSG_GOT_DATA, g_ack_seq);
+}
+
+// DSM_MSG_GET_PAGE: Process is fetching a page (lazy replication).
+static void handler_get_page (int fd, dsm_msg *mp) {
+    dsm_ctrl_slot *slot;
+    size_t page;
+
+    // Verify state + sender + mode.
+    ASSERT_STATE(g_started == 1 && fd != g_sock_server &&
+        g_cfg.lazy_pages != 0);
+
+    // Verify PID is registered.
+    ASSERT_COND(dsm_getProcessTableEntry(g_proc_tab, fd, mp->own.pid) != NULL);
+
+    // Record the process as reader, for invalidations.
+    page = getPageIndex(mp->own.offset);
+    if ((slot = getControlSlot(mp->own.pid)) != NULL) {
+        g_pages[page].readers |= (uint64_t)1 << (slot - g_ctrl->slots);
+    }
+
+    // Reply at once if another local process fetched it. Otherwise wait.
+    if (g_pages[page].is_resident == 1) {
+        sendPageReply(fd, mp->own.pid, page);
+    } else {
+        fetchPage(fd, mp->own.pid, page);
+    }
+}
 
-	// Always send acknowledgment to server.
-	send_task_msg(g_sock_server, DSM_MSG_GOT_DATA);
+/* DSM_MSG_PAGE_DATA: Server sent (part of) a fetched page. The page is
+ * resident at the empty message ending it. Writes to the page that follow are
+ * forwarded to us (or invalidate it), so it stays up to date once resident.
+*/
+static void handler_page_data (int fd, dsm_msg *mp) {
+    size_t page;
+
+    // Verify state + sender + mode.
+    ASSERT_STATE(g_started == 1 && fd == g_sock_server &&
+        g_cfg.lazy_pages != 0);
+
+    // Verify the page is being fetched.
+    ASSERT_COND(
+        g_pages[page = getPageIndex(mp->data.offset)].is_fetching == 1);
+
+    // Install the data, or mark the page resident.
+    if (mp->data.size > 0) {
+        writeMap(mp->data.offset, mp->data.size, mp->data.buf);
+    } else {
+        setResident(page);
+    }
+}
+
+/* DSM_MSG_INV_PAGE: Server invalidated a page (write-invalidate protocol).
+ * The page in the map keeps local writes not yet sent; a fetch only brings
+ * the parts written elsewhere since.
+*/
+static void handler_inv_page (int fd, dsm_msg *mp) {
+    size_t page;
+
+    // Verify state + sender + mode.
+    ASSERT_STATE(g_started == 1 && fd == g_sock_server &&
+        g_cfg.lazy_pages != 0);
+
+    if (g_pages[page = getPageIndex(mp->own.offset)].is_resident == 1) {
+        invalidatePage(page);
+    }
+
+    // Have waiters recheck (they fault the page in, once it is dropped).
+    wakeWatchers(mp->own.offset, mp->own.size);
+}
+
+// DSM_MSG_SET_PROTO, SUBSCRIBE: Process sets the protocol of (or subscribes
+// to) a range. Forward to server.
+static void handler_set_proto (int fd, dsm_msg *mp) {
+
+    // Verify state + sender.
+    ASSERT_STATE(g_started == 1 && fd != g_sock_server);
+
+    dsm_send_msg(g_sock_server, mp);
 }
 
-// DSM_MSG_POST_SEM: Process posted to a named semaphore.
+// DSM_MSG_POST_SEM: Process posted to a semaphore, or server granted one.
 static void handler_post_sem (int fd, dsm_msg *mp) {
-    int proc_fd, pid = mp->sem.pid;
+    int pid = mp->sem.pid, sem_id = mp->sem.sem_id;
+    dsm_cohort *cohort = getCohort(sem_id);
     dsm_proc *proc_p;
 
     // Verify state.
     ASSERT_STATE(g_started == 1);
 
-    // If from server: Find and unblock process.
+    // If from server: Grant is for the requester. Complete its wait.
     if (fd == g_sock_server) {
-        ASSERT_COND((proc_p = dsm_findProcessTableEntry(g_proc_tab, pid,
-            &proc_fd)));
-
-        // Ensure process was blocked: Could verify semaphore name but costly.
-        ASSERT_COND(proc_p->flags.is_blocked == 1);
-        
-        // Unset blocked bit.
-        proc_p->flags.is_blocked = 0;
+        ASSERT_COND(cohort->requester == pid);
+        cohort->requester = 0;
 
-        // Forward message to process.
-        dsm_send_msg(proc_fd, mp);
+        // Take requester out of the cohort, and complete its wait.
+        ASSERT_COND((proc_p = dequeueWaiter(&cohort->queue, pid, 1)) != NULL);
+        completeWait(proc_p);
 
+        // Remaining waiters need a new request.
+        requestCohort(cohort, sem_id);
         return;
     }
 
@@ -337,13 +1788,23 @@ static void handler_post_sem (int fd, dsm_msg *mp) {
     ASSERT_COND((proc_p = dsm_getProcessTableEntry(g_proc_tab, fd, pid)) 
         != NULL);
 
-    // Foward POST to server.
+    // Hand the unit to a local waiter (not the requester) if budget allows.
+    if (cohort->nhandoff < DSM_MAX_HANDOFF &&
+        (proc_p = dequeueWaiter(&cohort->queue, cohort->requester, 0)) != NULL) {
+        cohort->nhandoff++;
+        completeWait(proc_p);
+        return;
+    }
+
+    // Otherwise: Return unit to server.
+    cohort->nhandoff = 0;
     dsm_send_msg(g_sock_server, mp);
 }
 
-// DSM_MSG_WAIT_SEM: Process waiting on a named semaphore.
+// DSM_MSG_WAIT_SEM: Process waiting on a semaphore.
 static void handler_wait_sem (int fd, dsm_msg *mp) {
-    int pid = mp->sem.pid;
+    int pid = mp->sem.pid, sem_id = mp->sem.sem_id;
+    dsm_cohort *cohort = getCohort(sem_id);
     dsm_proc *proc_p;
 
     // Verify state + sender.
@@ -353,28 +1814,315 @@ static void handler_wait_sem (int fd, dsm_msg *mp) {
     ASSERT_COND((proc_p = dsm_getProcessTableEntry(g_proc_tab, fd, pid)) 
         != NULL);
 
-    // Set blocked bit.
-    proc_p->flags.is_blocked = 1;
+    // Only one wait may be outstanding per process.
+    ASSERT_COND(proc_p->flags.is_waiting == 0);
 
-    // Forward message to server.
+    // Set waiting bit.
+    proc_p->flags.is_waiting = 1;
+
+    // Join the cohort. Request from server if no request is outstanding.
+    enqueueWaiter(&cohort->queue, proc_p);
+    requestCohort(cohort, sem_id);
+}
+
+// DSM_MSG_RD_LOCK: Process requesting read lock, or server granted one.
+static void handler_rd_lock (int fd, dsm_msg *mp) {
+    int pid = mp->lock.pid, lock_id = mp->lock.lock_id;
+    dsm_rwcohort *rwc = getRWCohort(lock_id);
+    dsm_proc *proc_p;
+
+    // Verify state.
+    ASSERT_STATE(g_started == 1);
+
+    // If from server: Grant is shared by all queued readers.
+    if (fd == g_sock_server) {
+        ASSERT_COND(rwc->rd_state == DSM_RD_REQUESTED);
+        rwc->rd_state = DSM_RD_HELD;
+        rwc->draining = 0;
+
+        while ((proc_p = dequeueWaiter(&rwc->queue, 0, 0)) != NULL) {
+            rwc->nreaders++;
+            completeWait(proc_p);
+        }
+        return;
+    }
+
+    // Otherwise: Ensure process actually exists.
+    ASSERT_COND((proc_p = dsm_getProcessTableEntry(g_proc_tab, fd, pid))
+        != NULL);
+
+    // Only one request may be outstanding per process.
+    ASSERT_COND(proc_p->flags.is_waiting == 0);
+
+    // Set waiting bit.
+    proc_p->flags.is_waiting = 1;
+
+    // Join the held grant unless it is being returned.
+    if (rwc->rd_state == DSM_RD_HELD && rwc->draining == 0) {
+        rwc->nreaders++;
+        completeWait(proc_p);
+        return;
+    }
+
+    // Otherwise queue. Request from server if no grant is outstanding.
+    enqueueWaiter(&rwc->queue, proc_p);
+    requestReadGrant(rwc, lock_id);
+}
+
+// DSM_MSG_WR_LOCK: Process requesting write lock, or server granted one.
+static void handler_wr_lock (int fd, dsm_msg *mp) {
+    int proc_fd, pid = mp->lock.pid;
+    dsm_rwcohort *rwc = getRWCohort(mp->lock.lock_id);
+    dsm_proc *proc_p;
+
+    // Verify state.
+    ASSERT_STATE(g_started == 1);
+
+    // If from server: Complete wait of the writer.
+    if (fd == g_sock_server) {
+        ASSERT_COND(rwc->writer == 0);
+        ASSERT_COND((proc_p = dsm_findProcessTableEntry(g_proc_tab, pid,
+            &proc_fd)) != NULL);
+        rwc->writer = pid;
+        completeWait(proc_p);
+        return;
+    }
+
+    // Otherwise: Ensure process actually exists.
+    ASSERT_COND((proc_p = dsm_getProcessTableEntry(g_proc_tab, fd, pid))
+        != NULL);
+
+    // Only one request may be outstanding per process.
+    ASSERT_COND(proc_p->flags.is_waiting == 0);
+
+    // Set waiting bit, forward to server.
+    proc_p->flags.is_waiting = 1;
+    dsm_send_msg(g_sock_server, mp);
+}
+
+// DSM_MSG_RW_UNLOCK: Process releasing a read or write lock.
+static void handler_rw_unlock (int fd, dsm_msg *mp) {
+    int pid = mp->lock.pid, lock_id = mp->lock.lock_id;
+    dsm_rwcohort *rwc = getRWCohort(lock_id);
+
+    // Verify state + sender.
+    ASSERT_STATE(g_started == 1 && fd != g_sock_server);
+
+    // Verify process exists.
+    ASSERT_COND(dsm_getProcessTableEntry(g_proc_tab, fd, pid) != NULL);
+
+    // If writer: Return write grant to server.
+    if (rwc->writer == pid) {
+        rwc->writer = 0;
+        dsm_send_msg(g_sock_server, mp);
+        return;
+    }
+
+    // Otherwise reader: The read grant is returned with the last reader.
+    ASSERT_COND(rwc->rd_state == DSM_RD_HELD && rwc->nreaders > 0);
+    if (--rwc->nreaders > 0) {
+        return;
+    }
+
+    dsm_send_msg(g_sock_server, mp);
+    rwc->rd_state = DSM_RD_NONE;
+    rwc->draining = 0;
+
+    // Readers queued while draining need a new grant.
+    requestReadGrant(rwc, lock_id);
+}
+
+// DSM_MSG_RW_DRAIN: Server has a preferred writer waiting on a lock.
+static void handler_rw_drain (int fd, dsm_msg *mp) {
+    dsm_rwcohort *rwc = getRWCohort(mp->lock.lock_id);
+
+    // Verify state + sender.
+    ASSERT_STATE(g_started == 1 && fd == g_sock_server);
+
+    // Stop admitting local readers to a held grant.
+    if (rwc->rd_state == DSM_RD_HELD) {
+        rwc->draining = 1;
+    }
+}
+
+/* DSM_MSG_P2P_DATA: Process sending data, or the server (or a peer) routing it
+ * to us.
+*/
+static void handler_p2p_data (int fd, dsm_msg *mp) {
+    int dst_gid = mp->p2p.dst_gid, src_fd;
+    dsm_mailbox *mbox = getMailbox(dst_gid);
+
+    // Verify state (a peer may start its processes before us).
+    ASSERT_STATE(g_started == 1 || isPeer(fd));
+
+    // If from a process: Verify the sender.
+    if (isLocal(fd)) {
+        ASSERT_COND(dsm_getProcessTableEntryWithGID(g_proc_tab,
+            mp->p2p.src_gid, &src_fd) != NULL && src_fd == fd);
+
+        // Route through the peer reaching the receiver (or the server) unless
+        // the receiver is local.
+        if (dsm_getProcessTableEntryWithGID(g_proc_tab, dst_gid, NULL)
+            == NULL) {
+            dsm_send_msg(mbox->is_routed ? mbox->peer_fd : g_sock_server, mp);
+            return;
+        }
+    }
+
+    // Buffer the data, and deliver it if a receive is pending.
+    putMailbox(mbox, mp);
+    deliverMailbox(mbox, dst_gid);
+}
+
+// DSM_MSG_P2P_RECV: Process receiving data from a process (by GID).
+static void handler_p2p_recv (int fd, dsm_msg *mp) {
+    int dst_gid = mp->p2p.dst_gid, dst_fd;
+    dsm_mailbox *mbox = getMailbox(dst_gid);
+
+    // Verify state + sender.
+    ASSERT_STATE(g_started == 1 && fd != g_sock_server);
+
+    // Verify receiver is the sender, and has no receive pending.
+    ASSERT_COND(dsm_getProcessTableEntryWithGID(g_proc_tab, dst_gid, &dst_fd)
+        != NULL && dst_fd == fd);
+    ASSERT_COND(mbox->recv_left == 0 && mp->p2p.size > 0);
+
+    // Register the receive, and deliver what is already buffered.
+    mbox->recv_fd = fd;
+    mbox->recv_src = mp->p2p.src_gid;
+    mbox->recv_left = (size_t)mp->p2p.size;
+    deliverMailbox(mbox, dst_gid);
+}
+
+// DSM_MSG_FILL_RUN: Process queueing a modified run of a hole.
+static void handler_fill_run (int fd, dsm_msg *mp) {
+
+    // Verify state + sender.
+    ASSERT_STATE(g_started == 1 && fd != g_sock_server);
+
+    // Verify run is in the shared map.
+    ASSERT_COND(mp->data.offset >= 0 && mp->data.size > 0 &&
+        mp->data.offset + mp->data.size <= (int64_t)g_map_size);
+
+    putFillRun(fd, mp->data.offset, mp->data.size);
+}
+
+// DSM_MSG_FILL_END: Process filling its queued runs (without blocking).
+static void handler_fill_end (int fd, dsm_msg *mp) {
+    int pid = mp->proc.pid;
+    int64_t offset, size;
+    dsm_proc *proc_p;
+
+    // Verify state + sender.
+    ASSERT_STATE(g_started == 1 && fd != g_sock_server);
+
+    // Verify PID is registered, and has no sync request outstanding.
+    ASSERT_COND((proc_p = dsm_getProcessTableEntry(g_proc_tab, fd, pid))
+        != NULL && proc_p->flags.is_waiting == 0);
+
+    // Set waiting bit (the fill completes like a sync request).
+    proc_p->flags.is_waiting = 1;
+
+    // A clean hole has nothing to write. Complete it at once.
+    if (getFillRange(fd, &offset, &size) == 0) {
+        completeWait(proc_p);
+        return;
+    }
+
+    // Otherwise request the token (or the pages) on behalf of the process.
+    proc_p->flags.is_filling = 1;
+    if (g_cfg.page_owner != 0) {
+        requestPages(proc_p, fd, offset, size);
+    } else {
+        requestWrite(proc_p, fd);
+    }
+}
+
+// DSM_MSG_OPEN_SEM, OPEN_RWL: Process resolving a named object to a handle.
+static void handler_open_sem (int fd, dsm_msg *mp) {
+    int proc_fd, pid = mp->name.pid;
+
+    // Verify state.
+    ASSERT_STATE(g_started == 1);
+
+    // If from server: Forward handle to process.
+    if (fd == g_sock_server) {
+        ASSERT_COND(dsm_findProcessTableEntry(g_proc_tab, pid, &proc_fd)
+            != NULL);
+        dsm_send_msg(proc_fd, mp);
+        return;
+    }
+
+    // Otherwise: Ensure process actually exists.
+    ASSERT_COND(dsm_getProcessTableEntry(g_proc_tab, fd, pid) != NULL);
+
+    // Forward request to server.
     dsm_send_msg(g_sock_server, mp);
 }
 
-// DSM_MSG_EXIT: Process exiting.
+/* DSM_MSG_SET_PEER: Server names a peer to send write data to. Connect to it,
+ * and introduce ourselves. An empty entry ends the list.
+*/
+static void handler_set_peer (int fd, dsm_msg *mp) {
+    dsm_msg msg = {.type = DSM_MSG_ADD_PEER};
+    char addr[DSM_MSG_STR_SIZE + 1];
+    int sock;
+
+    // Verify state + sender + mode.
+    ASSERT_STATE(g_started == 0 && fd == g_sock_server &&
+        g_cfg.peer_data != 0);
+
+    // At the end of the list: The number of peers is known.
+    if (mp->peer.port == 0) {
+        g_npeers_expected = mp->peer.npeers;
+        checkPeers();
+        return;
+    }
+
+    snprintf(addr, sizeof(addr), "%.*s", DSM_MSG_STR_SIZE, mp->peer.addr);
+    if ((sock = dsm_getConnectedSocket(addr,
+        dsm_portToString((unsigned int)mp->peer.port))) == -1) {
+        dsm_panicf("Couldn't reach peer arbiter (%s:%d)", addr,
+            mp->peer.port);
+    }
+
+    dsm_send_msg(sock, &msg);
+    addPeer(sock);
+}
+
+// DSM_MSG_ADD_PEER: A peer arbiter connected to send us write data.
+static void handler_add_peer (int fd, dsm_msg *mp) {
+    UNUSED(mp);
+
+    // Verify state + sender + mode.
+    ASSERT_STATE(g_started == 0 && fd != g_sock_server &&
+        g_cfg.peer_data != 0);
+
+    addPeer(fd);
+    checkPeers();
+}
+
+// DSM_MSG_EXIT: Process (or peer arbiter) exiting.
 static void handler_exit (int fd, dsm_msg *mp) {
     UNUSED(mp);
 
     // Verify state + sender.
     ASSERT_STATE(g_started == 1 && fd != g_sock_server);
 
+    // A peer is done. Keep going while local processes remain.
+    if (isPeer(fd)) {
+        remPeer(fd);
+        return;
+    }
+
     // Close socket.
     close(fd);
 
     // Remove from pollable set.
     dsm_removePollable(fd, g_pollSet);
 
-    // If no more connections remain, then stop polling.
-    if (g_pollSet->fp <= 2) {
+    // If no more local connections remain, then stop polling.
+    if (g_pollSet->fp - g_npeers <= 2) {
         g_alive = 0;
     }
 }
@@ -387,12 +2135,14 @@ static void handler_exit (int fd, dsm_msg *mp) {
 */
 
 
-// Sends signal to 'pid'. 
-static void signalProcess (int pid, int signal) {
-    if (kill(pid, signal) == -1) {
-        dsm_panicf("(%s:%d) Could not send signal: \"%s\" to process %d!\n", 
-			__FILE__, __LINE__, strsignal(signal), pid);
+// Returns the control slot assigned to pid. Returns NULL if none.
+static dsm_ctrl_slot *getControlSlot (int pid) {
+    for (unsigned int i = 0; i < g_ctrl->nslots; i++) {
+        if (g_ctrl->slots[i].pid == pid) {
+            return g_ctrl->slots + i;
+        }
     }
+    return NULL;
 }
 
 // Contacts daemon with sid, sets session details. Exits fatally on error.
@@ -430,6 +2180,31 @@ static int getServerSocket (dsm_cfg *cfg) {
 	return sock;
 }
 
+// Sends the server the write-grant policy of the session.
+static void send_grant_msg (void) {
+    dsm_msg msg = {.type = DSM_MSG_SET_GRANT};
+    msg.grant.policy = (int32_t)g_cfg.grant_policy;
+    msg.grant.param = (int32_t)g_cfg.grant_param;
+    dsm_send_msg(g_sock_server, &msg);
+}
+
+// Sends the server our address (as it sees it) and listener port, for peers.
+static void send_peer_info (void) {
+    dsm_msg msg = {.type = DSM_MSG_ADD_PEER};
+    char addr[INET6_ADDRSTRLEN];
+    unsigned int port;
+
+    dsm_getSocketInfo(g_sock_server, addr, sizeof(addr), NULL);
+    dsm_getSocketInfo(g_sock_listen, NULL, 0, &port);
+
+    if (strlen(addr) > DSM_MSG_STR_SIZE) {
+        dsm_panicf("Address too long for message (%s)", addr);
+    }
+    memcpy(msg.peer.addr, addr, strlen(addr));
+    msg.peer.port = (int32_t)port;
+    dsm_send_msg(g_sock_server, &msg);
+}
+
 // Handles a connection to listener socket.
 static void handle_new_connection (int fd) {
     struct sockaddr_storage newAddr;
@@ -489,10 +2264,19 @@ int main (int argc, const char *argv[]) {
     struct pollfd *pfd = NULL;  // Pointer to a struct pollfd instance.
 
 	// Parse program arguments.
-	if (argc != 6 || sscanf(argv[1], "%u", &g_cfg.tproc) != 1 || 
-		sscanf(argv[5], "%zu", &g_cfg.map_size) != 1) {
+	if (argc != 13 || sscanf(argv[1], "%u", &g_cfg.tproc) != 1 || 
+		sscanf(argv[5], "%zu", &g_cfg.map_size) != 1 ||
+		sscanf(argv[6], "%u", &g_cfg.lease_writes) != 1 ||
+		sscanf(argv[7], "%u", &g_cfg.lease_ms) != 1 ||
+		sscanf(argv[8], "%u", &g_cfg.page_owner) != 1 ||
+		sscanf(argv[9], "%u", &g_cfg.lazy_pages) != 1 ||
+		sscanf(argv[10], "%u", &g_cfg.peer_data) != 1 ||
+		sscanf(argv[11], "%u", &g_cfg.grant_policy) != 1 ||
+		sscanf(argv[12], "%u", &g_cfg.grant_param) != 1) {
 		dsm_cpanic("Usage: ./dsm_arbiter <nproc> <sid_name> <d_addr> "\
-			"<d_port> <map_size>", "Bad arguments!");
+			"<d_port> <map_size> <lease_writes> <lease_ms> <page_owner> "\
+			"<lazy_pages> <peer_data> <grant_policy> <grant_param>",
+			"Bad arguments!");
 	} else {
 		g_cfg.sid_name = argv[2];
 		g_cfg.d_addr = argv[3];
@@ -515,22 +2299,60 @@ int main (int argc, const char *argv[]) {
 	g_map_size = dsm_setSharedFileSize(fd, MAX(DSM_SHM_FILE_SIZE, 
 		g_cfg.map_size));
 
-	// Map shared file to memory.
+	// Map shared file to memory, and zero it.
 	g_shared_map = dsm_mapSharedFile(fd, g_map_size, PROT_READ|PROT_WRITE);
+	memset(g_shared_map, 0, g_map_size);
+
+	// Create, size, map, and zero the control file.
+	fd = dsm_getSharedFile(DSM_CTRL_FILE_NAME, NULL);
+	dsm_setSharedFileSize(fd, DSM_CTRL_FILE_SIZE);
+	g_ctrl = dsm_mapSharedFile(fd, DSM_CTRL_FILE_SIZE, PROT_READ|PROT_WRITE);
+	memset(g_ctrl, 0, DSM_CTRL_FILE_SIZE);
+
+	// Allocate page states (all unowned, none fetched), if used.
+	if (g_cfg.page_owner != 0 || g_cfg.lazy_pages != 0) {
+		g_npages = ((size_t)g_map_size + DSM_PAGESIZE - 1) / DSM_PAGESIZE;
+		if ((g_pages = calloc(g_npages, sizeof(dsm_page))) == NULL) {
+			dsm_panic("Couldn't allocate page states!");
+		}
+	}
 
 
     // Register functions.
     dsm_setMsgFunc(DSM_MSG_CNT_ALL, handler_cnt_all, g_fmap);
     dsm_setMsgFunc(DSM_MSG_REL_BAR, handler_rel_bar, g_fmap);
     dsm_setMsgFunc(DSM_MSG_WRT_NOW, handler_wrt_now, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_WRT_REVOKE, handler_wrt_revoke, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_OWN_NOW, handler_own_now, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_OWN_REVOKE, handler_own_revoke, g_fmap);
     dsm_setMsgFunc(DSM_MSG_SET_GID, handler_set_gid, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_SET_PEER, handler_set_peer, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_ADD_PEER, handler_add_peer, g_fmap);
     dsm_setMsgFunc(DSM_MSG_ADD_PID, handler_add_pid, g_fmap);
     dsm_setMsgFunc(DSM_MSG_REQ_WRT, handler_req_wrt, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_REQ_OWN, handler_req_own, g_fmap);
     dsm_setMsgFunc(DSM_MSG_HIT_BAR, handler_hit_bar, g_fmap);
     dsm_setMsgFunc(DSM_MSG_WRT_DATA, handler_wrt_data, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_WRT_RUNS, handler_wrt_runs, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_OWN_DATA, handler_wrt_data, g_fmap);
 	dsm_setMsgFunc(DSM_MSG_WRT_END, handler_wrt_end, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_GET_PAGE, handler_get_page, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_PAGE_DATA, handler_page_data, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_INV_PAGE, handler_inv_page, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_SET_PROTO, handler_set_proto, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_SUBSCRIBE, handler_set_proto, g_fmap);
     dsm_setMsgFunc(DSM_MSG_POST_SEM, handler_post_sem, g_fmap);
     dsm_setMsgFunc(DSM_MSG_WAIT_SEM, handler_wait_sem, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_OPEN_SEM, handler_open_sem, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_OPEN_RWL, handler_open_sem, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_RD_LOCK, handler_rd_lock, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_WR_LOCK, handler_wr_lock, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_RW_UNLOCK, handler_rw_unlock, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_RW_DRAIN, handler_rw_drain, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_P2P_DATA, handler_p2p_data, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_P2P_RECV, handler_p2p_recv, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_FILL_RUN, handler_fill_run, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_FILL_END, handler_fill_end, g_fmap);
     dsm_setMsgFunc(DSM_MSG_EXIT, handler_exit, g_fmap);
 
     // Initialize pollable set.
@@ -542,6 +2364,26 @@ int main (int argc, const char *argv[]) {
     // Initialize server socket.
     g_sock_server = getServerSocket(&g_cfg);
 
+    // Have the server forward only writes to pages we fetched, if lazy.
+    if (g_cfg.lazy_pages != 0) {
+        send_easy_msg(g_sock_server, DSM_MSG_SET_LAZY);
+    }
+
+    // Have the server end our leases when others want to write (if leasing).
+    if (g_cfg.lease_writes > 0) {
+        send_easy_msg(g_sock_server, DSM_MSG_SET_LEASE);
+    }
+
+    // Set the write-grant policy, unless the default.
+    if (g_cfg.grant_policy != 0 || g_cfg.grant_param != 0) {
+        send_grant_msg();
+    }
+
+    // Tell the server where peers reach us, if sending them write data.
+    if (g_cfg.peer_data != 0) {
+        send_peer_info();
+    }
+
     // Register listener socket as pollable at index zero.
     dsm_setPollable(g_sock_listen, POLLIN, g_pollSet);
 
@@ -552,7 +2394,8 @@ int main (int argc, const char *argv[]) {
     // ------------------------------------------------------------------------
 
     // Keep polling as long as no errors occur, or alive flag not false.
-    while (g_alive && (new = poll(g_pollSet->fds, g_pollSet->fp, -1)) != -1) {
+    while (g_alive && (new = poll(g_pollSet->fds, g_pollSet->fp,
+        getPollTimeout())) != -1) {
         for (unsigned int i = 0; i < g_pollSet->fp; i++) {
             pfd = g_pollSet->fds + i;
 
@@ -567,13 +2410,44 @@ int main (int argc, const char *argv[]) {
             }
         }
 
+        // Hand back an expired lease.
+        checkLease();
+
+        // Acknowledge a remote write once its invalidations are applied.
+        checkInvalidations();
+
+        // Send what was queued, one batch per destination.
+        flushWriteRequests();
+        dsm_flush_msgs();
+
         printf("\rExchanged Messages: %u", g_msg_count); fflush(stdout);
     }
 
     // ------------------------------------------------------------------------
 
-    // Send exit message.
+    // Hand back any lease.
+    if (g_lease.held == 1) {
+        g_lease.revoked = 1;
+        checkLease();
+    }
+
+    // Hand back any owned pages.
+    for (size_t i = 0; i < g_npages; i++) {
+        if (g_pages[i].is_owned == 1) {
+            dropPage(i);
+        }
+    }
+
+    // Send exit message (to peers too).
     send_easy_msg(g_sock_server, DSM_MSG_EXIT);
+    while (g_npeers > 0) {
+        send_easy_msg(g_peers[0], DSM_MSG_EXIT);
+        remPeer(g_peers[0]);
+    }
+    free(g_peers);
+
+    // Free message batches.
+    dsm_free_msgs();
 
 	// Close and remove listener socket.
     close(g_sock_listen);
@@ -586,6 +2460,16 @@ int main (int argc, const char *argv[]) {
     // Free the process table.
     dsm_freeProcessTable(g_proc_tab);
 
+    // Free the semaphore and reader-writer lock cohorts.
+    free(g_cohorts);
+    free(g_rwcohorts);
+
+    // Free the point-to-point mailboxes.
+    freeMailboxes();
+
+    // Free the page states.
+    free(g_pages);
+
     // Free the pollable set.
     dsm_freePollSet(g_pollSet);
 
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <string.h>
+#include "dsm_heap.h"
+#include "dsm_util.h"
+
+
+/*
+ *******************************************************************************
+ *                        Internal Function Definitions                        *
+ *******************************************************************************
+*/
+
+
+// Returns the smallest shift such that (1 << shift) >= size.
+static unsigned int size_shift (size_t size) {
+	unsigned int shift = DSM_HEAP_MIN_SHIFT;
+	while (((size_t)1 << shift) < size) {
+		shift++;
+	}
+	return shift;
+}
+
+// Returns the number of slots in a slab with the given slot shift.
+static size_t slab_slots (dsm_heap *heap, unsigned int shift) {
+	return heap->pagesize >> shift;
+}
+
+// Returns the address of a page.
+static void *page_addr (dsm_heap *heap, size_t page) {
+	return (void *)((uintptr_t)heap->base + page * heap->pagesize);
+}
+
+// Allocates a slot in a slab of the given shift. Returns NULL if none left.
+static void *alloc_slot (dsm_heap *heap, unsigned int shift) {
+	size_t nslots = slab_slots(heap, shift), words = (nslots + 63) / 64;
+	dsm_heap_page *p = NULL;
+	size_t page, slot;
+
+	// Find a slab of the class with a free slot.
+	for (page = 0; page < heap->npages; page++) {
+		p = heap->pages + page;
+		if (p->kind == DSM_HEAP_PAGE_SLAB && p->shift == shift &&
+			p->nused < nslots) {
+			break;
+		}
+	}
+
+	// Otherwise turn a free page into a new slab.
+	if (page == heap->npages) {
+		for (page = 0; page < heap->npages; page++) {
+			if (heap->pages[page].kind == DSM_HEAP_PAGE_FREE) {
+				break;
+			}
+		}
+
+		if (page == heap->npages) {
+			return NULL;
+		}
+
+		p = heap->pages + page;
+		p->kind = DSM_HEAP_PAGE_SLAB;
+		p->shift = shift;
+		p->nused = 0;
+		p->used = dsm_zalloc(words * sizeof(uint64_t));
+	}
+
+	// Take the first free slot.
+	for (slot = 0; (p->used[slot / 64] >> (slot % 64)) & 1; slot++);
+	p->used[slot / 64] |= (uint64_t)1 << (slot % 64);
+	p->nused++;
+
+	return (void *)((uintptr_t)page_addr(heap, page) + (slot << shift));
+}
+
+// Allocates npages consecutive pages (first fit). Returns NULL if none left.
+static void *alloc_run (dsm_heap *heap, size_t npages) {
+	size_t start = 0, len = 0;
+
+	for (size_t page = 0; page < heap->npages && len < npages; page++) {
+		if (heap->pages[page].kind != DSM_HEAP_PAGE_FREE) {
+			len = 0;
+			continue;
+		}
+		if (len++ == 0) {
+			start = page;
+		}
+	}
+
+	if (len < npages) {
+		return NULL;
+	}
+
+	// Mark the block.
+	heap->pages[start].kind = DSM_HEAP_PAGE_RUN;
+	heap->pages[start].npages = npages;
+	for (size_t page = start + 1; page < start + npages; page++) {
+		heap->pages[page].kind = DSM_HEAP_PAGE_TAIL;
+	}
+
+	return page_addr(heap, start);
+}
+
+
+/*
+ *******************************************************************************
+ *                            Function Definitions                             *
+ *******************************************************************************
+*/
+
+
+// Creates a heap over npages pages at base. Exits fatally on error.
+dsm_heap *dsm_new_heap (void *base, size_t npages, size_t pagesize) {
+	dsm_heap *heap;
+
+	// Page size must be a power of two, and hold the smallest slab.
+	if ((pagesize & (pagesize - 1)) != 0 ||
+		pagesize < (2 << DSM_HEAP_MIN_SHIFT)) {
+		dsm_cpanic("dsm_new_heap", "Bad page size!");
+	}
+
+	heap = dsm_zalloc(sizeof(dsm_heap));
+	heap->base = base;
+	heap->pagesize = pagesize;
+	heap->npages = npages;
+	heap->pages = dsm_zalloc(MAX(npages, 1) * sizeof(dsm_heap_page));
+
+	return heap;
+}
+
+/* Allocates size bytes aligned to align (a power of two, at most a page).
+ * Returns NULL if size is zero, or no space is left.
+*/
+void *dsm_heap_alloc (dsm_heap *heap, size_t size, size_t align) {
+
+	// Verify alignment.
+	if (align == 0 || (align & (align - 1)) != 0 || align > heap->pagesize) {
+		dsm_cpanic("dsm_heap_alloc", "Bad alignment!");
+	}
+
+	if (size == 0) {
+		return NULL;
+	}
+
+	// Slots are aligned to their size: Use a class covering the alignment.
+	if (MAX(size, align) <= heap->pagesize / 2) {
+		return alloc_slot(heap, size_shift(MAX(size, align)));
+	}
+
+	// Otherwise allocate whole pages.
+	return alloc_run(heap, (size + heap->pagesize - 1) / heap->pagesize);
+}
+
+// Releases a block. Returns nonzero if ptr isn't an allocated block.
+int dsm_heap_release (dsm_heap *heap, void *ptr) {
+	uintptr_t offset = (uintptr_t)ptr - (uintptr_t)heap->base;
+	size_t page = offset / heap->pagesize, slot;
+	dsm_heap_page *p;
+
+	// Verify pointer is in heap.
+	if ((uintptr_t)ptr < (uintptr_t)heap->base || page >= heap->npages) {
+		return -1;
+	}
+
+	p = heap->pages + page;
+	offset %= heap->pagesize;
+
+	// Large block: Must be its first byte.
+	if (p->kind == DSM_HEAP_PAGE_RUN) {
+		if (offset != 0) {
+			return -1;
+		}
+		for (size_t i = page; i < page + p->npages; i++) {
+			heap->pages[i].kind = DSM_HEAP_PAGE_FREE;
+		}
+		return 0;
+	}
+
+	// Small block: Must be the start of a used slot.
+	if (p->kind != DSM_HEAP_PAGE_SLAB || (offset & ((1u << p->shift) - 1))) {
+		return -1;
+	}
+
+	slot = offset >> p->shift;
+	if (((p->used[slot / 64] >> (slot % 64)) & 1) == 0) {
+		return -1;
+	}
+
+	p->used[slot / 64] &= ~((uint64_t)1 << (slot % 64));
+
+	// Return empty slabs to the free pages.
+	if (--p->nused == 0) {
+		free(p->used);
+		p->used = NULL;
+		p->kind = DSM_HEAP_PAGE_FREE;
+	}
+
+	return 0;
+}
+
+// Frees a heap (the memory it manages is untouched).
+void dsm_free_heap (dsm_heap *heap) {
+	if (heap == NULL) {
+		return;
+	}
+
+	for (size_t page = 0; page < heap->npages; page++) {
+		free(heap->pages[page].used);
+	}
+
+	free(heap->pages);
+	free(heap);
+}
@@ -1,8 +1,20 @@
 #include <stdio.h>
+#include <string.h>
 #include "dsm_holes.h"
 #include "dsm_util.h"
 
 
+/*
+ *******************************************************************************
+ *                             Symbolic Constants                              *
+ *******************************************************************************
+*/
+
+
+// Minimum capacity of a hole table.
+#define DSM_MIN_HOLES			16
+
+
 /*
  *******************************************************************************
  *                              Global Variables                               *
@@ -21,24 +33,40 @@ int g_hole_id;
 */
 
 
-// Removes hole with id from linked-list. Sets exists to 1 if it was found.
-static dsm_hole *remove_hole (int id, int *exist_p, dsm_hole *holes) {
-	dsm_hole *next;
-
-	// If end of list. Return.
-	if (holes == NULL) return NULL;
+// Returns the number of holes starting before offset (binary search).
+static size_t holes_before (off_t offset, dsm_hole_tab *tab) {
+	size_t lo = 0, hi = tab->length, mid;
 
-	// If current node is target, free it and return next.
-	if (holes->id == id) {
-		if (exist_p != NULL) *exist_p = 1;
-		next = holes->next;
-		free(holes);
-		return next;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (tab->holes[mid].offset < offset) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
 	}
 
-	// Otherwise return next.
-	holes->next = remove_hole(id, exist_p, holes->next);
-	return holes;
+	return lo;
+}
+
+// Returns the number of tracked blocks in a hole.
+static size_t hole_blocks (dsm_hole *hole) {
+	return (hole->size + hole->block - 1) / hole->block;
+}
+
+// Returns nonzero if the given block of a hole is marked modified.
+static int is_dirty (dsm_hole *hole, size_t block) {
+	return (hole->dirty[block / 64] >> (block % 64)) & 1;
+}
+
+// Returns the index of hole with id. Returns -1 if none exists.
+static ssize_t hole_index (int id, dsm_hole_tab *tab) {
+	for (size_t i = 0; i < tab->length; i++) {
+		if (tab->holes[i].id == id) {
+			return (ssize_t)i;
+		}
+	}
+	return -1;
 }
 
 
@@ -49,133 +77,209 @@ static dsm_hole *remove_hole (int id, int *exist_p, dsm_hole *holes) {
 */
 
 
-// Creates a hole. Returns positive ID on success, or -1 on error.
-int dsm_new_hole (off_t offset, size_t size, dsm_hole **holes) {
-	dsm_hole *hole;
+// Creates a hole tracking blocks of the given size. Returns ID, or -1.
+static int new_hole (off_t offset, size_t size, size_t block,
+	dsm_hole_tab *tab) {
+	size_t i, capacity;
+	dsm_hole *holes;
 
 	// Return -1 if hole overlaps another hole.
-	if (dsm_overlaps_hole(offset, size, *holes) != 0) {
+	if (tab == NULL || dsm_overlaps_hole(offset, size, tab) != 0) {
 		return -1;
 	}
 
-	// Compute the next ID.
-	unsigned int id = g_hole_id++;
-
-	// Allocate hole. Return -1 on error.
-	if (holes == NULL || (hole = malloc(sizeof(dsm_hole))) == NULL) {
-		return -1;
+	// Grow table if full. Return -1 on error.
+	if (tab->length == tab->capacity) {
+		capacity = MAX(DSM_MIN_HOLES, 2 * tab->capacity);
+		if ((holes = realloc(tab->holes, capacity * sizeof(dsm_hole)))
+			== NULL) {
+			return -1;
+		}
+		tab->holes = holes;
+		tab->capacity = capacity;
 	}
 
-	// Configure it.
-	*hole = (dsm_hole) {
-		.id = id,
+	// Insert hole at its sorted position.
+	i = holes_before(offset, tab);
+	memmove(tab->holes + i + 1, tab->holes + i,
+		(tab->length - i) * sizeof(dsm_hole));
+	tab->length++;
+
+	tab->holes[i] = (dsm_hole) {
+		.id = g_hole_id++,
 		.offset = offset,
 		.size = size,
-		.next = *holes
+		.block = block
 	};
 
-	// Insert node at head of linked-list.
-	*holes = hole;
+	// Allocate the (clean) modification bitmap.
+	tab->holes[i].dirty = dsm_zalloc(((hole_blocks(tab->holes + i) + 63) / 64)
+		* sizeof(uint64_t));
 
 	// Return identifier.
-	return id;
+	return tab->holes[i].id;
 }
 
-// Frees a linked list of memory holes.
-void dsm_free_holes (dsm_hole *holes) {
-	if (holes == NULL) {
-		return;
-	}
-	dsm_free_holes(holes->next);
-	free(holes);
+// Creates a hole. Returns positive ID on success, or -1 on error.
+int dsm_new_hole (off_t offset, size_t size, dsm_hole_tab *tab) {
+	return new_hole(offset, size, DSM_HOLE_BLOCK_SIZE, tab);
 }
 
+/* Creates a hole tracking modifications to the byte (not by block). For holes
+ * no one claimed, where a whole block may hold data of others. Returns
+ * positive ID on success, or -1 on error.
+*/
+int dsm_new_exact_hole (off_t offset, size_t size, dsm_hole_tab *tab) {
+	return new_hole(offset, size, 1, tab);
+}
+
+// Frees all holes in the table. The table is left empty.
+void dsm_free_holes (dsm_hole_tab *tab) {
+	for (size_t i = 0; i < tab->length; i++) {
+		free(tab->holes[i].dirty);
+	}
+	free(tab->holes);
+	*tab = (dsm_hole_tab){0};
+}
 
 /* Returns pointer to a hole if the memory space resides inside one.
  * Ext is added to the compared hole size. It allows accesses to the last
  * byte of the hole to not count as outside the hole.
 */
 dsm_hole *dsm_in_hole (off_t offset, size_t size, size_t ext, 
-	dsm_hole *holes) {
+	dsm_hole_tab *tab) {
+	off_t end = offset + (off_t)size, hole_end;
+	size_t i = holes_before(offset + 1, tab);
 	dsm_hole *hole;
-	off_t start = offset, end = offset + size;
-	off_t hole_start, hole_end;
 
-	for (hole = holes; hole != NULL; hole = hole->next) {
-		hole_start = hole->offset;
-		hole_end = hole_start + hole->size + ext;
+	// Only the last hole starting at or before offset can contain it.
+	if (i == 0) {
+		return NULL;
+	}
 
-		// If start begins in that hole, ensure end is before hole end.
-		if (start >= hole_start && start < hole_end) {
-			return ((end <= hole_end) ? hole : NULL);
-		}
+	hole = tab->holes + (i - 1);
+	hole_end = hole->offset + (off_t)(hole->size + ext);
+
+	// If start begins in that hole, ensure end is before hole end.
+	if (offset < hole_end) {
+		return ((end <= hole_end) ? hole : NULL);
 	}
 
 	return NULL;
 }
 
 // Returns a pointer to a hole given a hole identifier. Returns NULL on error.
-dsm_hole *dsm_get_hole (int id, dsm_hole *holes) {
-	
-	// Base case: No hole.
-	if (holes == NULL) {
-		return NULL;
-	}
+dsm_hole *dsm_get_hole (int id, dsm_hole_tab *tab) {
+	ssize_t i = hole_index(id, tab);
+	return (i == -1) ? NULL : tab->holes + i;
+}
 
-	// Base case: At hole.
-	if (holes->id == id) {
-		return holes;
+// Returns nonzero if given memory range overlaps with a hole.
+int dsm_overlaps_hole (off_t offset, size_t size, dsm_hole_tab *tab) {
+	size_t i = holes_before(offset + (off_t)size, tab);
+	dsm_hole *hole;
+
+	// Holes are disjoint and sorted, so the last hole starting before the
+	// end of the range also ends last. It overlaps if it ends after start.
+	if (i == 0) {
+		return 0;
 	}
 
-	// Recursive case: Search next hole.
-	return dsm_get_hole(id, holes->next);
+	hole = tab->holes + (i - 1);
+	return (hole->offset + (off_t)hole->size > offset);
 }
 
-// Returns nonzero if given memory range overlaps with a hole.
-int dsm_overlaps_hole (off_t offset, size_t size, dsm_hole *holes) {
-	dsm_hole *hole;
-	unsigned int start = offset, end = offset + size;
-	unsigned int hole_start, hole_end;
+// Removes a hole. Returns nonzero on error.
+int dsm_del_hole (int id, dsm_hole_tab *tab) {
+	ssize_t i = hole_index(id, tab);
 
-	for (hole = holes; hole != NULL; hole = hole->next) {
-		hole_start = hole->offset;
-		hole_end = hole_start + hole->size;
+	if (i == -1) {
+		return 1;
+	}
 
-		// Case: Start or End is inside another hole.
-		if ((start >= hole_start && start < hole_end) ||
-			(end > hole_start && end < hole_end)) {
-			break;
-		}
+	// Free the modification bitmap, and close the gap.
+	free(tab->holes[i].dirty);
+	memmove(tab->holes + i, tab->holes + i + 1,
+		(tab->length - i - 1) * sizeof(dsm_hole));
+	tab->length--;
 
-		// Case: A hole is within the given range.
-		if (start < hole_start && end >= hole_end) {
-			break;
-		}
+	return 0;
+}
+
+// Records a modification of the given range. Clipped to the hole.
+void dsm_mark_hole (dsm_hole *hole, off_t offset, size_t size) {
+	off_t start = MAX(offset, hole->offset);
+	off_t end = MIN(offset + (off_t)size, hole->offset + (off_t)hole->size);
+
+	// Ignore ranges outside the hole.
+	if (start >= end) {
+		return;
 	}
 
-	return (hole != NULL);
+	// Mark all blocks the range touches.
+	for (size_t b = (start - hole->offset) / hole->block;
+		b <= (size_t)(end - 1 - hole->offset) / hole->block; b++) {
+		hole->dirty[b / 64] |= (uint64_t)1 << (b % 64);
+	}
 }
 
-// Removes a hole. Returns nonzero on error.
-int dsm_del_hole (int id, dsm_hole **holes) {
-	int exists = 0;
+/* Finds the next run of modified blocks at or after block *pos_p. Sets the
+ * offset and size of the run (clipped to the hole), and advances *pos_p past
+ * it. Returns zero if there are no more runs.
+*/
+int dsm_next_dirty_run (dsm_hole *hole, size_t *pos_p, off_t *offset_p,
+	size_t *size_p) {
+	size_t nblocks = hole_blocks(hole), b = *pos_p, start, end;
 
-	// Remove the hole, if it exists.
-	*holes = remove_hole(id, &exists, *holes);
+	// Skip clean blocks (whole words at a time where possible).
+	while (b < nblocks && !is_dirty(hole, b)) {
+		b = (hole->dirty[b / 64] >> (b % 64)) == 0 ? (b / 64 + 1) * 64 : b + 1;
+	}
 
-	return (exists != 1);
+	if (b >= nblocks) {
+		*pos_p = nblocks;
+		return 0;
+	}
+
+	// Extend the run over consecutive modified blocks.
+	for (start = b; b < nblocks && is_dirty(hole, b); b++);
+
+	// Compute the range, clipping the last block to the hole.
+	start *= hole->block;
+	end = MIN(b * hole->block, hole->size);
+	*offset_p = hole->offset + (off_t)start;
+	*size_p = end - start;
+	*pos_p = b;
+
+	return 1;
 }
 
-// [DEBUG] Prints all holes to output.
-void dsm_show_holes (dsm_hole *holes) {
+/* Sets the offset and size of the smallest range spanning all modified runs
+ * of the hole. Returns zero if nothing was modified.
+*/
+int dsm_dirty_range (dsm_hole *hole, off_t *offset_p, size_t *size_p) {
+	size_t pos = 0, size;
+	off_t offset, first;
 
-	// Base case.
-	if (holes == NULL) {
-		return;
+	if (dsm_next_dirty_run(hole, &pos, &first, &size) == 0) {
+		return 0;
 	}
 
-	printf("[%d]: %ld -> %lu\n", holes->id, holes->offset,
-		holes->offset + holes->size);
+	// Extend to the end of the last run.
+	offset = first;
+	while (dsm_next_dirty_run(hole, &pos, &offset, &size) != 0);
+
+	*offset_p = first;
+	*size_p = (size_t)(offset - first) + size;
+
+	return 1;
+}
 
-	dsm_show_holes(holes->next);
-}
\ No newline at end of file
+// [DEBUG] Prints all holes to output.
+void dsm_show_holes (dsm_hole_tab *tab) {
+	for (size_t i = 0; i < tab->length; i++) {
+		printf("[%d]: %lld -> %lld\n", tab->holes[i].id,
+			(long long)tab->holes[i].offset,
+			(long long)(tab->holes[i].offset + tab->holes[i].size));
+	}
+}
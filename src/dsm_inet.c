@@ -9,6 +9,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <sys/wait.h>
@@ -79,6 +80,13 @@ int dsm_getBoundSocket (int flags, int family, int socktype, const char *port) {
 			dsm_panicf("Couldn't reuse port (%s)", port);
 		}
 
+		// Send writes at once (accepted sockets inherit this). Messages are
+		// coalesced by the sender instead (see dsm_queue_msg).
+		if (socktype == SOCK_STREAM &&
+			setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &y, sizeof(y)) == -1) {
+			dsm_panicf("Couldn't disable delay (%s)", port);
+		}
+
 		// Try binding to the socket. Continue if not possible
 		if (bind(s, p->ai_addr, p->ai_addrlen) == -1) {
 			continue;
@@ -98,7 +106,7 @@ int dsm_getBoundSocket (int flags, int family, int socktype, const char *port) {
 // Returns a socket connected to given address and port. Exits fatally on error.
 int dsm_getConnectedSocket (const char *addr, const char *port) {
 	struct addrinfo hints, *res, *p;
-	int s, stat;
+	int s, stat, y = 1;
 
 	// Setup hints. 
 	memset(&hints, 0, sizeof(hints));
@@ -124,6 +132,11 @@ int dsm_getConnectedSocket (const char *addr, const char *port) {
 			continue;
 		}
 
+		// Send writes at once (see dsm_getBoundSocket).
+		if (setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &y, sizeof(y)) == -1) {
+			dsm_panicf("Couldn't disable delay (%s:%s)", addr, port);
+		}
+
 		break;
 	}
 
@@ -241,7 +241,7 @@ static size_t unpack (unsigned char *b, const char *fmt, ...) {
 */
 
 
-// Marshalls: [CNT_ALL, REL_BAR, WRT_END, EXIT].
+// Marshalls: [CNT_ALL, REL_BAR, WRT_REVOKE, SET_LAZY, SET_LEASE, EXIT].
 static void marshall_payload_none (int dir, dsm_msg *mp, unsigned char *b) {
 	const char *fmt = "l";
 	if (dir == 0) {
@@ -261,7 +261,7 @@ static void marshall_payload_sid (int dir, dsm_msg *mp, unsigned char *b) {
 	}
 }
 
-// Marshalls: [ADD_PID, SET_GID, REQ_WRT, WRT_NOW].
+// Marshalls: [ADD_PID, SET_GID, REQ_WRT, HIT_BAR, WRT_NOW, FILL_END].
 static void marshall_payload_proc (int dir, dsm_msg *mp, unsigned char *b) {
 	const char *fmt = "lll";
 	if (dir == 0) {
@@ -271,17 +271,53 @@ static void marshall_payload_proc (int dir, dsm_msg *mp, unsigned char *b) {
 	}
 }
 
-// Marshalls: [GOT_DATA].
+// Marshalls: [GOT_DATA, WRT_END].
 static void marshall_payload_task (int dir, dsm_msg *mp, unsigned char *b) {
-	const char *fmt = "ll";
+	const char *fmt = "lll";
+	if (dir == 0) {
+		pack(b, fmt, mp->type, mp->task.nproc, mp->task.seq);
+	} else {
+		unpack(b, fmt, &(mp->type), &(mp->task.nproc), &(mp->task.seq));
+	}
+}
+
+// Marshalls: [ADD_PEER, SET_PEER].
+static void marshall_payload_peer (int dir, dsm_msg *mp, unsigned char *b) {
+	const char *fmt = "lsll";
+	if (dir == 0) {
+		pack(b, fmt, mp->type, mp->peer.addr, mp->peer.port, mp->peer.npeers);
+	} else {
+		unpack(b, fmt, &(mp->type), mp->peer.addr, &(mp->peer.port),
+			&(mp->peer.npeers));
+	}
+}
+
+// Marshalls: [SET_GRANT].
+static void marshall_payload_grant (int dir, dsm_msg *mp, unsigned char *b) {
+	const char *fmt = "lll";
+	if (dir == 0) {
+		pack(b, fmt, mp->type, mp->grant.policy, mp->grant.param);
+	} else {
+		unpack(b, fmt, &(mp->type), &(mp->grant.policy), &(mp->grant.param));
+	}
+}
+
+// Marshalls: [REQ_WRTS]. Unused entries are zero.
+static void marshall_payload_reqs (int dir, dsm_msg *mp, unsigned char *b) {
 	if (dir == 0) {
-		pack(b, fmt, mp->type, mp->task.nproc);
+		b += pack(b, "ll", mp->type, mp->reqs.npids);
+		for (int i = 0; i < DSM_MSG_MAX_PIDS; i++) {
+			b += pack(b, "l", mp->reqs.pids[i]);
+		}
 	} else {
-		unpack(b, fmt, &(mp->type), &(mp->task.nproc));
+		b += unpack(b, "ll", &(mp->type), &(mp->reqs.npids));
+		for (int i = 0; i < DSM_MSG_MAX_PIDS; i++) {
+			b += unpack(b, "l", &(mp->reqs.pids[i]));
+		}
 	}
 }
 
-// Marshalls: [WRT_DATA]. (the buf field is NOT packed).
+// Marshalls: [WRT_DATA, OWN_DATA, PAGE_DATA, FILL_RUN]. (buf is NOT packed).
 static void marshall_payload_data (int dir, dsm_msg *mp, unsigned char *b) {
 	const char *fmt = "lqq";
 	if (dir == 0) {
@@ -291,13 +327,69 @@ static void marshall_payload_data (int dir, dsm_msg *mp, unsigned char *b) {
 	}
 }
 
+// Marshalls: [WRT_RUNS]. (buf is NOT packed).
+static void marshall_payload_runs (int dir, dsm_msg *mp, unsigned char *b) {
+	const char *fmt = "llq";
+	if (dir == 0) {
+		pack(b, fmt, mp->type, mp->runs.nruns, mp->runs.size);
+	} else {
+		unpack(b, fmt, &(mp->type), &(mp->runs.nruns), &(mp->runs.size));
+	}
+}
+
+// Marshalls: [REQ_OWN, OWN_NOW, OWN_REVOKE, OWN_DROP, GET_PAGE, INV_PAGE,
+// SET_PROTO, SUBSCRIBE].
+static void marshall_payload_own (int dir, dsm_msg *mp, unsigned char *b) {
+	const char *fmt = "lllqq";
+	if (dir == 0) {
+		pack(b, fmt, mp->type, mp->own.pid, mp->own.proto, mp->own.offset,
+			mp->own.size);
+	} else {
+		unpack(b, fmt, &(mp->type), &(mp->own.pid), &(mp->own.proto),
+			&(mp->own.offset), &(mp->own.size));
+	}
+}
+
 // Marshalls: [POST_SEM, WAIT_SEM].
 static void marshall_payload_sem (int dir, dsm_msg *mp, unsigned char *b) {
-	const char *fmt = "lsl";
+	const char *fmt = "lll";
+	if (dir == 0) {
+		pack(b, fmt, mp->type, mp->sem.sem_id, mp->sem.pid);
+	} else {
+		unpack(b, fmt, &(mp->type), &(mp->sem.sem_id), &(mp->sem.pid));
+	}
+}
+
+// Marshalls: [RD_LOCK, WR_LOCK, RW_UNLOCK, RW_DRAIN].
+static void marshall_payload_lock (int dir, dsm_msg *mp, unsigned char *b) {
+	const char *fmt = "lll";
+	if (dir == 0) {
+		pack(b, fmt, mp->type, mp->lock.lock_id, mp->lock.pid);
+	} else {
+		unpack(b, fmt, &(mp->type), &(mp->lock.lock_id), &(mp->lock.pid));
+	}
+}
+
+// Marshalls: [P2P_DATA, P2P_RECV]. (the buf field is NOT packed).
+static void marshall_payload_p2p (int dir, dsm_msg *mp, unsigned char *b) {
+	const char *fmt = "lllq";
+	if (dir == 0) {
+		pack(b, fmt, mp->type, mp->p2p.src_gid, mp->p2p.dst_gid, mp->p2p.size);
+	} else {
+		unpack(b, fmt, &(mp->type), &(mp->p2p.src_gid), &(mp->p2p.dst_gid),
+			&(mp->p2p.size));
+	}
+}
+
+// Marshalls: [OPEN_SEM, OPEN_RWL]. (the buf field is NOT packed).
+static void marshall_payload_name (int dir, dsm_msg *mp, unsigned char *b) {
+	const char *fmt = "llllq";
 	if (dir == 0) {
-		pack(b, fmt, mp->type, mp->sem.sem_name, mp->sem.pid);
+		pack(b, fmt, mp->type, mp->name.pid, mp->name.id, mp->name.flags,
+			mp->name.size);
 	} else {
-		unpack(b, fmt, &(mp->type), mp->sem.sem_name, &(mp->sem.pid));
+		unpack(b, fmt, &(mp->type), &(mp->name.pid), &(mp->name.id),
+			&(mp->name.flags), &(mp->name.size));
 	}
 }
 
@@ -321,8 +413,9 @@ void init_fmaps (void) {
 	}
 
 	// Marshalling: No payloads.
-	fmap[DSM_MSG_CNT_ALL] = fmap[DSM_MSG_REL_BAR]
-		= fmap[DSM_MSG_WRT_END] = fmap[DSM_MSG_EXIT] = marshall_payload_none;
+	fmap[DSM_MSG_CNT_ALL] = fmap[DSM_MSG_REL_BAR] = fmap[DSM_MSG_WRT_REVOKE]
+		= fmap[DSM_MSG_SET_LAZY] = fmap[DSM_MSG_SET_LEASE] = fmap[DSM_MSG_EXIT]
+		= marshall_payload_none;
 
 	// Marshalling: dsm_payload_sid.
 	fmap[DSM_MSG_SET_SID] = fmap[DSM_MSG_GET_SID]
@@ -331,17 +424,47 @@ void init_fmaps (void) {
 	// Marshalling: dsm_payload_proc.
 	fmap[DSM_MSG_ADD_PID] = fmap[DSM_MSG_SET_GID]
 		= fmap[DSM_MSG_HIT_BAR] = fmap[DSM_MSG_REQ_WRT]
-		= fmap[DSM_MSG_WRT_NOW] = marshall_payload_proc;
+		= fmap[DSM_MSG_WRT_NOW] = fmap[DSM_MSG_FILL_END]
+		= marshall_payload_proc;
 
 	// Marshalling: dsm_paylaod_task.
-	fmap[DSM_MSG_GOT_DATA] = marshall_payload_task;
+	fmap[DSM_MSG_GOT_DATA] = fmap[DSM_MSG_WRT_END] = marshall_payload_task;
+
+	// Marshalling: dsm_payload_peer.
+	fmap[DSM_MSG_ADD_PEER] = fmap[DSM_MSG_SET_PEER] = marshall_payload_peer;
+
+	// Marshalling: dsm_payload_reqs.
+	fmap[DSM_MSG_REQ_WRTS] = marshall_payload_reqs;
+
+	// Marshalling: dsm_payload_grant.
+	fmap[DSM_MSG_SET_GRANT] = marshall_payload_grant;
 
 	// Marshalling: dsm_payload_data.
-	fmap[DSM_MSG_WRT_DATA] = marshall_payload_data;
+	fmap[DSM_MSG_WRT_DATA] = fmap[DSM_MSG_OWN_DATA] = fmap[DSM_MSG_FILL_RUN]
+		= fmap[DSM_MSG_PAGE_DATA] = marshall_payload_data;
+
+	// Marshalling: dsm_payload_runs.
+	fmap[DSM_MSG_WRT_RUNS] = marshall_payload_runs;
+
+	// Marshalling: dsm_payload_own.
+	fmap[DSM_MSG_REQ_OWN] = fmap[DSM_MSG_OWN_NOW] = fmap[DSM_MSG_OWN_REVOKE]
+		= fmap[DSM_MSG_OWN_DROP] = fmap[DSM_MSG_GET_PAGE]
+		= fmap[DSM_MSG_INV_PAGE] = fmap[DSM_MSG_SET_PROTO]
+		= fmap[DSM_MSG_SUBSCRIBE] = marshall_payload_own;
 
 	// Marshalling: dsm_payload_sem.
 	fmap[DSM_MSG_POST_SEM] = fmap[DSM_MSG_WAIT_SEM] = marshall_payload_sem;
 
+	// Marshalling: dsm_payload_lock.
+	fmap[DSM_MSG_RD_LOCK] = fmap[DSM_MSG_WR_LOCK] = fmap[DSM_MSG_RW_UNLOCK]
+		= fmap[DSM_MSG_RW_DRAIN] = marshall_payload_lock;
+
+	// Marshalling: dsm_payload_name.
+	fmap[DSM_MSG_OPEN_SEM] = fmap[DSM_MSG_OPEN_RWL] = marshall_payload_name;
+
+	// Marshalling: dsm_payload_p2p.
+	fmap[DSM_MSG_P2P_DATA] = fmap[DSM_MSG_P2P_RECV] = marshall_payload_p2p;
+
 }
 
 
@@ -421,7 +544,7 @@ void dsm_show_msg (dsm_msg *mp) {
 		case DSM_MSG_WRT_NOW:
 			printf("Type: DSM_MSG_WRT_NOW\n");
 			printf("pid = %" PRId32 "\n", mp->proc.pid);
-			printf("gid = %" PRId32 "\n", mp->proc.gid);
+			printf("seq = %" PRId32 "\n", mp->proc.seq);
 			break;
 		case DSM_MSG_SET_GID:
 			printf("Type: DSM_MSG_SET_GID\n");
@@ -437,6 +560,7 @@ void dsm_show_msg (dsm_msg *mp) {
 		case DSM_MSG_GOT_DATA:
 			printf("Type: DSM_MSG_GOT_DATA\n");
 			printf("nproc = %" PRId32 "\n", mp->task.nproc);
+			printf("seq = %" PRId32 "\n", mp->task.seq);
 			break;
 		case DSM_MSG_ADD_PID:
 			printf("Type: DSM_MSG_ADD_PID\n");
@@ -449,6 +573,7 @@ void dsm_show_msg (dsm_msg *mp) {
 		case DSM_MSG_HIT_BAR:
 			printf("Type: DSM_MSG_HIT_BAR\n");
 			printf("pid = %" PRId32 "\n", mp->proc.pid);
+			printf("nproc = %" PRId32 "\n", mp->proc.nproc);
 			break;
 		case DSM_MSG_WRT_DATA:
 			printf("Type: DSM_MSG_WRT_DATA\n");
@@ -459,20 +584,168 @@ void dsm_show_msg (dsm_msg *mp) {
 			}
 			printf("\n");
 			break;
+		case DSM_MSG_WRT_RUNS:
+			printf("Type: DSM_MSG_WRT_RUNS\n");
+			printf("nruns = %" PRId32 "\n", mp->runs.nruns);
+			printf("size = %" PRId64 "\n", mp->runs.size);
+			break;
+		case DSM_MSG_OWN_DATA:
+			printf("Type: DSM_MSG_OWN_DATA\n");
+			printf("offset = %" PRId64 "\n", mp->data.offset);
+			printf("size = %" PRId64 "\n", mp->data.size);
+			break;
+		case DSM_MSG_REQ_OWN:
+			printf("Type: DSM_MSG_REQ_OWN\n");
+			printf("pid = %" PRId32 "\n", mp->own.pid);
+			printf("offset = %" PRId64 "\n", mp->own.offset);
+			printf("size = %" PRId64 "\n", mp->own.size);
+			break;
+		case DSM_MSG_OWN_NOW:
+			printf("Type: DSM_MSG_OWN_NOW\n");
+			printf("pid = %" PRId32 "\n", mp->own.pid);
+			printf("offset = %" PRId64 "\n", mp->own.offset);
+			printf("size = %" PRId64 "\n", mp->own.size);
+			break;
+		case DSM_MSG_OWN_REVOKE:
+			printf("Type: DSM_MSG_OWN_REVOKE\n");
+			printf("pid = %" PRId32 "\n", mp->own.pid);
+			printf("offset = %" PRId64 "\n", mp->own.offset);
+			printf("size = %" PRId64 "\n", mp->own.size);
+			break;
+		case DSM_MSG_OWN_DROP:
+			printf("Type: DSM_MSG_OWN_DROP\n");
+			printf("pid = %" PRId32 "\n", mp->own.pid);
+			printf("offset = %" PRId64 "\n", mp->own.offset);
+			printf("size = %" PRId64 "\n", mp->own.size);
+			break;
+		case DSM_MSG_SET_LAZY:
+			printf("Type: DSM_MSG_SET_LAZY\n");
+			break;
+		case DSM_MSG_SET_GRANT:
+			printf("Type: DSM_MSG_SET_GRANT\n");
+			printf("policy = %" PRId32 "\n", mp->grant.policy);
+			printf("param = %" PRId32 "\n", mp->grant.param);
+			break;
+		case DSM_MSG_SET_LEASE:
+			printf("Type: DSM_MSG_SET_LEASE\n");
+			break;
+		case DSM_MSG_ADD_PEER:
+			printf("Type: DSM_MSG_ADD_PEER\n");
+			printf("addr = \"%.*s\"\n", DSM_MSG_STR_SIZE, mp->peer.addr);
+			printf("port = %" PRId32 "\n", mp->peer.port);
+			break;
+		case DSM_MSG_SET_PEER:
+			printf("Type: DSM_MSG_SET_PEER\n");
+			printf("addr = \"%.*s\"\n", DSM_MSG_STR_SIZE, mp->peer.addr);
+			printf("port = %" PRId32 "\n", mp->peer.port);
+			printf("npeers = %" PRId32 "\n", mp->peer.npeers);
+			break;
+		case DSM_MSG_REQ_WRTS:
+			printf("Type: DSM_MSG_REQ_WRTS\n");
+			printf("npids = %" PRId32 "\n", mp->reqs.npids);
+			for (int i = 0; i < mp->reqs.npids && i < DSM_MSG_MAX_PIDS; i++) {
+				printf("pids[%d] = %" PRId32 "\n", i, mp->reqs.pids[i]);
+			}
+			break;
+		case DSM_MSG_GET_PAGE:
+			printf("Type: DSM_MSG_GET_PAGE\n");
+			printf("pid = %" PRId32 "\n", mp->own.pid);
+			printf("inv_seq = %" PRId32 "\n", mp->own.inv_seq);
+			printf("offset = %" PRId64 "\n", mp->own.offset);
+			printf("size = %" PRId64 "\n", mp->own.size);
+			break;
+		case DSM_MSG_INV_PAGE:
+			printf("Type: DSM_MSG_INV_PAGE\n");
+			printf("offset = %" PRId64 "\n", mp->own.offset);
+			printf("size = %" PRId64 "\n", mp->own.size);
+			break;
+		case DSM_MSG_SET_PROTO:
+			printf("Type: DSM_MSG_SET_PROTO\n");
+			printf("pid = %" PRId32 "\n", mp->own.pid);
+			printf("proto = %" PRId32 "\n", mp->own.proto);
+			printf("offset = %" PRId64 "\n", mp->own.offset);
+			printf("size = %" PRId64 "\n", mp->own.size);
+			break;
+		case DSM_MSG_SUBSCRIBE:
+			printf("Type: DSM_MSG_SUBSCRIBE\n");
+			printf("pid = %" PRId32 "\n", mp->own.pid);
+			printf("offset = %" PRId64 "\n", mp->own.offset);
+			printf("size = %" PRId64 "\n", mp->own.size);
+			break;
+		case DSM_MSG_PAGE_DATA:
+			printf("Type: DSM_MSG_PAGE_DATA\n");
+			printf("offset = %" PRId64 "\n", mp->data.offset);
+			printf("size = %" PRId64 "\n", mp->data.size);
+			break;
 		case DSM_MSG_WRT_END:
 			printf("Type: DSM_MSG_WRT_END\n");
+			printf("seq = %" PRId32 "\n", mp->task.seq);
+			break;
+		case DSM_MSG_WRT_REVOKE:
+			printf("Type: DSM_MSG_WRT_REVOKE\n");
 			break;
 		case DSM_MSG_POST_SEM:
 			printf("Type: DSM_MSG_POST_SEM\n");
 			printf("pid = %" PRId32 "\n", mp->sem.pid);
-			printf("sem_name = \"%.*s\"\n", DSM_MSG_STR_SIZE,
-				mp->sem.sem_name);
+			printf("sem_id = %" PRId32 "\n", mp->sem.sem_id);
 			break;
 		case DSM_MSG_WAIT_SEM:
 			printf("Type: DSM_MSG_WAIT_SEM\n");
 			printf("pid = %" PRId32 "\n", mp->sem.pid);
-			printf("sem_name = \"%.*s\"\n", DSM_MSG_STR_SIZE, 
-				mp->sem.sem_name);
+			printf("sem_id = %" PRId32 "\n", mp->sem.sem_id);
+			break;
+		case DSM_MSG_OPEN_SEM:
+			printf("Type: DSM_MSG_OPEN_SEM\n");
+			printf("pid = %" PRId32 "\n", mp->name.pid);
+			printf("id = %" PRId32 "\n", mp->name.id);
+			printf("size = %" PRId64 "\n", mp->name.size);
+			break;
+		case DSM_MSG_OPEN_RWL:
+			printf("Type: DSM_MSG_OPEN_RWL\n");
+			printf("pid = %" PRId32 "\n", mp->name.pid);
+			printf("id = %" PRId32 "\n", mp->name.id);
+			printf("flags = %" PRId32 "\n", mp->name.flags);
+			printf("size = %" PRId64 "\n", mp->name.size);
+			break;
+		case DSM_MSG_RD_LOCK:
+			printf("Type: DSM_MSG_RD_LOCK\n");
+			printf("pid = %" PRId32 "\n", mp->lock.pid);
+			printf("lock_id = %" PRId32 "\n", mp->lock.lock_id);
+			break;
+		case DSM_MSG_WR_LOCK:
+			printf("Type: DSM_MSG_WR_LOCK\n");
+			printf("pid = %" PRId32 "\n", mp->lock.pid);
+			printf("lock_id = %" PRId32 "\n", mp->lock.lock_id);
+			break;
+		case DSM_MSG_RW_UNLOCK:
+			printf("Type: DSM_MSG_RW_UNLOCK\n");
+			printf("pid = %" PRId32 "\n", mp->lock.pid);
+			printf("lock_id = %" PRId32 "\n", mp->lock.lock_id);
+			break;
+		case DSM_MSG_RW_DRAIN:
+			printf("Type: DSM_MSG_RW_DRAIN\n");
+			printf("lock_id = %" PRId32 "\n", mp->lock.lock_id);
+			break;
+		case DSM_MSG_P2P_DATA:
+			printf("Type: DSM_MSG_P2P_DATA\n");
+			printf("src_gid = %" PRId32 "\n", mp->p2p.src_gid);
+			printf("dst_gid = %" PRId32 "\n", mp->p2p.dst_gid);
+			printf("size = %" PRId64 "\n", mp->p2p.size);
+			break;
+		case DSM_MSG_P2P_RECV:
+			printf("Type: DSM_MSG_P2P_RECV\n");
+			printf("src_gid = %" PRId32 "\n", mp->p2p.src_gid);
+			printf("dst_gid = %" PRId32 "\n", mp->p2p.dst_gid);
+			printf("size = %" PRId64 "\n", mp->p2p.size);
+			break;
+		case DSM_MSG_FILL_RUN:
+			printf("Type: DSM_MSG_FILL_RUN\n");
+			printf("offset = %" PRId64 "\n", mp->data.offset);
+			printf("size = %" PRId64 "\n", mp->data.size);
+			break;
+		case DSM_MSG_FILL_END:
+			printf("Type: DSM_MSG_FILL_END\n");
+			printf("pid = %" PRId32 "\n", mp->proc.pid);
 			break;
 		case DSM_MSG_EXIT:
 			printf("Type: DSM_MSG_EXIT\n");
@@ -485,6 +758,102 @@ void dsm_show_msg (dsm_msg *mp) {
 	printf("===================================\n");
 }
 
+/* Starts an empty DSM_MSG_WRT_RUNS message, built in buf. While it is built,
+ * the runs are packed at the start of buf, and the data after room for all
+ * runs: The size is that of the data alone.
+*/
+void dsm_init_runs (dsm_msg *mp, unsigned char *buf) {
+	mp->type = DSM_MSG_WRT_RUNS;
+	mp->runs.nruns = 0;
+	mp->runs.size = 0;
+	mp->runs.buf = buf;
+}
+
+// Adds as much of the run as fits. Returns the number of bytes added.
+int64_t dsm_add_run (dsm_msg *mp, int64_t offset, int64_t size,
+	const unsigned char *data) {
+	unsigned char *b = mp->runs.buf + mp->runs.nruns * DSM_MSG_RUN_SIZE;
+	int64_t last_offset, last_size, room;
+	int extend = 0;
+
+	ASSERT_COND(offset >= 0 && size >= 0);
+
+	// Extend the last run if this one continues it.
+	if (mp->runs.nruns > 0) {
+		b -= DSM_MSG_RUN_SIZE;
+		unpack_i64(b, &last_offset);
+		unpack_i64(b + sizeof(int64_t), &last_size);
+		extend = (offset == last_offset + last_size);
+	}
+
+	// Otherwise a run must be added (for which there must be room).
+	if (extend == 0 && mp->runs.nruns == DSM_MSG_MAX_RUNS) {
+		return 0;
+	}
+	room = DSM_MAX_DATA_SIZE - mp->runs.size -
+		(mp->runs.nruns + (extend == 0)) * DSM_MSG_RUN_SIZE;
+	if ((size = MIN(size, room)) <= 0) {
+		return 0;
+	}
+
+	// Pack the run.
+	if (extend != 0) {
+		pack_i64(b + sizeof(int64_t), last_size + size);
+	} else {
+		b = mp->runs.buf + mp->runs.nruns++ * DSM_MSG_RUN_SIZE;
+		b += pack_i64(b, offset);
+		pack_i64(b, size);
+	}
+
+	// Append its data.
+	memcpy(mp->runs.buf + DSM_MSG_MAX_RUNS * DSM_MSG_RUN_SIZE + mp->runs.size,
+		data, size);
+	mp->runs.size += size;
+
+	return size;
+}
+
+// Completes the message: Its data then follows right after its runs.
+void dsm_end_runs (dsm_msg *mp) {
+	int64_t runs_size = mp->runs.nruns * DSM_MSG_RUN_SIZE;
+
+	memmove(mp->runs.buf + runs_size, mp->runs.buf +
+		DSM_MSG_MAX_RUNS * DSM_MSG_RUN_SIZE, mp->runs.size);
+	mp->runs.size += runs_size;
+}
+
+// Reads the next run of the message. Returns NULL once none remain.
+const unsigned char *dsm_next_run (dsm_msg *mp, int *index_p,
+	int64_t *offset_p, int64_t *size_p) {
+	int64_t pos = (int64_t)mp->runs.nruns * DSM_MSG_RUN_SIZE, size;
+	unsigned char *b;
+	int i = *index_p;
+
+	// Verify the runs fit in the buffer.
+	ASSERT_COND(mp->runs.nruns >= 0 && mp->runs.nruns <= DSM_MSG_MAX_RUNS &&
+		pos <= mp->runs.size);
+
+	if (i >= mp->runs.nruns) {
+		return NULL;
+	}
+
+	// Its data follows that of the runs before it.
+	for (int j = 0; j < i; j++) {
+		unpack_i64(mp->runs.buf + j * DSM_MSG_RUN_SIZE + sizeof(int64_t),
+			&size);
+		pos += size;
+	}
+
+	// Read the run, and verify its data is in the buffer.
+	b = mp->runs.buf + i * DSM_MSG_RUN_SIZE;
+	b += unpack_i64(b, offset_p);
+	unpack_i64(b, size_p);
+	ASSERT_COND(*size_p >= 0 && *size_p <= mp->runs.size - pos);
+
+	*index_p = i + 1;
+	return mp->runs.buf + pos;
+}
+
 // Assigns function to given message type. Exits on error.
 void dsm_setMsgFunc (dsm_msg_t type, dsm_msg_func func, dsm_msg_func *fmap) {
 
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #include "dsm_msg.h"
 #include "dsm_util.h"
@@ -8,6 +9,83 @@
 #include "dsm_msg_io.h"
 
 
+/*
+ *******************************************************************************
+ *                             Symbolic Constants                              *
+ *******************************************************************************
+*/
+
+
+// Size (in bytes) at which a batch is sent before the next flush.
+#define DSM_MSG_BATCH_LIMIT		(64 * DSM_MSG_SIZE + DSM_MAX_DATA_SIZE)
+
+
+/*
+ *******************************************************************************
+ *                              Type Definitions                               *
+ *******************************************************************************
+*/
+
+
+// Type describing the packed messages queued for a socket.
+typedef struct dsm_batch {
+	int fd;                             // Destination.
+	size_t size;                        // Bytes queued.
+	size_t length;                      // Capacity of the buffer.
+	unsigned char *buf;                 // Packed messages.
+} dsm_batch;
+
+
+/*
+ *******************************************************************************
+ *                              Global Variables                               *
+ *******************************************************************************
+*/
+
+
+// Batches of queued messages, and their number.
+static dsm_batch *g_batches;
+static unsigned int g_nbatches;
+
+
+/*
+ *******************************************************************************
+ *                        Private Function Definitions                         *
+ *******************************************************************************
+*/
+
+
+/* Sets pointers to the size and buffer fields of messages that carry attached
+ * data. Returns nonzero if the message type carries attached data.
+*/
+static int getAttachedData (dsm_msg *mp, int64_t **size_p, 
+	unsigned char ***buf_p) {
+	switch (mp->type) {
+		case DSM_MSG_WRT_DATA:
+		case DSM_MSG_OWN_DATA:
+		case DSM_MSG_PAGE_DATA:
+			*size_p = &(mp->data.size);
+			*buf_p = &(mp->data.buf);
+			return 1;
+		case DSM_MSG_WRT_RUNS:
+			*size_p = &(mp->runs.size);
+			*buf_p = &(mp->runs.buf);
+			return 1;
+		case DSM_MSG_OPEN_SEM:
+		case DSM_MSG_OPEN_RWL:
+			*size_p = &(mp->name.size);
+			*buf_p = &(mp->name.buf);
+			return 1;
+		case DSM_MSG_P2P_DATA:
+			*size_p = &(mp->p2p.size);
+			*buf_p = &(mp->p2p.buf);
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+
 /*
  *******************************************************************************
  *                            Function Definitions                             *
@@ -19,6 +97,8 @@
 void dsm_recv_msg (int fd, dsm_msg *mp) {
 	unsigned char buf[DSM_MSG_SIZE];
 	static unsigned char data[DSM_MAX_DATA_SIZE];
+	unsigned char **buf_p;
+	int64_t *size_p;
 
 	// Receive message from socket.
 	if (dsm_recvall(fd, buf, DSM_MSG_SIZE) != 0) {
@@ -28,62 +108,195 @@ void dsm_recv_msg (int fd, dsm_msg *mp) {
 	// Unpack the message.
 	dsm_unpack_msg(mp, buf);
 
-	// If not DSM_MSG_WRT_DATA, then return.
-	if (mp->type != DSM_MSG_WRT_DATA) {
+	// If no attached data, then return.
+	if (getAttachedData(mp, &size_p, &buf_p) == 0) {
 		return;
 	}
 	
 	// Otherwise verify data payload size.
-	ASSERT_COND(mp->data.size <= DSM_MAX_DATA_SIZE);
+	ASSERT_COND(*size_p >= 0 && *size_p <= DSM_MAX_DATA_SIZE);
 	
 	// Receive remaining data from socket.
-	if (dsm_recvall(fd, data, mp->data.size) != 0) {
+	if (*size_p > 0 && dsm_recvall(fd, data, *size_p) != 0) {
 		goto err;
 	}
 
 	// Attach buffer pointer to message, and return it.
-	mp->data.buf = data;
+	*buf_p = data;
 	return;
 
 	err: dsm_panicf("(%s:%d) Lost connection to [%d]!", 
 			__FILE__, __LINE__, fd);
 }
 
+/* Packs message (with any attached data) to buffer b, which must hold
+ * DSM_MSG_SIZE + DSM_MAX_DATA_SIZE bytes. Data beyond DSM_MAX_DATA_SIZE is
+ * chunked: The message is then advanced past the packed chunk, and more_p
+ * set. Returns the number of bytes packed.
+*/
+static size_t packChunk (dsm_msg *mp, unsigned char *b, int *more_p) {
+	unsigned char **buf_p;
+	int64_t *size_p, size, send_size;
+
+	*more_p = 0;
+
+	// If no attached data, just pack the message.
+	if (getAttachedData(mp, &size_p, &buf_p) == 0) {
+		dsm_pack_msg(mp, b);
+		return DSM_MSG_SIZE;
+	}
+
+	// Only data writes (and fetched pages) may be chunked.
+	ASSERT_COND(mp->type == DSM_MSG_WRT_DATA ||
+		mp->type == DSM_MSG_OWN_DATA || mp->type == DSM_MSG_PAGE_DATA ||
+		*size_p <= DSM_MAX_DATA_SIZE);
+
+	size = *size_p;
+	send_size = MIN(DSM_MAX_DATA_SIZE, size);
+
+	// Pack the message for the chunk, followed by its data.
+	*size_p = send_size;
+	dsm_pack_msg(mp, b);
+	if (send_size > 0) {
+		memcpy(b + DSM_MSG_SIZE, *buf_p, send_size);
+	}
+
+	// If more remains, advance past the chunk.
+	if (size > send_size) {
+		*more_p = 1;
+		*size_p = size - send_size;
+		*buf_p += send_size;
+		mp->data.offset += send_size;
+	}
+
+	return DSM_MSG_SIZE + (size_t)send_size;
+}
+
+// Returns the batch of fd. If none and create is set, adds one (else NULL).
+static dsm_batch *getBatch (int fd, int create) {
+
+	for (unsigned int i = 0; i < g_nbatches; i++) {
+		if (g_batches[i].fd == fd) {
+			return g_batches + i;
+		}
+	}
+
+	if (create == 0) {
+		return NULL;
+	}
+
+	if ((g_batches = realloc(g_batches, (g_nbatches + 1) * sizeof(dsm_batch)))
+		== NULL) {
+		dsm_panic("getBatch: Allocation failed!");
+	}
+
+	g_batches[g_nbatches] = (dsm_batch){.fd = fd};
+	return g_batches + g_nbatches++;
+}
+
+// Sends the messages queued in the batch (at once), and empties it.
+static void flushBatch (dsm_batch *bp) {
+	if (bp->size > 0) {
+		dsm_sendall(bp->fd, bp->buf, bp->size);
+	}
+	bp->size = 0;
+}
+
 // See header file for description.
 void dsm_send_msg (int fd, dsm_msg *mp) {
-	unsigned char buf[DSM_MSG_SIZE];
-	size_t next_size, send_size;
-	unsigned int isData;
+	unsigned char buf[DSM_MSG_SIZE + DSM_MAX_DATA_SIZE];
+	dsm_msg msg;
+	dsm_batch *bp;
+	int more;
 
 	// Verify input.
 	ASSERT_COND(mp != NULL);
+	msg = *mp;
 
-	// If message type is DSM_MSG_WRT_DATA, adjust details.
-	if ((isData = (mp->type == DSM_MSG_WRT_DATA)) == 1) {
-		send_size = MIN(DSM_MAX_DATA_SIZE, mp->data.size);
-		next_size = mp->data.size - send_size;
-		mp->data.size = send_size;
+	// Messages queued for fd go first.
+	if ((bp = getBatch(fd, 0)) != NULL) {
+		flushBatch(bp);
 	}
 
-	// Pack the message to buffer.
-	dsm_pack_msg(mp, buf);
+	// Send each chunk (with its data) at once.
+	do {
+		dsm_sendall(fd, buf, packChunk(&msg, buf, &more));
+	} while (more);
+}
 
-	// Dispatch message.
-	dsm_sendall(fd, buf, DSM_MSG_SIZE);
+// See header file for description.
+void dsm_queue_msg (int fd, dsm_msg *mp) {
+	dsm_batch *bp;
+	dsm_msg msg;
+	int more;
 
-	// If type is not DSM_MSG_WRT_DATA. Return.
-	if (isData == 0) {
-		return;
-	}
+	// Verify input.
+	ASSERT_COND(mp != NULL);
+	msg = *mp;
 
-	// Send the data.
-	dsm_sendall(fd, mp->data.buf, mp->data.size);
+	bp = getBatch(fd, 1);
+	do {
 
-	// If more remains, continue sending.
-	if (next_size > 0) {
-		mp->data.size = next_size;
-		mp->data.offset += send_size;
-		mp->data.buf = (void *)((intptr_t)mp->data.buf + (intptr_t)send_size);
+		// Make room for the largest chunk.
+		if (bp->size + DSM_MSG_SIZE + DSM_MAX_DATA_SIZE > bp->length) {
+			bp->length = MAX(2 * bp->length,
+				bp->size + DSM_MSG_SIZE + DSM_MAX_DATA_SIZE);
+			if ((bp->buf = realloc(bp->buf, bp->length)) == NULL) {
+				dsm_panic("dsm_queue_msg: Allocation failed!");
+			}
+		}
+
+		bp->size += packChunk(&msg, bp->buf + bp->size, &more);
+
+		// Don't let a batch grow without bound.
+		if (bp->size >= DSM_MSG_BATCH_LIMIT) {
+			flushBatch(bp);
+		}
+	} while (more);
+}
+
+// See header file for description.
+void dsm_send_run (int fd, dsm_msg *mp, int64_t offset, int64_t size,
+	const unsigned char *data) {
+	int64_t n;
+
+	while (size > 0) {
+
+		// Send the message once full, and start over.
+		if ((n = dsm_add_run(mp, offset, size, data)) == 0) {
+			dsm_send_runs(fd, mp);
+			continue;
+		}
+
+		offset += n;
+		size -= n;
+		data += n;
+	}
+}
+
+// See header file for description.
+void dsm_send_runs (int fd, dsm_msg *mp) {
+	if (mp->runs.nruns > 0) {
+		dsm_end_runs(mp);
 		dsm_send_msg(fd, mp);
 	}
+	dsm_init_runs(mp, mp->runs.buf);
+}
+
+// See header file for description.
+void dsm_flush_msgs (void) {
+	for (unsigned int i = 0; i < g_nbatches; i++) {
+		flushBatch(g_batches + i);
+	}
+}
+
+// See header file for description.
+void dsm_free_msgs (void) {
+	dsm_flush_msgs();
+	for (unsigned int i = 0; i < g_nbatches; i++) {
+		free(g_batches[i].buf);
+	}
+	free(g_batches);
+	g_batches = NULL;
+	g_nbatches = 0;
 }
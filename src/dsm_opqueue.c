@@ -7,6 +7,117 @@
 #include "dsm_util.h"
 
 
+/*
+ *******************************************************************************
+ *                              Global Variables                               *
+ *******************************************************************************
+*/
+
+
+// Names of the grant policies (for the statistics).
+static const char *g_policy_names[DSM_OPQUEUE_NPOLICIES] = {
+	"FIFO", "Locality", "GID priority", "Fair share"
+};
+
+
+/*
+ *******************************************************************************
+ *                        Private Function Definitions                         *
+ *******************************************************************************
+*/
+
+
+// Packs an entry as returned by the queue.
+static uint64_t packEntry (dsm_opentry *e) {
+	return ((uint64_t)e->fd | ((uint64_t)e->pid << 32));
+}
+
+// Returns the number of grants to the arbiter at fd (growing the table).
+static unsigned int *getServed (dsm_opqueue *oq, uint32_t fd) {
+	size_t new_length;
+
+	if (fd >= oq->nserved) {
+		new_length = MAX(2 * oq->nserved, (size_t)fd + 1);
+		if ((oq->served = realloc(oq->served, new_length *
+			sizeof(unsigned int))) == NULL) {
+			dsm_cpanic("getServed", "Allocation error");
+		}
+		memset(oq->served + oq->nserved, 0,
+			(new_length - oq->nserved) * sizeof(unsigned int));
+		oq->nserved = new_length;
+	}
+
+	return oq->served + fd;
+}
+
+// Returns the index of the request the policy grants next (never the head).
+static size_t selectNext (dsm_opqueue *oq) {
+	size_t next = 1;
+	double now;
+
+	switch (oq->policy) {
+
+		// Oldest of the last granted arbiter, unless its run is over.
+		case DSM_OPQUEUE_LOCAL:
+			if (oq->run >= oq->param) {
+				break;
+			}
+			for (size_t i = 1; i < oq->count; i++) {
+				if (oq->queue[i].fd == oq->last_fd) {
+					return i;
+				}
+			}
+			break;
+
+		// Lowest GID (oldest first among equals).
+		case DSM_OPQUEUE_GID:
+			for (size_t i = 2; i < oq->count; i++) {
+				if (oq->queue[i].gid < oq->queue[next].gid) {
+					next = i;
+				}
+			}
+			break;
+
+		// Past the deadline, otherwise of the arbiter granted least.
+		case DSM_OPQUEUE_FAIR:
+			now = dsm_getWallTime();
+			if ((now - oq->queue[1].time) * 1000.0 >= oq->param) {
+				break;
+			}
+			for (size_t i = 2; i < oq->count; i++) {
+				if (*getServed(oq, oq->queue[i].fd) <
+					*getServed(oq, oq->queue[next].fd)) {
+					next = i;
+				}
+			}
+			break;
+
+		default:
+			break;
+	}
+
+	return next;
+}
+
+// Records the grant of the head: Its wait, and whose turn it is.
+static void grantHead (dsm_opqueue *oq) {
+	dsm_opentry *e = oq->queue;
+	double wait = dsm_getWallTime() - e->time;
+
+	oq->stats.ngrants++;
+	oq->stats.wait_sum += wait;
+	oq->stats.wait_max = MAX(oq->stats.wait_max, wait);
+
+	if (oq->stats.ngrants > 1 && e->fd != oq->last_fd) {
+		oq->stats.nswitches++;
+	}
+
+	oq->run = (e->fd == oq->last_fd) ? oq->run + 1 : 1;
+	oq->last_fd = e->fd;
+	*getServed(oq, e->fd) += 1;
+}
+
+
 /*
  *******************************************************************************
  *                            Function Definitions                             *
@@ -14,7 +125,7 @@
 */
 
 
-// Allocates and initializes an operation-queue.
+// Allocates and initializes an operation-queue (FIFO policy).
 dsm_opqueue *dsm_initOpQueue (size_t length) {
 	dsm_opqueue *oq;
 
@@ -24,14 +135,21 @@ dsm_opqueue *dsm_initOpQueue (size_t length) {
 	}
 
 	// Set queue itself.
-	if ((oq->queue = malloc(length * sizeof(uint64_t))) == NULL) {
+	if ((oq->queue = malloc(length * sizeof(dsm_opentry))) == NULL) {
 		dsm_cpanic("dsm_initOpQueue failed!", "Allocation error");
 	}
 
 	// Set remaining fields.
 	oq->step = STEP_READY;
 	oq->length = length;
-	oq->head = oq->tail = 0;
+	oq->count = 0;
+	oq->policy = DSM_OPQUEUE_FIFO;
+	oq->param = 0;
+	oq->last_fd = 0;
+	oq->run = 0;
+	oq->served = NULL;
+	oq->nserved = 0;
+	memset(&oq->stats, 0, sizeof(dsm_opstats));
 
 	return oq;
 }
@@ -42,76 +160,108 @@ void dsm_freeOpQueue (dsm_opqueue *oq) {
 		return;
 	}
 	free(oq->queue);
+	free(oq->served);
 	free(oq);
 }
 
+// Sets the grant policy, and its parameter (0 for the default).
+void dsm_setOpQueuePolicy (dsm_opqueue *oq, int policy, unsigned int param) {
+	ASSERT_COND(policy >= 0 && policy < DSM_OPQUEUE_NPOLICIES);
+
+	// Fill in the default parameter.
+	if (param == 0) {
+		param = (policy == DSM_OPQUEUE_FAIR) ? DSM_OPQUEUE_DEF_DEADLINE :
+			DSM_OPQUEUE_DEF_BATCH;
+	}
+
+	oq->policy = policy;
+	oq->param = param;
+}
+
 // Returns true (1) if the given operation-queue is empty.
 int dsm_isOpQueueEmpty (dsm_opqueue *oq) {
-	return (oq->head == oq->tail);
+	return (oq->count == 0);
 }
 
-// Returns tail of operation-queue. Exits fatally on error.
+// Returns the number of operations in the operation-queue.
+size_t dsm_getOpQueueLength (dsm_opqueue *oq) {
+	return oq->count;
+}
+
+// Returns head of operation-queue. Exits fatally on error.
 uint64_t dsm_getOpQueueHead (dsm_opqueue *oq) {
 	if (dsm_isOpQueueEmpty(oq) == 1) {
-		dsm_cpanic("dsm_getOpQueueHead", "Can't get tail of empty queue!");
+		dsm_cpanic("dsm_getOpQueueHead", "Can't get head of empty queue!");
 	}
-	return oq->queue[oq->tail];
+	return packEntry(oq->queue);
 }
 
-// Enqueues {machine + process} in operation-queue for write.
-void dsm_enqueueOpQueue (uint32_t fd, uint32_t pid, dsm_opqueue *oq) {
-	size_t new_length;
-	unsigned int i, j;
-	uint64_t *new_queue;
-
-	// Resize queue if full.
-	if ((oq->head + 1) % oq->length == oq->tail) {
+// Returns true (1) if another arbiter than that of the head has a request.
+int dsm_isOpQueueShared (dsm_opqueue *oq) {
+	for (size_t i = 1; i < oq->count; i++) {
+		if (oq->queue[i].fd != oq->queue[0].fd) {
+			return 1;
+		}
+	}
+	return 0;
+}
 
-		// Double queue size.
-		new_length = 2 * oq->length;
+// Enqueues {machine + process} in operation-queue for write.
+void dsm_enqueueOpQueue (uint32_t fd, uint32_t pid, int32_t gid,
+	dsm_opqueue *oq) {
 
-		// Allocate the new queue.
-		if ((new_queue = malloc(new_length * sizeof(uint64_t))) == NULL) {
+	// Double queue size if full.
+	if (oq->count == oq->length) {
+		oq->length *= 2;
+		if ((oq->queue = realloc(oq->queue, oq->length * sizeof(dsm_opentry)))
+			== NULL) {
 			dsm_cpanic("dsm_enqueueOpQueue", "Couldn't resize queue");
 		}
-
-		// Copy over the data.
-		for (i = oq->tail, j = 0; i != oq->head; 
-			i = (i + 1) % oq->length, j++) {
-			new_queue[j] = oq->queue[i];
-		}
-
-		// Free the old queue and replace it.
-		free(oq->queue);
-		oq->queue = new_queue;
-
-		// Set the size, new head and tail.
-		oq->length = new_length;
-		oq->head = j;
-		oq->tail = 0;
 	}
 
-	// Compute new item.
-	uint64_t long_fd = fd;
-	uint64_t long_pid = pid;
-
 	// Enroll item.
-	oq->queue[oq->head] = (long_fd | (long_pid << 32));
-	oq->head = (oq->head + 1) % oq->length;
+	oq->queue[oq->count++] = (dsm_opentry) {
+		.fd = fd,
+		.pid = pid,
+		.gid = gid,
+		.time = dsm_getWallTime()
+	};
+
+	// If it's the only one, it's granted.
+	if (oq->count == 1) {
+		grantHead(oq);
+	}
 }
 
-// Dequeues file-descriptor from operation queue. Panics on error.
+// Dequeues head of operation queue. The policy chooses the next head.
 uint64_t dsm_dequeueOpQueue (dsm_opqueue *oq) {
-	int64_t val;
+	dsm_opentry next;
+	uint64_t val;
+	size_t i;
 
 	// Error out if queue is empty.
-	if (oq->tail == oq->head) {
+	if (oq->count == 0) {
 		dsm_cpanic("dsm_dequeueOpQueue", "Can't dequeue from empty!");
 	}
 
-	// Extract value, move tail up, then return value.
-	val = oq->queue[oq->tail];
-	oq->tail = (oq->tail + 1) % oq->length;
+	// Extract value.
+	val = packEntry(oq->queue);
+
+	// If others remain: Move the chosen one up front, the rest keep order.
+	if (oq->count > 1 && (i = selectNext(oq)) > 1) {
+		next = oq->queue[i];
+		memmove(oq->queue + 2, oq->queue + 1, (i - 1) * sizeof(dsm_opentry));
+		oq->queue[1] = next;
+	}
+
+	// Drop the head.
+	memmove(oq->queue, oq->queue + 1, (oq->count - 1) * sizeof(dsm_opentry));
+	oq->count--;
+
+	if (oq->count > 0) {
+		grantHead(oq);
+	}
+
 	return val;
 }
 
@@ -119,12 +269,24 @@ uint64_t dsm_dequeueOpQueue (dsm_opqueue *oq) {
 void dsm_showOpQueue (dsm_opqueue *oq) {
 	printf("Operation Step = %d\n", oq->step);
 	printf("Operation Queue = [");
-	for (unsigned i = oq->tail; i != oq->head; i = (i + 1) % oq->length) {
-		uint64_t v = oq->queue[i];
-		printf("{%" PRIu32 ": %" PRIu32 "}", DSM_MASK_FD(v), DSM_MASK_PID(v));
-		if (i < (oq->head - 1)) {
+	for (size_t i = 0; i < oq->count; i++) {
+		printf("{%" PRIu32 ": %" PRIu32 "}", oq->queue[i].fd, oq->queue[i].pid);
+		if (i < (oq->count - 1)) {
 			putchar(',');
 		}
 	}
 	printf("]\n");
 }
+
+// Prints the grant policy, and how long requests waited under it.
+void dsm_showOpQueueStats (dsm_opqueue *oq) {
+	dsm_opstats *s = &oq->stats;
+	double mean = (s->ngrants == 0) ? 0.0 : s->wait_sum / s->ngrants;
+
+	printf("Write grants (%s", g_policy_names[oq->policy]);
+	if (oq->policy == DSM_OPQUEUE_LOCAL || oq->policy == DSM_OPQUEUE_FAIR) {
+		printf(", %u", oq->param);
+	}
+	printf("): %lu, switches: %lu, wait: %.3f ms mean, %.3f ms max\n",
+		s->ngrants, s->nswitches, mean * 1000.0, s->wait_max * 1000.0);
+}
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dsm_otab.h"
+#include "dsm_util.h"
+
+
+/*
+ *******************************************************************************
+ *                        Internal Function Definitions                        *
+ *******************************************************************************
+*/
+
+
+// Returns the ownership of the given page. Grows the table if needed.
+static dsm_owner *getOwner (dsm_otab *otab, size_t page) {
+	size_t length = otab->length;
+
+	// Double capacity until the page fits. New pages have no owner.
+	if (page >= length) {
+		while (page >= length) {
+			length = MAX(DSM_OTAB_MIN_PAGES, 2 * length);
+		}
+
+		if ((otab->pages = realloc(otab->pages, length * sizeof(dsm_owner)))
+			== NULL) {
+			dsm_panic("getOwner: Allocation failed!");
+		}
+
+		for (size_t i = otab->length; i < length; i++) {
+			otab->pages[i] = (dsm_owner) {
+				.fd = -1, .revoking = 0, .head = NULL, .tail = NULL
+			};
+		}
+
+		otab->length = length;
+	}
+
+	return otab->pages + page;
+}
+
+
+/*
+ *******************************************************************************
+ *                            Function Definitions                             *
+ *******************************************************************************
+*/
+
+
+// Initializes the ownership table. Returns pointer. Exits fatally on error.
+dsm_otab *dsm_initOwnerTable (void) {
+	dsm_otab *otab;
+
+	if ((otab = calloc(1, sizeof(dsm_otab))) == NULL) {
+		dsm_panic("dsm_initOwnerTable: Allocation failed!");
+	}
+
+	return otab;
+}
+
+/* Requests a page for the arbiter at fd. Returns nonzero if it now owns it.
+ * Otherwise the request is queued, and *revoke_p is set to the owner to ask
+ * to drop the page (-1 if it was already asked).
+*/
+int dsm_acquirePage (dsm_otab *otab, size_t page, int fd, int *revoke_p) {
+	dsm_owner *owner = getOwner(otab, page);
+	dsm_owner_req *req;
+
+	// Grant if unowned (nobody waits on an unowned page).
+	if (owner->fd == -1 || owner->fd == fd) {
+		owner->fd = fd;
+		return 1;
+	}
+
+	// Otherwise queue the request.
+	if ((req = malloc(sizeof(dsm_owner_req))) == NULL) {
+		dsm_panic("dsm_acquirePage: Allocation failed!");
+	}
+
+	*req = (dsm_owner_req) {.fd = fd, .next = NULL};
+
+	if (owner->tail == NULL) {
+		owner->head = req;
+	} else {
+		owner->tail->next = req;
+	}
+
+	owner->tail = req;
+
+	// Ask the owner to drop it, unless already asked.
+	*revoke_p = (owner->revoking == 0) ? owner->fd : -1;
+	owner->revoking = 1;
+
+	return 0;
+}
+
+/* Releases a page owned by the arbiter at fd. Returns the next owner (-1 if
+ * none). Sets *revoke_p to the next owner if others still wait on the page
+ * (so it must be asked to drop it in turn), or to -1 otherwise.
+*/
+int dsm_releasePage (dsm_otab *otab, size_t page, int fd, int *revoke_p) {
+	dsm_owner *owner = getOwner(otab, page);
+	dsm_owner_req *req;
+
+	// Verify the owner.
+	if (owner->fd != fd) {
+		dsm_cpanic("dsm_releasePage", "Page is not owned by releaser!");
+	}
+
+	*revoke_p = -1;
+	owner->fd = -1;
+	owner->revoking = 0;
+
+	// Pass to the first waiting arbiter.
+	if ((req = owner->head) == NULL) {
+		return -1;
+	}
+
+	if ((owner->head = req->next) == NULL) {
+		owner->tail = NULL;
+	}
+
+	owner->fd = req->fd;
+	free(req);
+
+	// If more are waiting, the new owner must drop it again once done.
+	if (owner->head != NULL) {
+		*revoke_p = owner->fd;
+		owner->revoking = 1;
+	}
+
+	return owner->fd;
+}
+
+// Frees the ownership table.
+void dsm_freeOwnerTable (dsm_otab *otab) {
+	dsm_owner_req *req;
+
+	// Free any queued requests.
+	for (size_t i = 0; i < otab->length; i++) {
+		while ((req = otab->pages[i].head) != NULL) {
+			otab->pages[i].head = req->next;
+			free(req);
+		}
+	}
+
+	free(otab->pages);
+	free(otab);
+}
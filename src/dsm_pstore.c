@@ -0,0 +1,470 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dsm_pstore.h"
+#include "dsm_util.h"
+
+
+/*
+ *******************************************************************************
+ *                        Internal Function Definitions                        *
+ *******************************************************************************
+*/
+
+
+// Returns the holder at fd. Grows the holder array if needed.
+static dsm_holder *getHolder (dsm_pstore *pstore, int fd) {
+	size_t length = pstore->nholders;
+
+	ASSERT_COND(fd >= 0);
+
+	// Double capacity until fd fits. New holders hold all pages.
+	if ((size_t)fd >= length) {
+		while ((size_t)fd >= length) {
+			length = MAX(DSM_PSTORE_MIN_LENGTH, 2 * length);
+		}
+
+		if ((pstore->holders = realloc(pstore->holders,
+			length * sizeof(dsm_holder))) == NULL) {
+			dsm_panic("getHolder: Allocation failed!");
+		}
+
+		memset(pstore->holders + pstore->nholders, 0,
+			(length - pstore->nholders) * sizeof(dsm_holder));
+		pstore->nholders = length;
+	}
+
+	return pstore->holders + fd;
+}
+
+// Returns the given page. Grows the page array if needed.
+static dsm_pentry *getEntry (dsm_pstore *pstore, size_t page) {
+	size_t length = pstore->npages;
+
+	// Double capacity until the page fits. New pages are in auto mode.
+	if (page >= length) {
+		while (page >= length) {
+			length = MAX(DSM_PSTORE_MIN_LENGTH, 2 * length);
+		}
+
+		if ((pstore->pages = realloc(pstore->pages,
+			length * sizeof(dsm_pentry))) == NULL) {
+			dsm_panic("getEntry: Allocation failed!");
+		}
+
+		memset(pstore->pages + pstore->npages, 0,
+			(length - pstore->npages) * sizeof(dsm_pentry));
+		pstore->npages = length;
+	}
+
+	return pstore->pages + page;
+}
+
+// Returns the copy of the given page. Allocates it (zeroed) if needed.
+static unsigned char *getData (dsm_pstore *pstore, dsm_pentry *entry) {
+
+	// Allocate the copy on its first write.
+	if (entry->data == NULL &&
+		(entry->data = calloc(1, pstore->pagesize)) == NULL) {
+		dsm_panic("getData: Allocation failed!");
+	}
+
+	return entry->data;
+}
+
+// Returns nonzero if the holder holds the given page.
+static int isHeld (dsm_holder *holder, size_t page) {
+	return page / 64 < holder->nwords &&
+		((holder->held[page / 64] >> (page % 64)) & 1);
+}
+
+// Returns nonzero if the holder subscribed to the given page.
+static int isSubscribed (dsm_holder *holder, size_t page) {
+	return page / 64 < holder->nwords &&
+		((holder->subscribed[page / 64] >> (page % 64)) & 1);
+}
+
+// Grows the bitmaps of the holder until the given page fits.
+static void growHolder (dsm_holder *holder, size_t page) {
+	size_t nwords = holder->nwords;
+
+	if (page / 64 < nwords) {
+		return;
+	}
+
+	while (page / 64 >= nwords) {
+		nwords = MAX(DSM_PSTORE_MIN_LENGTH, 2 * nwords);
+	}
+
+	if ((holder->held = realloc(holder->held, nwords * sizeof(uint64_t)))
+		== NULL || (holder->subscribed = realloc(holder->subscribed,
+		nwords * sizeof(uint64_t))) == NULL) {
+		dsm_panic("growHolder: Allocation failed!");
+	}
+
+	memset(holder->held + holder->nwords, 0,
+		(nwords - holder->nwords) * sizeof(uint64_t));
+	memset(holder->subscribed + holder->nwords, 0,
+		(nwords - holder->nwords) * sizeof(uint64_t));
+	holder->nwords = nwords;
+}
+
+// Returns pointer to the link of the invalidated copy of fd (or its end).
+static dsm_stale **getStale (dsm_pentry *entry, int fd) {
+	dsm_stale **sp = &entry->stale;
+
+	while (*sp != NULL && (*sp)->fd != fd) {
+		sp = &(*sp)->next;
+	}
+
+	return sp;
+}
+
+// Removes the invalidated copy at the given link. Returns its dirty words.
+static size_t remStale (dsm_pstore *pstore, dsm_stale **sp) {
+	dsm_stale *stale = *sp;
+	size_t nwords = pstore->pagesize / DSM_PSTORE_WORD, ndirty = 0;
+
+	for (size_t w = 0; w < nwords; w++) {
+		ndirty += (stale->dirty[w / 64] >> (w % 64)) & 1;
+	}
+
+	*sp = stale->next;
+	free(stale->dirty);
+	free(stale);
+
+	return ndirty;
+}
+
+// Marks the words touched by a write of size bytes at start as dirty.
+static void markDirty (dsm_stale *stale, size_t start, size_t size) {
+	size_t first = start / DSM_PSTORE_WORD;
+	size_t last = (start + size - 1) / DSM_PSTORE_WORD;
+
+	for (size_t w = first; w <= last; w++) {
+		stale->dirty[w / 64] |= (uint64_t)1 << (w % 64);
+	}
+}
+
+/* Invalidates the copies of the given page held by lazy arbiters other than
+ * the writer at fd, unless subscribed. Returns the number of copies
+ * invalidated.
+*/
+static unsigned int invalidateCopies (dsm_pstore *pstore, int fd,
+	size_t page, dsm_inv_func inv) {
+	size_t nwords = pstore->pagesize / DSM_PSTORE_WORD;
+	dsm_pentry *entry = pstore->pages + page;
+	dsm_holder *holder;
+	dsm_stale *stale;
+	unsigned int count = 0;
+
+	for (size_t i = 0; i < pstore->nholders; i++) {
+		holder = pstore->holders + i;
+
+		if ((int)i == fd || holder->is_lazy == 0 || !isHeld(holder, page) ||
+			isSubscribed(holder, page)) {
+			continue;
+		}
+
+		// Drop the page from the holder, and track writes from now on.
+		holder->held[page / 64] &= ~((uint64_t)1 << (page % 64));
+
+		if ((stale = malloc(sizeof(dsm_stale))) == NULL ||
+			(stale->dirty = calloc((nwords + 63) / 64, sizeof(uint64_t)))
+			== NULL) {
+			dsm_panic("invalidateCopies: Allocation failed!");
+		}
+
+		stale->fd = (int)i;
+		stale->next = entry->stale;
+		entry->stale = stale;
+
+		inv((int)i, page);
+		count++;
+	}
+
+	return count;
+}
+
+/* Returns the number of lazy arbiters other than fd holding the given page,
+ * that invalidation would drop it from (they didn't subscribe).
+*/
+static unsigned int getSharers (dsm_pstore *pstore, int fd, size_t page) {
+	dsm_holder *holder;
+	unsigned int count = 0;
+
+	for (size_t i = 0; i < pstore->nholders; i++) {
+		holder = pstore->holders + i;
+		if ((int)i != fd && holder->is_lazy == 1 && isHeld(holder, page) &&
+			!isSubscribed(holder, page)) {
+			count++;
+		}
+	}
+
+	return count;
+}
+
+/* Chooses the protocol of a page in auto mode, after a write of size bytes by
+ * the arbiter at fd. Pages written while others hold them try invalidation
+ * after a number of such writes. They return to updates if invalidation cost
+ * more than it saved over a window of writes, and back off further probes.
+*/
+static void updateProtocol (dsm_pstore *pstore, int fd, size_t page) {
+	dsm_pentry *entry = pstore->pages + page;
+
+	if (entry->mode != DSM_PSTORE_AUTO) {
+		return;
+	}
+
+	if (entry->is_invalidate == 0) {
+		if (getSharers(pstore, fd, page) > 0 && ++entry->nwrites >=
+			((unsigned int)DSM_PSTORE_PROBE_WRITES << entry->backoff)) {
+			entry->is_invalidate = 1;
+			entry->nwrites = 0;
+			entry->balance = 0;
+		}
+		return;
+	}
+
+	if (++entry->nwrites >= DSM_PSTORE_WINDOW_WRITES) {
+		if (entry->balance < 0) {
+			entry->is_invalidate = 0;
+			entry->backoff = MIN(entry->backoff + 1, DSM_PSTORE_MAX_BACKOFF);
+		} else {
+			entry->backoff = 0;
+		}
+		entry->nwrites = 0;
+		entry->balance = 0;
+	}
+}
+
+
+/*
+ *******************************************************************************
+ *                            Function Definitions                             *
+ *******************************************************************************
+*/
+
+
+// Initializes the page store. Returns pointer. Exits fatally on error.
+dsm_pstore *dsm_initPageStore (size_t pagesize) {
+	dsm_pstore *pstore;
+
+	ASSERT_COND(pagesize > 0 && pagesize % DSM_PSTORE_WORD == 0);
+
+	if ((pstore = calloc(1, sizeof(dsm_pstore))) == NULL) {
+		dsm_panic("dsm_initPageStore: Allocation failed!");
+	}
+
+	pstore->pagesize = pagesize;
+
+	return pstore;
+}
+
+/* Copies data written by the arbiter at fd into the page store (if any lazy
+ * arbiter registered). Calls inv for each copy held by another lazy arbiter
+ * that the write invalidates, and updates the protocol of the written pages.
+*/
+void dsm_writePageStore (dsm_pstore *pstore, int fd, int64_t offset,
+	const unsigned char *buf, size_t size, dsm_inv_func inv) {
+	size_t page, start, n;
+	unsigned int nstale;
+	dsm_pentry *entry;
+
+	// Nobody fetches pages: Nothing to keep.
+	if (pstore->nlazy == 0) {
+		return;
+	}
+
+	ASSERT_COND(offset >= 0);
+
+	// Copy page by page.
+	for (size_t done = 0; done < size; done += n) {
+		page = ((size_t)offset + done) / pstore->pagesize;
+		start = ((size_t)offset + done) % pstore->pagesize;
+		n = MIN(size - done, pstore->pagesize - start);
+		entry = getEntry(pstore, page);
+		memcpy(getData(pstore, entry) + start, buf + done, n);
+
+		// Invalidate other copies if the page is in invalidate mode.
+		if (entry->mode == DSM_PSTORE_INVALIDATE ||
+			(entry->mode == DSM_PSTORE_AUTO && entry->is_invalidate == 1)) {
+			entry->balance -= (int64_t)(DSM_PSTORE_MSG_COST *
+				invalidateCopies(pstore, fd, page, inv));
+		}
+
+		// Invalidated copies don't receive the write: Mark it for their fetch.
+		nstale = 0;
+		for (dsm_stale *s = entry->stale; s != NULL; s = s->next, nstale++) {
+			markDirty(s, start, n);
+		}
+		entry->balance += (int64_t)(nstale * (n + DSM_PSTORE_MSG_COST));
+
+		updateProtocol(pstore, fd, page);
+	}
+}
+
+// Copies the given page to buf (zeroes if it was never written).
+void dsm_readPageStore (dsm_pstore *pstore, size_t page, unsigned char *buf) {
+	if (page >= pstore->npages || pstore->pages[page].data == NULL) {
+		memset(buf, 0, pstore->pagesize);
+	} else {
+		memcpy(buf, pstore->pages[page].data, pstore->pagesize);
+	}
+}
+
+/* Sets start_p and size_p to the next run of the page that the arbiter at fd
+ * must fetch, after position *pos_p (initially zero). That is the whole page,
+ * unless its copy was invalidated: Then only the runs written since. Returns
+ * zero once there are no runs left.
+*/
+int dsm_nextPageRun (dsm_pstore *pstore, int fd, size_t page, size_t *pos_p,
+	size_t *start_p, size_t *size_p) {
+	size_t nwords = pstore->pagesize / DSM_PSTORE_WORD, first, last;
+	dsm_stale *stale = NULL;
+
+	if (page < pstore->npages) {
+		stale = *getStale(pstore->pages + page, fd);
+	}
+
+	// Without an invalidated copy: The whole page.
+	if (stale == NULL) {
+		if (*pos_p > 0) {
+			return 0;
+		}
+		*start_p = 0;
+		*size_p = *pos_p = pstore->pagesize;
+		return 1;
+	}
+
+	// Otherwise: The next run of dirty words.
+	for (first = *pos_p / DSM_PSTORE_WORD; first < nwords &&
+		((stale->dirty[first / 64] >> (first % 64)) & 1) == 0; first++);
+
+	for (last = first; last < nwords &&
+		((stale->dirty[last / 64] >> (last % 64)) & 1) == 1; last++);
+
+	*pos_p = last * DSM_PSTORE_WORD;
+	*start_p = first * DSM_PSTORE_WORD;
+	*size_p = (last - first) * DSM_PSTORE_WORD;
+
+	return (first < nwords);
+}
+
+// Sets the protocol of the given page (see DSM_PSTORE_AUTO).
+void dsm_setPageMode (dsm_pstore *pstore, size_t page, int mode) {
+	ASSERT_COND(mode >= DSM_PSTORE_AUTO && mode <= DSM_PSTORE_INVALIDATE);
+	getEntry(pstore, page)->mode = mode;
+}
+
+// Registers the arbiter at fd as lazy: It holds no pages until it fetches.
+void dsm_setLazyHolder (dsm_pstore *pstore, int fd) {
+	dsm_holder *holder = getHolder(pstore, fd);
+
+	if (holder->is_lazy == 0) {
+		holder->is_lazy = 1;
+		pstore->nlazy++;
+	}
+}
+
+// Records that the (lazy) arbiter at fd fetched, and now holds the given page.
+void dsm_setHeldPage (dsm_pstore *pstore, int fd, size_t page) {
+	dsm_holder *holder = getHolder(pstore, fd);
+	dsm_pentry *entry = getEntry(pstore, page);
+	size_t ndirty;
+	dsm_stale **sp;
+
+	ASSERT_COND(holder->is_lazy == 1);
+
+	// Charge the fetch of an invalidated copy to invalidation.
+	if (*(sp = getStale(entry, fd)) != NULL) {
+		ndirty = remStale(pstore, sp);
+		entry->balance -= (int64_t)(ndirty * DSM_PSTORE_WORD +
+			2 * DSM_PSTORE_MSG_COST);
+	}
+
+	growHolder(holder, page);
+	holder->held[page / 64] |= (uint64_t)1 << (page % 64);
+}
+
+/* Subscribes the (lazy) arbiter at fd to the given page: Writes to it are
+ * forwarded once the page is held, and never invalidate it.
+*/
+void dsm_setSubscribedPage (dsm_pstore *pstore, int fd, size_t page) {
+	dsm_holder *holder = getHolder(pstore, fd);
+
+	// Arbiters that don't fetch hold (and are sent) all pages anyway.
+	if (holder->is_lazy == 0) {
+		return;
+	}
+
+	growHolder(holder, page);
+	holder->subscribed[page / 64] |= (uint64_t)1 << (page % 64);
+}
+
+// Returns nonzero if the arbiter at fd holds any page of the given range.
+int dsm_holdsPageRange (dsm_pstore *pstore, int fd, int64_t offset,
+	size_t size) {
+	dsm_holder *holder = getHolder(pstore, fd);
+	size_t first, last;
+
+	// Arbiters that don't fetch hold all pages.
+	if (holder->is_lazy == 0) {
+		return 1;
+	}
+
+	ASSERT_COND(offset >= 0);
+	first = (size_t)offset / pstore->pagesize;
+	last = ((size_t)offset + MAX(size, 1) - 1) / pstore->pagesize;
+
+	for (size_t page = first; page <= last && page / 64 < holder->nwords;
+		page++) {
+		if (isHeld(holder, page)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Removes the arbiter at fd (it holds all pages again, if it reconnects).
+void dsm_remHolder (dsm_pstore *pstore, int fd) {
+	dsm_holder *holder = getHolder(pstore, fd);
+	dsm_stale **sp;
+
+	if (holder->is_lazy == 1) {
+		pstore->nlazy--;
+	}
+
+	// Forget its invalidated copies.
+	for (size_t i = 0; i < pstore->npages; i++) {
+		if (*(sp = getStale(pstore->pages + i, fd)) != NULL) {
+			remStale(pstore, sp);
+		}
+	}
+
+	free(holder->held);
+	free(holder->subscribed);
+	*holder = (dsm_holder){0};
+}
+
+// Frees the page store.
+void dsm_freePageStore (dsm_pstore *pstore) {
+
+	for (size_t i = 0; i < pstore->npages; i++) {
+		while (pstore->pages[i].stale != NULL) {
+			remStale(pstore, &pstore->pages[i].stale);
+		}
+		free(pstore->pages[i].data);
+	}
+
+	for (size_t i = 0; i < pstore->nholders; i++) {
+		free(pstore->holders[i].held);
+		free(pstore->holders[i].subscribed);
+	}
+
+	free(pstore->pages);
+	free(pstore->holders);
+	free(pstore);
+}
@@ -166,8 +166,10 @@ dsm_proc *dsm_setProcessTableEntry (dsm_ptab *ptab, int fd, int pid) {
         .proc = (dsm_proc) {
             .gid = ptab->next_gid++,
             .pid = pid,
+            .fd = fd,
             .sem_id = -1,
-            .flags = {0}
+            .flags = {0},
+            .sem_next = NULL
         }
     };
 
@@ -311,6 +313,34 @@ dsm_proc *dsm_getProcessTableEntryWithSemID (dsm_ptab *ptab, int sem_id,
     return NULL;
 }
 
+// Returns pointer to process with global ID. Returns NULL if none exists.
+dsm_proc *dsm_getProcessTableEntryWithGID (dsm_ptab *ptab, int gid, 
+    int *fd_p) {
+
+    // For all file-descriptors: Search the linked-lists.
+    for (unsigned int fd = 0; fd < ptab->length; fd++) {
+
+        // Search the linked-list for the given file-descriptor.
+        for (dsm_proc_node *n = ptab->tab[fd]; n != NULL; n = n->next) {
+
+            // Ignore entries with mismatching gids.
+            if (n->proc.gid != gid) {
+                continue;
+            }
+            
+            // Set the file-descriptor pointer indexing this linked-list.
+            if (fd_p != NULL) {
+                *fd_p = fd;
+            }
+
+            // Return pointer to process structure.
+            return &(n->proc);
+        }
+    }
+
+    return NULL;
+}
+
 // [DEBUG] Prints the process table.
 void dsm_showProcessTable (dsm_ptab *ptab) {
     printf("nproc = %u\n", ptab->nproc);
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dsm_rwlock.h"
+#include "dsm_htab.h"
+#include "dsm_util.h"
+
+
+/*
+ *******************************************************************************
+ *                        Internal Function Definitions                        *
+ *******************************************************************************
+*/
+
+
+// [HTAB]: Hashing routine for the lock hash table.
+static unsigned int func_hash (void *key) {
+	const char *name = (const char *)key;
+	return DJBHash(name, strlen(name));
+}
+
+// [HTAB]: Freeing routine for the lock hash table data.
+static void func_free (void *data) {
+	dsm_rwlock_t *lock = (dsm_rwlock_t *)data;
+	dsm_rwlock_req *req;
+
+	// Free any queued requests.
+	while ((req = lock->head) != NULL) {
+		lock->head = req->next;
+		free(req);
+	}
+
+	free(lock);
+}
+
+// [HTAB]: Debugging/printing routines for the lock hash table data.
+static void func_show (void *data) {
+	dsm_rwlock_t *lock = (dsm_rwlock_t *)data;
+	printf("ID: %s, Readers: %u, Writer: %d", lock->name, lock->nreaders,
+		lock->writer_pid);
+}
+
+// [HTAB]: Key to data comparison routine for the lock hash table.
+static int func_comp (void *key, void *data) {
+	dsm_rwlock_t *lock = (dsm_rwlock_t *)data;
+	return (strcmp((char *)key, lock->name) == 0);
+}
+
+
+/*
+ *******************************************************************************
+ *                            Function Definitions                             *
+ *******************************************************************************
+*/
+
+
+// Initializes lock hash table. Returns pointer. Exits fatally on error.
+dsm_rwlock_htab *dsm_initRWLockHashTable (void) {
+	return dsm_initHashTable(DSM_RWLOCK_HTAB_LENGTH, func_hash, func_free,
+		func_show, func_comp);
+}
+
+// Registers new lock in table. Returns pointer. Exits fatally on error.
+dsm_rwlock_t *dsm_setRWLockHashTableEntry (dsm_rwlock_htab *htab,
+	const char *name, int prefer_writer) {
+	size_t size = strlen(name) + 1;
+	dsm_rwlock_t *lock;
+
+	// Allocate lock (with name).
+	if ((lock = malloc(sizeof(dsm_rwlock_t) + size)) == NULL) {
+		dsm_panic("dsm_setRWLockHashTableEntry: Allocation failed!");
+	}
+
+	// Configure.
+	lock->handle = -1;
+	lock->prefer_writer = prefer_writer;
+	lock->nreaders = lock->nwriters = 0;
+	lock->writer_fd = -1;
+	lock->writer_pid = -1;
+	lock->head = lock->tail = NULL;
+	memcpy(lock->name, name, size);
+
+	return dsm_setHashTableEntry(htab, lock->name, lock);
+}
+
+/* Requests the lock. Returns nonzero if granted immediately. Otherwise the
+ * request is queued, and is later returned by dsm_nextRWLockGrant.
+*/
+int dsm_acquireRWLock (dsm_rwlock_t *lock, int fd, int pid, int is_writer) {
+	dsm_rwlock_req *req;
+
+	// Readers share the lock unless written, or a writer is preferred.
+	if (!is_writer && lock->writer_fd == -1 &&
+		(lock->prefer_writer == 0 || lock->nwriters == 0)) {
+		lock->nreaders++;
+		return 1;
+	}
+
+	// Writers require the lock to be free, and nobody ahead of them.
+	if (is_writer && lock->writer_fd == -1 && lock->nreaders == 0 &&
+		lock->head == NULL) {
+		lock->writer_fd = fd;
+		lock->writer_pid = pid;
+		return 1;
+	}
+
+	// Otherwise queue the request.
+	if ((req = malloc(sizeof(dsm_rwlock_req))) == NULL) {
+		dsm_panic("dsm_acquireRWLock: Allocation failed!");
+	}
+
+	*req = (dsm_rwlock_req) {
+		.fd = fd, .pid = pid, .is_writer = is_writer, .next = NULL
+	};
+
+	if (lock->tail == NULL) {
+		lock->head = req;
+	} else {
+		lock->tail->next = req;
+	}
+
+	lock->tail = req;
+	lock->nwriters += (is_writer != 0);
+
+	return 0;
+}
+
+// Releases a grant. It is a write grant if fd and pid match the writer.
+void dsm_releaseRWLock (dsm_rwlock_t *lock, int fd, int pid) {
+
+	// Release write grant.
+	if (lock->writer_fd == fd && lock->writer_pid == pid) {
+		lock->writer_fd = lock->writer_pid = -1;
+		return;
+	}
+
+	// Otherwise release read grant.
+	if (lock->nreaders == 0) {
+		dsm_cpanic("dsm_releaseRWLock", "Lock is not held!");
+	}
+
+	lock->nreaders--;
+}
+
+/* Dequeues the next grantable request into the given pointers. Returns
+ * nonzero if one was granted. Call until zero after each release.
+*/
+int dsm_nextRWLockGrant (dsm_rwlock_t *lock, int *fd_p, int *pid_p,
+	int *is_writer_p) {
+	dsm_rwlock_req *req = lock->head;
+
+	// Nothing is grantable while written, or if nobody is queued.
+	if (req == NULL || lock->writer_fd != -1) {
+		return 0;
+	}
+
+	// Writers must also wait for all readers.
+	if (req->is_writer && lock->nreaders > 0) {
+		return 0;
+	}
+
+	// Grant it.
+	if (req->is_writer) {
+		lock->writer_fd = req->fd;
+		lock->writer_pid = req->pid;
+		lock->nwriters--;
+	} else {
+		lock->nreaders++;
+	}
+
+	// Return request details.
+	*fd_p = req->fd;
+	*pid_p = req->pid;
+	*is_writer_p = req->is_writer;
+
+	// Unlink and free.
+	if ((lock->head = req->next) == NULL) {
+		lock->tail = NULL;
+	}
+	free(req);
+
+	return 1;
+}
+
+/* Returns nonzero if read grants must be returned once their readers leave,
+ * rather than be shared with new ones: A preferred writer is queued.
+*/
+int dsm_mustDrainRWLock (dsm_rwlock_t *lock) {
+	return (lock->prefer_writer && lock->nwriters > 0);
+}
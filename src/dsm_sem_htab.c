@@ -79,7 +79,45 @@ dsm_sem_t *dsm_setSemHashTableEntry (dsm_sem_htab *htab, char *sem_name) {
 
     // Configure.
     sem->sem_id = dsm_setStringTableEntry(g_str_tab, sem_name);
+    sem->handle = -1;
     sem->value = 1;
+    sem->head = sem->tail = NULL;
 
     return dsm_setHashTableEntry(htab, sem_name, sem);
 }
+
+// Appends process to the semaphore wait queue. Exits fatally on error.
+void dsm_enqueueSemWaiter (dsm_sem_t *sem, dsm_proc *proc) {
+
+    // Verify input.
+    if (sem == NULL || proc == NULL || proc->sem_next != NULL) {
+        dsm_cpanic("dsm_enqueueSemWaiter", "Invalid arguments!");
+    }
+
+    // Link after tail, or as head if empty.
+    if (sem->tail == NULL) {
+        sem->head = proc;
+    } else {
+        sem->tail->sem_next = proc;
+    }
+
+    sem->tail = proc;
+}
+
+// Removes and returns the longest waiting process. Returns NULL if none.
+dsm_proc *dsm_dequeueSemWaiter (dsm_sem_t *sem) {
+    dsm_proc *proc;
+
+    // Return NULL if no process is waiting.
+    if ((proc = sem->head) == NULL) {
+        return NULL;
+    }
+
+    // Unlink head. Reset tail if queue is now empty.
+    if ((sem->head = proc->sem_next) == NULL) {
+        sem->tail = NULL;
+    }
+
+    proc->sem_next = NULL;
+    return proc;
+}
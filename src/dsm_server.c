@@ -17,6 +17,9 @@
 #include "dsm_ptab.h"
 #include "dsm_stab.h"
 #include "dsm_sem_htab.h"
+#include "dsm_rwlock.h"
+#include "dsm_otab.h"
+#include "dsm_pstore.h"
 #include "dsm_daemon.h"
 #include "dsm_msg_io.h"
 
@@ -37,6 +40,26 @@
 // Minimum number of queuable operation requests.
 #define DSM_MIN_OPQUEUE_SIZE	32
 
+// Minimum number of semaphore handles.
+#define DSM_MIN_SEM_HANDLES		32
+
+// Minimum number of reader-writer lock handles.
+#define DSM_MIN_RWL_HANDLES		32
+
+
+/*
+ *******************************************************************************
+ *                              Type Definitions                               *
+ *******************************************************************************
+*/
+
+
+// Arbiter that sends write data straight to its peers.
+typedef struct dsm_peer {
+    int fd;                         // Connection of the arbiter.
+    dsm_payload_peer info;          // Where its peers reach it.
+} dsm_peer;
+
 
 /*
  *******************************************************************************
@@ -63,15 +86,64 @@ dsm_msg_func g_fmap[DSM_MSG_MAX_VAL];
 // Operation queue (current write state, who wants to write next, etc).
 dsm_opqueue *g_opqueue;
 
+// Boolean flag indicating if the current writer was asked to end its lease.
+int g_revoked;
+
+// Arbiters sent data (or invalidations) of the current write, by descriptor.
+unsigned char *g_targets;
+
+// Capacity of g_targets.
+size_t g_ntargets;
+
+// Arbiters keeping the write token as a lease, by descriptor (and capacity).
+unsigned char *g_leases;
+size_t g_nleases;
+
+// Number of arbiters yet to acknowledge the current write (may go negative,
+// if peers acknowledge before the writer ends it).
+int g_nacks;
+
+// Sequence number of the current write grant.
+uint32_t g_seq;
+
+// Arbiters sending write data to their peers (in registration order), count,
+// and capacity. Either all arbiters do, or none.
+dsm_peer *g_peers;
+unsigned int g_npeers, g_peers_size;
+
+// Page ownership table (writes to owned pages bypass the operation queue).
+dsm_otab *g_otab;
+
+// Page store (copies of written pages, fetched by lazy arbiters).
+dsm_pstore *g_pstore;
+
+// Buffer for a fetched page.
+unsigned char *g_page_buf;
+
 // Process table.
 dsm_ptab *g_proc_tab;
 
 // String table.
 dsm_stab *g_str_tab;
 
-// Semaphore table.
+// Semaphore table (by name).
 dsm_sem_htab *g_sem_htab;
 
+// Semaphores indexed by handle.
+dsm_sem_t **g_sems;
+
+// Number of semaphore handles issued, and capacity of g_sems.
+unsigned int g_nsems, g_sems_size;
+
+// Reader-writer lock table (by name).
+dsm_rwlock_htab *g_rwl_htab;
+
+// Reader-writer locks indexed by handle.
+dsm_rwlock_t **g_rwls;
+
+// Number of lock handles issued, and capacity of g_rwls.
+unsigned int g_nrwls, g_rwls_size;
+
 // The listener socket.
 int g_sock_listen = -1;
 
@@ -97,6 +169,137 @@ static void send_all_msg (dsm_msg *mp, int except) {
     }
 }
 
+// Sets the flag of an arbiter in a table by descriptor. Grows the table.
+static void setFlag (unsigned char **flags_p, size_t *nflags_p, int fd) {
+    size_t length = *nflags_p;
+
+    // Double capacity until fd fits.
+    if ((size_t)fd >= length) {
+        while ((size_t)fd >= length) {
+            length = MAX(DSM_MIN_POLLABLE, 2 * length);
+        }
+        if ((*flags_p = realloc(*flags_p, length)) == NULL) {
+            dsm_panic("setFlag: Allocation failed!");
+        }
+        memset(*flags_p + *nflags_p, 0, length - *nflags_p);
+        *nflags_p = length;
+    }
+
+    (*flags_p)[fd] = 1;
+}
+
+// Marks an arbiter as sent part of the current write. It must acknowledge it.
+static void setTarget (int fd) {
+    setFlag(&g_targets, &g_ntargets, fd);
+}
+
+// Returns nonzero if the arbiter keeps the write token as a lease.
+static int isLeaseHolder (uint32_t fd) {
+    return fd < g_nleases && g_leases[fd] != 0;
+}
+
+// Tells a lazy arbiter to drop the given page (see dsm_writePageStore).
+static void send_inv_msg (int fd, size_t page) {
+    dsm_msg msg = {.type = DSM_MSG_INV_PAGE};
+    setTarget(fd);
+    msg.own.offset = (int64_t)(page * DSM_PAGESIZE);
+    msg.own.size = DSM_PAGESIZE;
+    dsm_send_msg(fd, &msg);
+}
+
+/* Keeps a copy of written data, and forwards it to all file-descriptors but
+ * except. Lazy arbiters only receive writes to pages they fetched, and drop
+ * pages in invalidate mode that others write. Only arbiters sent either are
+ * targets of the write.
+*/
+static void send_data_msg (dsm_msg *mp, int except) {
+    int fd;
+
+    // Update the page store (if any arbiter is lazy).
+    dsm_writePageStore(g_pstore, except, mp->data.offset, mp->data.buf,
+        (size_t)mp->data.size, send_inv_msg);
+
+    // Send to all holders. Skip listener socket at index zero.
+    for (int i = 1; i < (int)g_pollSet->fp; i++) {
+        fd = g_pollSet->fds[i].fd;
+
+        if (fd == except || dsm_holdsPageRange(g_pstore, fd, mp->data.offset,
+            (size_t)mp->data.size) == 0) {
+            continue;
+        }
+
+        dsm_send_msg(fd, mp);
+        setTarget(fd);
+    }
+}
+
+// Returns nonzero if the arbiter at fd holds any page written by the runs.
+static int holdsAnyRun (int fd, dsm_msg *mp) {
+    int64_t offset, size;
+    int i = 0;
+
+    while (dsm_next_run(mp, &i, &offset, &size) != NULL) {
+        if (dsm_holdsPageRange(g_pstore, fd, offset, (size_t)size) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Like send_data_msg, but for the runs of a DSM_MSG_WRT_RUNS message. Arbiters
+ * holding any of the pages written receive the message whole.
+*/
+static void send_runs_msg (dsm_msg *mp, int except) {
+    const unsigned char *data;
+    int64_t offset, size;
+    int fd, i = 0;
+
+    // Update the page store (if any arbiter is lazy).
+    while ((data = dsm_next_run(mp, &i, &offset, &size)) != NULL) {
+        dsm_writePageStore(g_pstore, except, offset, data, (size_t)size,
+            send_inv_msg);
+    }
+
+    // Send to all holders. Skip listener socket at index zero.
+    for (i = 1; i < (int)g_pollSet->fp; i++) {
+        fd = g_pollSet->fds[i].fd;
+
+        if (fd == except || holdsAnyRun(fd, mp) == 0) {
+            continue;
+        }
+
+        dsm_send_msg(fd, mp);
+        setTarget(fd);
+    }
+}
+
+/* Forwards the end of the current write to its targets but except, and clears
+ * them. Returns the number of targets.
+*/
+static unsigned int send_end_msg (dsm_msg *mp, int except) {
+    unsigned int count = 0;
+    int fd;
+
+    // Send to targets. Skip listener socket at index zero.
+    for (int i = 1; i < (int)g_pollSet->fp; i++) {
+        fd = g_pollSet->fds[i].fd;
+
+        if (fd == except || (size_t)fd >= g_ntargets || g_targets[fd] == 0) {
+            continue;
+        }
+
+        dsm_send_msg(fd, mp);
+        count++;
+    }
+
+    // Clear the targets for the next write.
+    if (g_ntargets > 0) {
+        memset(g_targets, 0, g_ntargets);
+    }
+
+    return count;
+}
+
 // Sends basic message without payload. If fd == -1. Message is sent to all.
 static void send_easy_msg (int fd, dsm_msg_t type) {
     dsm_msg msg = {.type = type};
@@ -111,6 +314,20 @@ static void send_easy_msg (int fd, dsm_msg_t type) {
     send_all_msg(&msg, -1);
 }
 
+/* A writer holding a lease keeps the token until told to end it. Tells the
+ * head of the queue so, once per grant, if another arbiter is queued. Its own
+ * processes are granted under the lease (or once it ends).
+*/
+static void revokeIfQueued (void) {
+    uint32_t fd = DSM_MASK_FD(dsm_getOpQueueHead(g_opqueue));
+
+    if (g_revoked == 0 && isLeaseHolder(fd) &&
+        dsm_isOpQueueShared(g_opqueue) != 0) {
+        g_revoked = 1;
+        send_easy_msg(fd, DSM_MSG_WRT_REVOKE);
+    }
+}
+
 // Informs the head of the queue it can write. Used twice so made it a function!
 static void send_queue_wrt_now_msg (void) {
     dsm_msg msg = {.type = DSM_MSG_WRT_NOW};
@@ -124,46 +341,204 @@ static void send_queue_wrt_now_msg (void) {
     fd = DSM_MASK_FD(v);
     pid = DSM_MASK_PID(v);
     msg.proc.pid = pid;
+    msg.proc.seq = (int32_t)++g_seq;
 
     // Dispatch message.
     dsm_send_msg(fd, &msg);
+
+    // New grant: End its lease at once if others are already queued.
+    g_revoked = 0;
+    revokeIfQueued();
+}
+
+/* Has each arbiter sending write data to its peers connect to those that
+ * registered before it. Each list ends with an empty entry holding the number
+ * of peers, so arbiters know when all have connected.
+*/
+static void send_peer_msgs (void) {
+    dsm_msg msg = {.type = DSM_MSG_SET_PEER};
+
+    if (g_npeers == 0) {
+        return;
+    }
+
+    // Either all arbiters send write data to their peers, or none.
+    ASSERT_COND(g_npeers == g_pollSet->fp - 1);
+
+    for (unsigned int i = 0; i < g_npeers; i++) {
+        for (unsigned int j = 0; j < i; j++) {
+            msg.peer = g_peers[j].info;
+            msg.peer.npeers = (int32_t)g_npeers - 1;
+            dsm_send_msg(g_peers[i].fd, &msg);
+        }
+
+        memset(&msg.peer, 0, sizeof(msg.peer));
+        msg.peer.npeers = (int32_t)g_npeers - 1;
+        dsm_send_msg(g_peers[i].fd, &msg);
+    }
+}
+
+/* Completes the current write once it ended, and all its targets acknowledged
+ * it. Informs the next writer, if any.
+*/
+static void completeWrite (void) {
+    int fd;
+
+    if (g_opqueue->step != STEP_WAITING_SYNC_ACK || g_nacks > 0) {
+        return;
+    }
+
+    // Read from the writer again (see handler_wrt_end).
+    fd = DSM_MASK_FD(dsm_getOpQueueHead(g_opqueue));
+    if (g_npeers > 0) {
+        dsm_setPollable(fd, POLLIN, g_pollSet);
+    }
+
+    // Dequeue completed write-operation.
+    dsm_dequeueOpQueue(g_opqueue);
+
+    // If new operation pending, jump to step 2 and inform writer.
+    if (!dsm_isOpQueueEmpty(g_opqueue)) {
+        g_opqueue->step = STEP_WAITING_WRT_DATA;
+        send_queue_wrt_now_msg();
+        return;
+    }
+
+    // Reset step.
+    g_opqueue->step = STEP_READY;
+}
+
+/* Queues the write-requests of the given processes of the arbiter at fd, in
+ * order. They are granted back to back, unless others were queued before.
+*/
+static void queueWriteRequests (int fd, const int32_t *pids, int npids) {
+    int isEmptyQueue = 0;
+    dsm_proc *proc_p;
+
+    // Verify PIDs and FD are valid.
+    ASSERT_COND(fd >= 0 && npids > 0);
+
+    // Copy queue state.
+    isEmptyQueue = dsm_isOpQueueEmpty(g_opqueue);
+
+    // Queue requests (with the GID, for the grant policy).
+    for (int i = 0; i < npids; i++) {
+        ASSERT_COND(pids[i] >= 0 && (proc_p = dsm_getProcessTableEntry(
+            g_proc_tab, fd, pids[i])) != NULL);
+        dsm_enqueueOpQueue((uint32_t)fd, (uint32_t)pids[i], proc_p->gid,
+            g_opqueue);
+    }
+
+    // Start new operation sequence if none other in progress.
+    if (isEmptyQueue == 1) {
+
+        // Verify step.
+        ASSERT_COND(g_opqueue->step == STEP_READY);
+
+		// Inform head of queue it may write.
+		send_queue_wrt_now_msg();
+
+        // Set the next step.
+        g_opqueue->step = STEP_WAITING_WRT_DATA;
+        return;
+    }
+
+    // Otherwise have the writer end any lease, unless already ending.
+    if (g_opqueue->step == STEP_WAITING_WRT_DATA) {
+        revokeIfQueued();
+    }
 }
 
 
 /*
  *******************************************************************************
- *                          Message Handler Functions                          *
+ *                         Semaphore Handle Functions                          *
  *******************************************************************************
 */
 
 
-// DSM_MSG_GOT_DATA: Arbiter has updated all local processes.
-static void handler_got_data (int fd, dsm_msg *mp) {
-    int ready = mp->task.nproc;
-    UNUSED(fd);
+// Registers semaphore under the next handle. Returns the handle.
+static int setSemaphore (dsm_sem_t *sem) {
 
-    // Verify state.
-    ASSERT_STATE(g_started == 1 && g_opqueue->step == STEP_WAITING_SYNC_ACK);
+    // Double capacity if full.
+    if (g_nsems >= g_sems_size) {
+        g_sems_size = MAX(DSM_MIN_SEM_HANDLES, 2 * g_sems_size);
+        if ((g_sems = realloc(g_sems, g_sems_size * sizeof(dsm_sem_t *))) 
+            == NULL) {
+            dsm_panic("setSemaphore: Allocation failed!");
+        }
+    }
 
-    // If all processes ready. Check queue for new operation.
-    if ((g_proc_tab->nready += ready) >= g_nproc) {
+    g_sems[g_nsems] = sem;
+    return g_nsems++;
+}
 
-        // Dequeue completed write-operation.
-        dsm_dequeueOpQueue(g_opqueue);
+// Returns semaphore for the given handle. Exits fatally if invalid.
+static dsm_sem_t *getSemaphore (int sem_id) {
+    ASSERT_COND(sem_id >= 0 && (unsigned int)sem_id < g_nsems);
+    return g_sems[sem_id];
+}
 
-        // Reset ready counter.
-        g_proc_tab->nready = 0;
+// Registers lock under the next handle. Returns the handle.
+static int setRWLock (dsm_rwlock_t *lock) {
 
-        // If new operation pending, jump to step 2 and inform writer.
-        if (!dsm_isOpQueueEmpty(g_opqueue)) {
-            g_opqueue->step = STEP_WAITING_WRT_DATA;
-            send_queue_wrt_now_msg();
-            return;
+    // Double capacity if full.
+    if (g_nrwls >= g_rwls_size) {
+        g_rwls_size = MAX(DSM_MIN_RWL_HANDLES, 2 * g_rwls_size);
+        if ((g_rwls = realloc(g_rwls, g_rwls_size * sizeof(dsm_rwlock_t *)))
+            == NULL) {
+            dsm_panic("setRWLock: Allocation failed!");
         }
-
-		// Reset step.
-        g_opqueue->step = STEP_READY;
     }
+
+    g_rwls[g_nrwls] = lock;
+    return g_nrwls++;
+}
+
+// Returns lock for the given handle. Exits fatally if invalid.
+static dsm_rwlock_t *getRWLock (int lock_id) {
+    ASSERT_COND(lock_id >= 0 && (unsigned int)lock_id < g_nrwls);
+    return g_rwls[lock_id];
+}
+
+// Sends a page ownership message for the page at the given offset.
+static void send_own_msg (dsm_msg_t type, int fd, int64_t offset,
+    int64_t size) {
+    dsm_msg msg = {.type = type};
+    msg.own.offset = offset;
+    msg.own.size = size;
+    dsm_send_msg(fd, &msg);
+}
+
+// Sends lock grant to the requester.
+static void send_lock_msg (dsm_msg_t type, int fd, int pid, int lock_id) {
+    dsm_msg msg = {.type = type};
+    msg.lock.lock_id = lock_id;
+    msg.lock.pid = pid;
+    dsm_send_msg(fd, &msg);
+}
+
+
+/*
+ *******************************************************************************
+ *                          Message Handler Functions                          *
+ *******************************************************************************
+*/
+
+
+/* DSM_MSG_GOT_DATA: Arbiter has updated all local processes. With peer data,
+ * this may arrive before the writer ends the write.
+*/
+static void handler_got_data (int fd, dsm_msg *mp) {
+    UNUSED(fd);
+
+    // Verify state, and that it is for the current write.
+    ASSERT_STATE(g_started == 1 && g_opqueue->step != STEP_READY);
+    ASSERT_COND((uint32_t)mp->task.seq == g_seq);
+
+    // Complete the write if it was the last acknowledgement.
+    g_nacks--;
+    completeWrite();
 }
 
 // DSM_MSG_ADD_PID: Process is checking in.
@@ -189,7 +564,8 @@ static void handler_add_pid (int fd, dsm_msg *mp) {
         // Set global started flag.
         g_started = 1;
 
-        // Instruct all processes to begin.
+        // Connect arbiters to their peers, and instruct all processes to begin.
+        send_peer_msgs();
         send_easy_msg(-1, DSM_MSG_CNT_ALL);
 
         // Reset the barrier.
@@ -199,45 +575,36 @@ static void handler_add_pid (int fd, dsm_msg *mp) {
 
 // DSM_MSG_REQ_WRT: Process wishes to write.
 static void handler_req_wrt (int fd, dsm_msg *mp) {
-    int isEmptyQueue = 0;
-    int pid = mp->proc.pid;
 
     // Verify state.
     ASSERT_STATE(g_started == 1);
 
-    // Verify PID and FD are valid.
-    ASSERT_COND(fd >= 0 && pid >= 0);
-
-    // Copy queue state.
-    isEmptyQueue = dsm_isOpQueueEmpty(g_opqueue);
-
-    // Queue request.
-    dsm_enqueueOpQueue((uint32_t)fd, (uint32_t)pid, g_opqueue);
-
-    // Start new operation sequence if none other in progress.
-    if (isEmptyQueue == 1) {
+    queueWriteRequests(fd, &(mp->proc.pid), 1);
+}
 
-        // Verify step.
-        ASSERT_COND(g_opqueue->step == STEP_READY);
+// DSM_MSG_REQ_WRTS: Processes of an arbiter wish to write.
+static void handler_req_wrts (int fd, dsm_msg *mp) {
 
-		// Inform head of queue it may write.
-		send_queue_wrt_now_msg();
+    // Verify state + count.
+    ASSERT_STATE(g_started == 1);
+    ASSERT_COND(mp->reqs.npids <= DSM_MSG_MAX_PIDS);
 
-        // Set the next step.
-        g_opqueue->step = STEP_WAITING_WRT_DATA;
-    }
+    queueWriteRequests(fd, mp->reqs.pids, mp->reqs.npids);
 }
 
-// DSM_MSG_HIT_BAR: Process is blocked on a barrier.
+// DSM_MSG_HIT_BAR: All processes of an arbiter are blocked on a barrier.
 static void handler_hit_bar (int fd, dsm_msg *mp) {
+    int nproc = mp->proc.nproc;
     UNUSED(fd);
-    UNUSED(mp);
 
     // Verify state.
     ASSERT_STATE(g_started == 1);
 
+    // Verify count.
+    ASSERT_COND(nproc > 0);
+
     // If all processes have reached barrier: Release and reset.
-    if ((g_proc_tab->nblocked += 1) >= g_nproc) {
+    if ((g_proc_tab->nblocked += nproc) >= g_nproc) {
 
         // Inform blocked processes.
         send_easy_msg(-1, DSM_MSG_REL_BAR);
@@ -258,40 +625,235 @@ static void handler_wrt_data (int fd, dsm_msg *mp) {
     ASSERT_COND(dsm_isOpQueueEmpty(g_opqueue) == 0 && fd > 0 &&
         DSM_MASK_FD(dsm_getOpQueueHead(g_opqueue)) == (uint32_t)fd);
 
-    // Otherwise: Forward data to all arbiters except the sender.
-    send_all_msg(mp, fd);
+    // Otherwise: Forward data to all arbiters (holding it) except the sender.
+    send_data_msg(mp, fd);
 
 }
 
+// DSM_MSG_WRT_RUNS: Process write information (of several runs).
+static void handler_wrt_runs (int fd, dsm_msg *mp) {
+
+    // Verify state.
+    ASSERT_STATE(g_started == 1 && g_opqueue->step == STEP_WAITING_WRT_DATA);
+
+    // Verify sender is writer.
+    ASSERT_COND(dsm_isOpQueueEmpty(g_opqueue) == 0 && fd > 0 &&
+        DSM_MASK_FD(dsm_getOpQueueHead(g_opqueue)) == (uint32_t)fd);
+
+    // Forward data to all arbiters (holding any of it) except the sender.
+    send_runs_msg(mp, fd);
+}
+
 // DSM_MSG_WRT_END: Acknowledge end of data transmission.
 static void handler_wrt_end (int fd, dsm_msg *mp) {
-	UNUSED(fd);
 
-	// Treat the end of transmission signal like the data message.
-	handler_wrt_data(fd, mp);
+    // Verify state.
+    ASSERT_STATE(g_started == 1 && g_opqueue->step == STEP_WAITING_WRT_DATA);
+
+    // Verify sender is writer.
+    ASSERT_COND(dsm_isOpQueueEmpty(g_opqueue) == 0 && fd > 0 &&
+        DSM_MASK_FD(dsm_getOpQueueHead(g_opqueue)) == (uint32_t)fd);
+
+	// With peer data, the writer sent both the data and its end to all peers,
+	// which acknowledge it. Messages from the writer wait until they have: Any
+	// that the write happened before (barriers, posts) can't overtake it.
+	if (g_npeers > 0) {
+		g_nacks += (int)g_npeers - 1;
+		dsm_setPollable(fd, 0, g_pollSet);
 
-	// Set the state to waiting for acknowledgement. 
+	} else {
+
+		// Otherwise forward to the targets of the write (all acknowledge).
+		// Others hold none of its pages. The writer acknowledges too.
+		g_nacks += 1 + (int)send_end_msg(mp, fd);
+	}
+
+	// Set the state to waiting for acknowledgement.
 	g_opqueue->step = STEP_WAITING_SYNC_ACK;
+	completeWrite();
+}
+
+// DSM_MSG_REQ_OWN: Arbiter wants to own a page.
+static void handler_req_own (int fd, dsm_msg *mp) {
+    int revoke_fd;
+
+    // Verify state and page.
+    ASSERT_STATE(g_started == 1);
+    ASSERT_COND(mp->own.offset >= 0 && mp->own.size > 0);
+
+    // Grant now, or have the owner drop it once its writes are sent.
+    if (dsm_acquirePage(g_otab, mp->own.offset / mp->own.size, fd,
+        &revoke_fd)) {
+        send_own_msg(DSM_MSG_OWN_NOW, fd, mp->own.offset, mp->own.size);
+    } else if (revoke_fd != -1) {
+        send_own_msg(DSM_MSG_OWN_REVOKE, revoke_fd, mp->own.offset,
+            mp->own.size);
+    }
+}
+
+/* DSM_MSG_OWN_DROP: Arbiter dropped a page. Its writes to the page arrived
+ * (and were forwarded) before this, so the next owner sees them first.
+*/
+static void handler_own_drop (int fd, dsm_msg *mp) {
+    int next_fd, revoke_fd;
+
+    // Verify state and page.
+    ASSERT_STATE(g_started == 1);
+    ASSERT_COND(mp->own.offset >= 0 && mp->own.size > 0);
+
+    // Pass the page on, and have the new owner drop it if others wait.
+    if ((next_fd = dsm_releasePage(g_otab, mp->own.offset / mp->own.size, fd,
+        &revoke_fd)) == -1) {
+        return;
+    }
+
+    send_own_msg(DSM_MSG_OWN_NOW, next_fd, mp->own.offset, mp->own.size);
+
+    if (revoke_fd != -1) {
+        send_own_msg(DSM_MSG_OWN_REVOKE, revoke_fd, mp->own.offset,
+            mp->own.size);
+    }
+}
+
+// DSM_MSG_OWN_DATA: Arbiter wrote to page(s) it owns. No grant is needed.
+static void handler_own_data (int fd, dsm_msg *mp) {
+
+    // Verify state.
+    ASSERT_STATE(g_started == 1);
+
+    // Forward data to all arbiters (holding it) except the sender.
+    send_data_msg(mp, fd);
+}
+
+// DSM_MSG_ADD_PEER: Arbiter sends write data straight to its peers.
+static void handler_add_peer (int fd, dsm_msg *mp) {
+
+    // Verify state (peers connect before the session starts).
+    ASSERT_STATE(g_started == 0);
+
+    // Double capacity if full.
+    if (g_npeers >= g_peers_size) {
+        g_peers_size = MAX(DSM_MIN_POLLABLE, 2 * g_peers_size);
+        if ((g_peers = realloc(g_peers, g_peers_size * sizeof(dsm_peer)))
+            == NULL) {
+            dsm_panic("handler_add_peer: Allocation failed!");
+        }
+    }
+
+    g_peers[g_npeers++] = (dsm_peer){.fd = fd, .info = mp->peer};
+}
+
+// DSM_MSG_SET_LAZY: Arbiter fetches pages on first access.
+static void handler_set_lazy (int fd, dsm_msg *mp) {
+    UNUSED(mp);
+
+    // Verify state (writes before this wouldn't be stored).
+    ASSERT_STATE(g_started == 0);
+
+    // Forward it only writes to pages it fetched from now on.
+    dsm_setLazyHolder(g_pstore, fd);
+}
+
+// DSM_MSG_SET_LEASE: Arbiter keeps the write token as a lease.
+static void handler_set_lease (int fd, dsm_msg *mp) {
+    UNUSED(mp);
+
+    // Verify state.
+    ASSERT_STATE(g_started == 0);
+
+    // Tell it to end its leases when other arbiters want to write.
+    setFlag(&g_leases, &g_nleases, fd);
+}
+
+// DSM_MSG_SET_GRANT: Arbiter sets the write-grant policy of the session.
+static void handler_set_grant (int fd, dsm_msg *mp) {
+    UNUSED(fd);
+
+    // Verify state (all requests are granted under one policy).
+    ASSERT_STATE(g_started == 0);
+
+    // Verify policy.
+    ASSERT_COND(mp->grant.policy >= 0 &&
+        mp->grant.policy < DSM_OPQUEUE_NPOLICIES && mp->grant.param >= 0);
+
+    dsm_setOpQueuePolicy(g_opqueue, mp->grant.policy,
+        (unsigned int)mp->grant.param);
+}
+
+/* DSM_MSG_GET_PAGE: Arbiter fetches a page. Later writes to it are forwarded
+ * after the page, so the arbiter misses none of them.
+*/
+static void handler_get_page (int fd, dsm_msg *mp) {
+    dsm_msg msg = {.type = DSM_MSG_PAGE_DATA};
+    size_t page, pos = 0, start, size;
+
+    // Verify state and page.
+    ASSERT_STATE(g_started == 1);
+    ASSERT_COND(mp->own.offset >= 0 && mp->own.size == DSM_PAGESIZE);
+
+    // Send the page (in chunks). If the arbiter's copy was invalidated, only
+    // the runs written since: The rest may hold its unsent local writes.
+    page = (size_t)mp->own.offset / DSM_PAGESIZE;
+    dsm_readPageStore(g_pstore, page, g_page_buf);
+    while (dsm_nextPageRun(g_pstore, fd, page, &pos, &start, &size) != 0) {
+        msg.data.offset = mp->own.offset + (int64_t)start;
+        msg.data.size = (int64_t)size;
+        msg.data.buf = g_page_buf + start;
+        dsm_send_msg(fd, &msg);
+    }
+
+    // End with an empty message, and record that the arbiter holds the page.
+    msg.data.offset = mp->own.offset;
+    msg.data.size = 0;
+    dsm_send_msg(fd, &msg);
+    dsm_setHeldPage(g_pstore, fd, page);
+}
+
+// DSM_MSG_SET_PROTO: Process sets the protocol of the pages of a range.
+static void handler_set_proto (int fd, dsm_msg *mp) {
+    UNUSED(fd);
+
+    // Verify state and range.
+    ASSERT_STATE(g_started == 1);
+    ASSERT_COND(mp->own.offset >= 0 && mp->own.size > 0);
+
+    for (size_t page = (size_t)mp->own.offset / DSM_PAGESIZE;
+        page <= (size_t)(mp->own.offset + mp->own.size - 1) / DSM_PAGESIZE;
+        page++) {
+        dsm_setPageMode(g_pstore, page, mp->own.proto);
+    }
+}
+
+/* DSM_MSG_SUBSCRIBE: Process subscribes its arbiter to the pages of a range.
+ * They are fetched first (so held), and no longer invalidated.
+*/
+static void handler_subscribe (int fd, dsm_msg *mp) {
+
+    // Verify state and range.
+    ASSERT_STATE(g_started == 1);
+    ASSERT_COND(mp->own.offset >= 0 && mp->own.size > 0);
+
+    for (size_t page = (size_t)mp->own.offset / DSM_PAGESIZE;
+        page <= (size_t)(mp->own.offset + mp->own.size - 1) / DSM_PAGESIZE;
+        page++) {
+        dsm_setSubscribedPage(g_pstore, fd, page);
+    }
 }
 
 // DSM_MSG_POST_SEM: Process is posting to a semaphore.
 static void handler_post_sem (int fd, dsm_msg *mp) {
-    char *sem_name = mp->sem.sem_name;
     dsm_sem_t *sem;
     dsm_proc *proc;
-    int pfd;
     UNUSED(fd);
 
     // Verify State.
     ASSERT_STATE(g_started == 1);
 
-    // If semaphore does not exist, create it.
-    if ((sem = dsm_getHashTableEntry(g_sem_htab, sem_name)) == NULL) {
-        sem = dsm_setSemHashTableEntry(g_sem_htab, sem_name);
-    }
+    // Resolve the semaphore handle.
+    sem = getSemaphore(mp->sem.sem_id);
 
-    // Get any process blocked on semaphore.
-    proc = dsm_getProcessTableEntryWithSemID(g_proc_tab, sem->sem_id, &pfd);
+    // Get the longest waiting process blocked on semaphore.
+    proc = dsm_dequeueSemWaiter(sem);
 
     // If no process found: Increment value. Else: Unblock and reset process.
     if (proc == NULL) {
@@ -299,13 +861,12 @@ static void handler_post_sem (int fd, dsm_msg *mp) {
     } else {
         proc->sem_id = -1;
         mp->sem.pid = proc->pid;
-        dsm_send_msg(pfd, mp);
+        dsm_send_msg(proc->fd, mp);
     }
 }
 
 // DSM_MSG_WAIT_SEM: Process is waiting on a semaphore.
 static void handler_wait_sem (int fd, dsm_msg *mp) {
-    char *sem_name = mp->sem.sem_name;
     dsm_sem_t *sem = NULL;
     dsm_proc *proc_p = dsm_getProcessTableEntry(g_proc_tab, fd, mp->sem.pid);
 
@@ -315,13 +876,8 @@ static void handler_wait_sem (int fd, dsm_msg *mp) {
     // Verify process exists in table.
     ASSERT_COND(proc_p != NULL);
 
-    // If the semaphore does not exist, create it.
-    if ((sem = dsm_getHashTableEntry(g_sem_htab, sem_name)) == NULL) {
-        sem = dsm_setSemHashTableEntry(g_sem_htab, sem_name);
-    }
-
-    // Verify semaphore was created.
-    ASSERT_COND(sem != NULL);
+    // Resolve the semaphore handle.
+    sem = getSemaphore(mp->sem.sem_id);
 
     // If sem value > 0 : Send unblock and decrement. Else log sem under pid.
     if (sem->value > 0) {
@@ -329,8 +885,127 @@ static void handler_wait_sem (int fd, dsm_msg *mp) {
         dsm_send_msg(fd, mp);
         sem->value--;
     } else {
-        proc_p->sem_id = sem->sem_id;
+        proc_p->sem_id = mp->sem.sem_id;
+        dsm_enqueueSemWaiter(sem, proc_p);
+    }
+}
+
+// DSM_MSG_OPEN_SEM: Process is resolving a named semaphore to a handle.
+static void handler_open_sem (int fd, dsm_msg *mp) {
+    char *sem_name = (char *)mp->name.buf;
+    dsm_sem_t *sem;
+
+    // Verify state.
+    ASSERT_STATE(g_started == 1);
+
+    // Verify name is a terminated string.
+    ASSERT_COND(mp->name.size > 0 && sem_name[mp->name.size - 1] == '\0');
+
+    // If the semaphore does not exist, create it and issue a handle.
+    if ((sem = dsm_getHashTableEntry(g_sem_htab, sem_name)) == NULL) {
+        sem = dsm_setSemHashTableEntry(g_sem_htab, sem_name);
+        sem->handle = setSemaphore(sem);
     }
+
+    // Reply with the handle (no attached data).
+    mp->name.id = sem->handle;
+    mp->name.size = 0;
+    dsm_send_msg(fd, mp);
+}
+
+// DSM_MSG_OPEN_RWL: Process is resolving a named lock to a handle.
+static void handler_open_rwl (int fd, dsm_msg *mp) {
+    char *name = (char *)mp->name.buf;
+    dsm_rwlock_t *lock;
+
+    // Verify state.
+    ASSERT_STATE(g_started == 1);
+
+    // Verify name is a terminated string.
+    ASSERT_COND(mp->name.size > 0 && name[mp->name.size - 1] == '\0');
+
+    // If the lock does not exist, create it (first opener sets preference).
+    if ((lock = dsm_getHashTableEntry(g_rwl_htab, name)) == NULL) {
+        lock = dsm_setRWLockHashTableEntry(g_rwl_htab, name, mp->name.flags);
+        lock->handle = setRWLock(lock);
+    }
+
+    // Reply with the handle (no attached data).
+    mp->name.id = lock->handle;
+    mp->name.size = 0;
+    dsm_send_msg(fd, mp);
+}
+
+// DSM_MSG_RD_LOCK: Arbiter requests a (shared) read lock.
+static void handler_rd_lock (int fd, dsm_msg *mp) {
+    dsm_rwlock_t *lock = getRWLock(mp->lock.lock_id);
+
+    // Verify state.
+    ASSERT_STATE(g_started == 1);
+
+    // Grant now, or queue.
+    if (dsm_acquireRWLock(lock, fd, mp->lock.pid, 0)) {
+        dsm_send_msg(fd, mp);
+    }
+}
+
+// DSM_MSG_WR_LOCK: Process requests an (exclusive) write lock.
+static void handler_wr_lock (int fd, dsm_msg *mp) {
+    dsm_rwlock_t *lock = getRWLock(mp->lock.lock_id);
+
+    // Verify state.
+    ASSERT_STATE(g_started == 1);
+
+    // Grant now, or queue.
+    if (dsm_acquireRWLock(lock, fd, mp->lock.pid, 1)) {
+        dsm_send_msg(fd, mp);
+        return;
+    }
+
+    // If writers are preferred: Readers must stop sharing their grants.
+    if (lock->nreaders > 0 && dsm_mustDrainRWLock(lock)) {
+        mp->type = DSM_MSG_RW_DRAIN;
+        send_all_msg(mp, -1);
+    }
+}
+
+// DSM_MSG_RW_UNLOCK: Arbiter releases read lock, or process its write lock.
+static void handler_rw_unlock (int fd, dsm_msg *mp) {
+    int lock_id = mp->lock.lock_id, next_fd, next_pid, is_writer;
+    dsm_rwlock_t *lock = getRWLock(lock_id);
+
+    // Verify state.
+    ASSERT_STATE(g_started == 1);
+
+    // Release grant.
+    dsm_releaseRWLock(lock, fd, mp->lock.pid);
+
+    // Grant to all now eligible requests.
+    while (dsm_nextRWLockGrant(lock, &next_fd, &next_pid, &is_writer)) {
+        send_lock_msg(is_writer ? DSM_MSG_WR_LOCK : DSM_MSG_RD_LOCK, next_fd,
+            next_pid, lock_id);
+
+        // A read grant ahead of a preferred writer must not be shared on.
+        if (!is_writer && dsm_mustDrainRWLock(lock)) {
+            send_lock_msg(DSM_MSG_RW_DRAIN, next_fd, next_pid, lock_id);
+        }
+    }
+}
+
+// DSM_MSG_P2P_DATA: Process sending data to another process (by GID).
+static void handler_p2p_data (int fd, dsm_msg *mp) {
+    int dst_fd;
+    UNUSED(fd);
+
+    // Verify state.
+    ASSERT_STATE(g_started == 1);
+
+    // Verify target exists.
+    ASSERT_COND(dsm_getProcessTableEntryWithGID(g_proc_tab, mp->p2p.dst_gid,
+        &dst_fd) != NULL);
+
+    // Route to the arbiter of the target. The write order is unaffected.
+    dsm_send_msg(dst_fd, mp);
 }
 
 // DSM_MSG_EXIT: Process exit message.
@@ -347,6 +1022,12 @@ static void handler_exit (int fd, dsm_msg *mp) {
     // Remove process table entry.
     dsm_remProcessTableEntries(g_proc_tab, fd);
 
+    // Remove the pages it held, and its lease setting.
+    dsm_remHolder(g_pstore, fd);
+    if ((size_t)fd < g_nleases) {
+        g_leases[fd] = 0;
+    }
+
     // Destroy session if no active connections left.
     g_alive = (g_pollSet->fp > 1);
 }
@@ -475,11 +1156,29 @@ int main (int argc, const char *argv[]) {
     dsm_setMsgFunc(DSM_MSG_GOT_DATA, handler_got_data, g_fmap);
     dsm_setMsgFunc(DSM_MSG_ADD_PID, handler_add_pid, g_fmap);
     dsm_setMsgFunc(DSM_MSG_REQ_WRT, handler_req_wrt, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_REQ_WRTS, handler_req_wrts, g_fmap);
     dsm_setMsgFunc(DSM_MSG_HIT_BAR, handler_hit_bar, g_fmap);
     dsm_setMsgFunc(DSM_MSG_WRT_DATA, handler_wrt_data, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_WRT_RUNS, handler_wrt_runs, g_fmap);
 	dsm_setMsgFunc(DSM_MSG_WRT_END, handler_wrt_end, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_REQ_OWN, handler_req_own, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_OWN_DROP, handler_own_drop, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_OWN_DATA, handler_own_data, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_ADD_PEER, handler_add_peer, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_SET_LAZY, handler_set_lazy, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_SET_GRANT, handler_set_grant, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_SET_LEASE, handler_set_lease, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_GET_PAGE, handler_get_page, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_SET_PROTO, handler_set_proto, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_SUBSCRIBE, handler_subscribe, g_fmap);
     dsm_setMsgFunc(DSM_MSG_POST_SEM, handler_post_sem, g_fmap);
     dsm_setMsgFunc(DSM_MSG_WAIT_SEM, handler_wait_sem, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_OPEN_SEM, handler_open_sem, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_OPEN_RWL, handler_open_rwl, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_RD_LOCK, handler_rd_lock, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_WR_LOCK, handler_wr_lock, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_RW_UNLOCK, handler_rw_unlock, g_fmap);
+    dsm_setMsgFunc(DSM_MSG_P2P_DATA, handler_p2p_data, g_fmap);
     dsm_setMsgFunc(DSM_MSG_EXIT, handler_exit, g_fmap);
 
     // Initialize pollable set.
@@ -488,12 +1187,24 @@ int main (int argc, const char *argv[]) {
     // Initialize operation queue.
     g_opqueue = dsm_initOpQueue(DSM_MIN_OPQUEUE_SIZE);
 
+    // Initialize page ownership table.
+    g_otab = dsm_initOwnerTable();
+
+    // Initialize page store, and the buffer for fetched pages.
+    g_pstore = dsm_initPageStore(DSM_PAGESIZE);
+    if ((g_page_buf = malloc(DSM_PAGESIZE)) == NULL) {
+        dsm_panic("Couldn't allocate page buffer!");
+    }
+
     // Initialize process table.
     g_proc_tab = dsm_initProcessTable(DSM_PTAB_NFD);
 
     // Initialize semaphore table.
     g_sem_htab = dsm_initSemHashTable();
 
+    // Initialize reader-writer lock table.
+    g_rwl_htab = dsm_initRWLockHashTable();
+
     // Initialize string table.
     g_str_tab = dsm_initStringTable(DSM_STR_TAB_SIZE);
 
@@ -549,15 +1260,33 @@ int main (int argc, const char *argv[]) {
     // Free the process table.
     dsm_freeProcessTable(g_proc_tab);
 
-    // Free semaphore table.
+    // Free semaphore table, and handle array (entries owned by table).
     dsm_freeHashTable(g_sem_htab);
+    free(g_sems);
+
+    // Free lock table, and handle array (entries owned by table).
+    dsm_freeHashTable(g_rwl_htab);
+    free(g_rwls);
 
     // Free string table.
     dsm_freeStringTable(g_str_tab);
 
-    // Free the operation queue.
+    // Report how long writers waited, then free the operation queue.
+    printf("[%d] ", getpid()); dsm_showOpQueueStats(g_opqueue);
     dsm_freeOpQueue(g_opqueue);
 
+    // Free the page ownership table.
+    dsm_freeOwnerTable(g_otab);
+
+    // Free the page store, and page buffer.
+    dsm_freePageStore(g_pstore);
+    free(g_page_buf);
+
+    // Free the write targets, lease holders, and peers.
+    free(g_targets);
+    free(g_leases);
+    free(g_peers);
+
     // Free pollable set.
     dsm_freePollSet(g_pollSet);
 
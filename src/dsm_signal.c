@@ -58,4 +58,19 @@ void dsm_sigaction (int signal, void (*f)(int, siginfo_t *, void *),
 	if (sigaction(signal, &sa, old) == -1) {
 		dsm_panic("Couldn't install handler!");
 	}
-}
\ No newline at end of file
+}
+
+// Installs a handler for the given signal. Interrupted system calls restart.
+void dsm_sigaction_restart (int signal, void (*f)(int, siginfo_t *, void *),
+	struct sigaction *old) {
+	struct sigaction sa = {0};
+
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_sigaction = f;
+
+	// Install sigaction and verify.
+	if (sigaction(signal, &sa, old) == -1) {
+		dsm_panic("Couldn't install handler!");
+	}
+}
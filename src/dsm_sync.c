@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <sys/mman.h>
 #include <ucontext.h>
 
@@ -25,6 +26,13 @@
 // Length of the UD2 instruction for isa: x86-64.
 #define UD2_SIZE		2
 
+// Consecutive streaming faults (same instruction, rising address) before an
+// automatic hole is opened ahead of the instruction.
+#define DSM_AUTO_HOLE_STREAK	16
+
+// Number of pages an automatic hole spans (at most).
+#define DSM_AUTO_HOLE_PAGES		16
+
 
 /*
  *******************************************************************************
@@ -54,6 +62,31 @@ unsigned int g_skip_sync;
 // Hole last access was in. If NULL, access was not in a hole.
 dsm_hole *g_active_hole;
 
+// Boolean: Indicates if access is a repeated string store (unknown length).
+unsigned int g_is_rep_string;
+
+// Identifier of the automatic hole (-1 if none is open).
+static int g_auto_hole_id = -1;
+
+// Instruction and offset of the last fault, and the streaming fault count.
+static void *g_last_pc;
+static off_t g_last_offset;
+static unsigned int g_streak;
+
+// Bitmap of the pages fetched by the process (if fetched lazily).
+static uint64_t *g_resident;
+
+// Invalidations posted before each page was fetched (they don't apply to it).
+static uint32_t *g_fetch_seq;
+
+// Boolean flags: Invalidations are held back (pages in use), and pending.
+static volatile sig_atomic_t g_inv_hold;
+static volatile sig_atomic_t g_inv_pending;
+
+// Range the faulting access was allowed to write.
+static off_t g_write_offset;
+static size_t g_write_size;
+
 
 /*
  *******************************************************************************
@@ -80,21 +113,115 @@ static xed_uint_t getInstLength (void *addr, xed_state_t *decoderState) {
 	return xed_decoded_inst_get_length(&xedd);
 }
 
-// Prepares to write: Messages the arbiter, waits for an acknowledgement.
-static void takeAccess (void) {
+/* Returns nonzero if the instruction is a REP-prefixed string store, whose
+ * extent can't be determined from the fault address alone.
+*/
+static int isRepString (unsigned char *inst) {
+	int rep = 0;
+
+	// Skip legacy prefixes, noting REP.
+	for (;; inst++) {
+		if (*inst == 0xf2 || *inst == 0xf3) {
+			rep = 1;
+		} else if (*inst != 0x66 && *inst != 0x67 && *inst != 0x2e &&
+			*inst != 0x3e && *inst != 0x26 && *inst != 0x64 && *inst != 0x65 &&
+			*inst != 0x36 && *inst != 0xf0) {
+			break;
+		}
+	}
 
-	// Configure message.
-	dsm_msg msg = {.type = DSM_MSG_REQ_WRT};
-	msg.proc.pid = getpid();
+	// Skip REX prefix.
+	if ((*inst & 0xf0) == 0x40) {
+		inst++;
+	}
 
-	// Send message to arbiter.
-	dsm_send_msg(g_sock_io, &msg);
+	// MOVS, STOS.
+	return rep && (*inst == 0xa4 || *inst == 0xa5 || *inst == 0xaa ||
+		*inst == 0xab);
+}
 
-	// Wait for response from arbiter.
-	dsm_recv_msg(g_sock_io, &msg);;
+// Returns nonzero if the given page was fetched (always, if not lazy).
+static int isResident (size_t page) {
+	return g_lazy_pages == 0 || ((g_resident[page / 64] >> (page % 64)) & 1);
+}
 
-	// Verify message.
-	ASSERT_COND(msg.type == DSM_MSG_WRT_NOW && msg.proc.pid == getpid());
+/* Sets the protection of the pages spanning the given range. If not lazy,
+ * it is set for the whole map (as all pages are resident). Otherwise pages
+ * not resident stay inaccessible when made readable.
+*/
+static void protectRange (off_t offset, size_t size, int prot) {
+	size_t pagesize = DSM_PAGESIZE, page, run, last;
+	int is_resident;
+
+	if (g_lazy_pages == 0) {
+		dsm_mprotect(g_shared_map, g_map_size, prot);
+		return;
+	}
+
+	last = ((size_t)offset + size - 1) / pagesize;
+
+	// Protect runs of pages alike at once.
+	for (page = (size_t)offset / pagesize; page <= last; page = run) {
+		is_resident = (prot == PROT_WRITE || isResident(page));
+		for (run = page + 1; run <= last && (prot == PROT_WRITE ||
+			isResident(run) == is_resident); run++);
+		dsm_mprotect((void *)((intptr_t)g_shared_map + page * pagesize),
+			(run - page) * pagesize, is_resident ? prot : PROT_NONE);
+	}
+}
+
+// Drops a page: It is fetched again on the next access.
+static void dropPage (size_t page) {
+	g_resident[page / 64] &= ~((uint64_t)1 << (page % 64));
+	dsm_mprotect((void *)((intptr_t)g_shared_map + page * DSM_PAGESIZE),
+		DSM_PAGESIZE, PROT_NONE);
+}
+
+/* Drops the pages invalidated since last applied, unless fetched after the
+ * invalidation. Entries the ring overwrote are lost: All pages fetched before
+ * the oldest entry left are dropped instead.
+*/
+static void applyInvalidations (void) {
+	size_t npages = (size_t)g_map_size / DSM_PAGESIZE, page;
+	uint32_t from = g_slot->inv_seen, seq;
+
+	do {
+		seq = __atomic_load_n(&g_ctrl->inv_seq, __ATOMIC_ACQUIRE);
+
+		if (seq - from > DSM_CTRL_INV_RING) {
+			from = seq - DSM_CTRL_INV_RING;
+			for (page = 0; page < npages; page++) {
+				if (isResident(page) &&
+					(int32_t)(g_fetch_seq[page] - from) < 0) {
+					dropPage(page);
+				}
+			}
+		}
+
+		for (uint32_t i = from; i != seq; i++) {
+			page = g_ctrl->inv_ring[i % DSM_CTRL_INV_RING];
+			if (page < npages && isResident(page) &&
+				(int32_t)(i - g_fetch_seq[page]) >= 0) {
+				dropPage(page);
+			}
+		}
+
+	// Read again if the ring wrapped meanwhile.
+	} while (__atomic_load_n(&g_ctrl->inv_seq, __ATOMIC_ACQUIRE) - from >
+		DSM_CTRL_INV_RING);
+
+	// Acknowledge to the arbiter.
+	__atomic_store_n(&g_slot->inv_seen, seq, __ATOMIC_RELEASE);
+}
+
+// Applies pending invalidations. Call with invalidations not held.
+static void applyPending (void) {
+	while (g_inv_pending != 0 && g_slot != NULL) {
+		g_inv_hold = 1;
+		g_inv_pending = 0;
+		applyInvalidations();
+		g_inv_hold = 0;
+	}
 }
 
 // Releases access: Messages the arbiter, then suspends itself until continued.
@@ -119,6 +246,42 @@ static void dropAccess (size_t modified_size) {
 }
 
 
+/* Counts the fault toward a streaming store: The same instruction writing
+ * at rising addresses, at most a page apart. Returns the streak length.
+*/
+static unsigned int trackStream (void *prgm_counter, off_t offset) {
+	int streaming = (prgm_counter == g_last_pc && offset > g_last_offset &&
+		offset - g_last_offset < (off_t)DSM_PAGESIZE);
+
+	g_last_pc = prgm_counter;
+	g_last_offset = offset;
+
+	return (g_streak = (streaming ? g_streak + 1 : 0));
+}
+
+/* Opens an automatic hole from the given offset to the end of its page range.
+ * Returns the hole, or NULL if the range overlaps another hole. Nobody claimed
+ * the range, so the hole tracks the bytes written (others may own the rest).
+*/
+static dsm_hole *openAutoHole (off_t offset) {
+	off_t pagesize = (off_t)DSM_PAGESIZE;
+	off_t end = MIN((offset / pagesize + DSM_AUTO_HOLE_PAGES) * pagesize,
+		g_map_size);
+
+	if (dsm_overlaps_hole(offset, end - offset, &g_shm_holes) != 0) {
+		return NULL;
+	}
+
+	if ((g_auto_hole_id = dsm_new_exact_hole(offset, end - offset,
+		&g_shm_holes))
+		== -1) {
+		dsm_panicf("(%s:%d) Couldn't create hole!\n", __FILE__, __LINE__);
+	}
+
+	return dsm_get_hole(g_auto_hole_id, &g_shm_holes);
+}
+
+
 /*
  *******************************************************************************
  *                         Public Function Definitions                         *
@@ -135,6 +298,131 @@ void dsm_sync_init (void) {
 	// Setup machine state.
 	xed_state_init2(&g_xed_machine_state, XED_MACHINE_MODE_LONG_64,
 		XED_ADDRESS_WIDTH_64b);
+
+	// Allocate the resident page bitmap (no pages fetched), if lazy.
+	if (g_lazy_pages != 0 && ((g_resident = calloc((g_map_size /
+		DSM_PAGESIZE + 63) / 64, sizeof(uint64_t))) == NULL ||
+		(g_fetch_seq = calloc(g_map_size / DSM_PAGESIZE, sizeof(uint32_t)))
+		== NULL)) {
+		dsm_panic("dsm_sync_init: Allocation failed!");
+	}
+}
+
+/* Fetches the pages of the given range of the shared map that aren't resident
+ * yet (if fetched lazily), and makes them readable. Returns the number of
+ * pages fetched. All requests go out before the replies are awaited.
+ * Invalidations are held back meanwhile, and applied after (unless held).
+*/
+unsigned int dsm_sync_fetch (off_t offset, size_t size) {
+	dsm_msg msg = {.type = DSM_MSG_GET_PAGE};
+	size_t pagesize = DSM_PAGESIZE, first, last, page;
+	sig_atomic_t hold = g_inv_hold;
+	unsigned int n = 0;
+
+	if (g_lazy_pages == 0 || size == 0) {
+		return 0;
+	}
+
+	g_inv_hold = 1;
+
+	first = (size_t)offset / pagesize;
+	last = MIN((size_t)offset + size, (size_t)g_map_size) - 1;
+	last /= pagesize;
+
+	// Ask the arbiter for each page not resident.
+	for (page = first; page <= last; page++) {
+		if (isResident(page) == 0) {
+			msg.own.pid = getpid();
+			msg.own.offset = (int64_t)(page * pagesize);
+			msg.own.size = pagesize;
+			dsm_send_msg(g_sock_io, &msg);
+			n++;
+		}
+	}
+
+	// Wait for the replies (in order), and make each page readable.
+	for (unsigned int i = 0; i < n; i++) {
+		dsm_recv_msg(g_sock_io, &msg);
+		ASSERT_COND(msg.type == DSM_MSG_GET_PAGE && msg.own.pid == getpid());
+		page = (size_t)msg.own.offset / pagesize;
+		dsm_mprotect((void *)((intptr_t)g_shared_map + msg.own.offset),
+			pagesize, PROT_READ);
+		g_resident[page / 64] |= (uint64_t)1 << (page % 64);
+		g_fetch_seq[page] = (uint32_t)msg.own.inv_seq;
+	}
+
+	if ((g_inv_hold = hold) == 0) {
+		applyPending();
+	}
+
+	return n;
+}
+
+/* Prepares to write the given range of the shared map: Messages the arbiter,
+ * waits for an acknowledgement. Under page ownership, the arbiter grants it
+ * once it owns all pages of the range. The range is then fetched: Pages may
+ * have been dropped while waiting, but not after (others can't write them).
+*/
+void dsm_sync_take (off_t offset, size_t size) {
+	dsm_msg msg = {.type = DSM_MSG_REQ_WRT};
+
+	// Configure message.
+	if (g_page_owner != 0) {
+		msg.type = DSM_MSG_REQ_OWN;
+		msg.own.pid = getpid();
+		msg.own.offset = offset;
+		msg.own.size = MIN(size, (size_t)(g_map_size - offset));
+	} else {
+		msg.proc.pid = getpid();
+	}
+
+	// Send message to arbiter.
+	dsm_send_msg(g_sock_io, &msg);
+
+	// Wait for response from arbiter.
+	dsm_recv_msg(g_sock_io, &msg);
+
+	// Verify message.
+	ASSERT_COND(msg.type == DSM_MSG_WRT_NOW && msg.proc.pid == getpid());
+
+	// Fetch the range (if fetched lazily).
+	dsm_sync_fetch(offset, size);
+}
+
+/* Writes the modified runs of the automatic hole as one write, and removes
+ * the hole. Does nothing if no automatic hole is open.
+*/
+void dsm_sync_flush (void) {
+	unsigned char buf[DSM_MSG_RUNS_BUF_SIZE];
+	size_t pos = 0, size;
+	dsm_hole *hole;
+	off_t offset;
+	dsm_msg msg;
+
+	// Nothing to do without an automatic hole.
+	if (g_auto_hole_id == -1) {
+		return;
+	}
+
+	ASSERT_COND((hole = dsm_get_hole(g_auto_hole_id, &g_shm_holes)) != NULL);
+
+	// Send data of each modified run (a hole is only opened on a write).
+	ASSERT_COND(dsm_dirty_range(hole, &offset, &size) != 0);
+	dsm_sync_take(offset, size);
+	dsm_init_runs(&msg, buf);
+	while (dsm_next_dirty_run(hole, &pos, &offset, &size) != 0) {
+		dsm_send_run(g_sock_io, &msg, offset, size,
+			(unsigned char *)((intptr_t)g_shared_map + (intptr_t)offset));
+	}
+	dsm_send_runs(g_sock_io, &msg);
+
+	// Signal end of data stream.
+	msg.type = DSM_MSG_WRT_END;
+	dsm_send_msg(g_sock_io, &msg);
+
+	// Remove the hole.
+	ASSERT_COND(dsm_del_hole(g_auto_hole_id, &g_shm_holes) == 0);
+	g_auto_hole_id = -1;
 }
 
 // Handler: Synchronization action for SIGSEGV.
@@ -142,28 +430,74 @@ void dsm_sync_sigsegv (int signal, siginfo_t *info, void *ucontext) {
 	ucontext_t *context = (ucontext_t *)ucontext;
 	void *prgm_counter = (void *)context->uc_mcontext.gregs[REG_RIP];
 	xed_uint_t len;
+	unsigned int streak;
 	off_t offset, fault_offset;
 	UNUSED(signal);
 
-	// Set fault address.
-	g_fault_addr = info->si_addr;
-
 	// Compute fault offset.
-	fault_offset = (intptr_t)g_fault_addr - (intptr_t)g_shared_map;
+	fault_offset = (intptr_t)info->si_addr - (intptr_t)g_shared_map;
 
 	// Verify address is within shared page. Otherwise panic.
-	if ((intptr_t)g_fault_addr < (intptr_t)g_shared_map || 
-		(intptr_t)g_fault_addr >= (intptr_t)g_shared_map + g_map_size) {
-		dsm_panicf("Segmentation Fault: %p", g_fault_addr);
+	if (fault_offset < 0 || fault_offset >= g_map_size) {
+		dsm_panicf("Segmentation Fault: %p", info->si_addr);
+	}
+
+	// A page not resident yet: Fetch it, then retry the access (may also be
+	// a read by a single-stepped store, so the fault address is kept).
+	if (dsm_sync_fetch(fault_offset, 1) != 0) {
+		return;
 	}
 
+	// Set fault address.
+	g_fault_addr = info->si_addr;
+
 	// Determine whether access in hole or not.
 	g_active_hole = dsm_in_hole(fault_offset, SYS_ADDR_WIDTH,
-		SYS_ADDR_WIDTH, g_shm_holes);
+		SYS_ADDR_WIDTH, &g_shm_holes);
+
+	// A string store may write all of a hole. Keep it out of the automatic
+	// hole, which only holds the bytes written.
+	g_is_rep_string = isRepString(prgm_counter);
+	if (g_is_rep_string && g_active_hole != NULL &&
+		g_active_hole->id == g_auto_hole_id) {
+		g_active_hole = NULL;
+	}
+
+	// Outside holes: Write out the automatic hole first (keeps program order),
+	// and open a new one ahead of the access if it continues a stream.
+	streak = trackStream(prgm_counter, fault_offset);
+	if (g_active_hole == NULL) {
+		dsm_sync_flush();
+		if (streak >= DSM_AUTO_HOLE_STREAK && !g_is_rep_string) {
+			g_active_hole = openAutoHole(fault_offset);
+		}
+	}
+
+	// Determine the range the access may write. String stores outside holes
+	// may write anywhere.
+	if (g_is_rep_string && g_active_hole != NULL) {
+		g_write_offset = g_active_hole->offset;
+		g_write_size = g_active_hole->size;
+	} else if (g_is_rep_string) {
+		g_write_offset = 0;
+		g_write_size = g_map_size;
+	} else {
+		g_write_offset = fault_offset;
+		g_write_size = MIN(SYS_ADDR_WIDTH, g_map_size - fault_offset);
+	}
 
 	// Request write access if the addressable range wasn't in a hole.
 	if (g_active_hole == NULL) {
-		takeAccess();
+		dsm_sync_take(fault_offset, SYS_ADDR_WIDTH);
+	}
+
+	// Hold invalidations until the access completes. Then fetch what it writes
+	// (but not the whole map for a string store).
+	g_inv_hold = 1;
+	if (g_write_size < (size_t)g_map_size) {
+		dsm_sync_fetch(g_write_offset, g_write_size);
+	} else {
+		dsm_sync_fetch(fault_offset, SYS_ADDR_WIDTH);
 	}
 
 	// Make copy of memory before modification (do after access granted).
@@ -187,7 +521,7 @@ void dsm_sync_sigsegv (int signal, siginfo_t *info, void *ucontext) {
 	memcpy(nextInst, g_ud2_opcodes, UD2_SIZE);
 
 	// Give protected portion of shared page read-write access.
-	dsm_mprotect(g_shared_map, g_map_size, PROT_WRITE);
+	protectRange(g_write_offset, g_write_size, PROT_WRITE);
 }
 
 // Handler: Synchronization action for SIGILL.
@@ -206,7 +540,7 @@ void dsm_sync_sigill (int signal, siginfo_t *info, void *ucontext) {
 	memcpy(prgm_counter, g_inst_buf, UD2_SIZE);
 
 	// Protect shared page again.
-	dsm_mprotect(g_shared_map, g_map_size, PROT_READ);
+	protectRange(g_write_offset, g_write_size, PROT_READ);
 
 	// Compute the size of the modified memory.
 	size_t modified_size = dsm_memcmp(g_fault_addr, g_mem_buf, SYS_ADDR_WIDTH);
@@ -216,6 +550,40 @@ void dsm_sync_sigill (int signal, siginfo_t *info, void *ucontext) {
 		dropAccess(modified_size);
 	}
 
+	// Otherwise record the modified block(s) of the hole. A single store is at
+	// most a block wide. String stores may cover the whole hole. An automatic
+	// hole tracks bytes: Mark just those the store changed.
+	else if (g_is_rep_string) {
+		dsm_mark_hole(g_active_hole, g_active_hole->offset,
+			g_active_hole->size);
+	} else if (g_active_hole->id == g_auto_hole_id) {
+		dsm_mark_hole(g_active_hole, (intptr_t)g_fault_addr -
+			(intptr_t)g_shared_map, MAX(modified_size, 1));
+	} else {
+		dsm_mark_hole(g_active_hole, (intptr_t)g_fault_addr -
+			(intptr_t)g_shared_map, DSM_HOLE_BLOCK_SIZE);
+	}
+
 	// Unset fault address.
 	g_fault_addr = NULL;
+
+	// Apply the invalidations held during the access.
+	g_inv_hold = 0;
+	applyPending();
+}
+
+// Handler: Drops pages invalidated by the arbiter (DSM_CTRL_INV_SIGNAL).
+void dsm_sync_siginv (int signal, siginfo_t *info, void *ucontext) {
+	int saved_errno = errno;
+	UNUSED(signal);
+	UNUSED(info);
+	UNUSED(ucontext);
+
+	// Apply now, unless pages are in use (then once they aren't).
+	g_inv_pending = 1;
+	if (g_inv_hold == 0) {
+		applyPending();
+	}
+
+	errno = saved_errno;
 }
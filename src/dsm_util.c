@@ -10,6 +10,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "dsm_util.h"
 
@@ -204,6 +206,23 @@ double dsm_getWallTime (void) {
 	return (double)time.tv_sec + (double)time.tv_usec * 0.000001;
 }
 
+/* Sleeps while *addr == val (shared futex). Returns early on wake, signal,
+ * or if addr isn't readable (a shared page that was dropped).
+*/
+void dsm_futexWait (volatile uint32_t *addr, uint32_t val) {
+	if (syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0) == -1 &&
+		errno != EAGAIN && errno != EINTR && errno != EFAULT) {
+		dsm_panic("Couldn't wait on futex!");
+	}
+}
+
+// Wakes up to n waiters sleeping on addr (shared futex). Panics on error.
+void dsm_futexWake (volatile uint32_t *addr, int n) {
+	if (syscall(SYS_futex, addr, FUTEX_WAKE, n, NULL, NULL, 0) == -1) {
+		dsm_panic("Couldn't wake futex!");
+	}
+}
+
 /*
  *******************************************************************************
  *                       Semaphore Function Definitions                        *
@@ -337,7 +356,9 @@ off_t dsm_getSharedFileSize (int fd) {
 	return sb.st_size;
 }
 
-// Maps shared file of given size to memory with protections. Panics on error.
+/* Maps shared file of given size to memory with protections. Panics on error.
+ * The contents are left as is: Creators should zero the map themselves.
+*/
 void *dsm_mapSharedFile (int fd, size_t size, int prot) {
 	void *map;
 
@@ -346,9 +367,6 @@ void *dsm_mapSharedFile (int fd, size_t size, int prot) {
 		dsm_panicf("Couldn't map shared file to memory (fd = %d)!", fd);
 	}
 
-	// Zero the memory.
-	memset(map, 0, size);
-
 	return map;
 }
 
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "dsm/dsm.h"
+
+/* Test Description:
+ * Two processes each fill two holes without blocking, back to back, and
+ * then a third before taking a lock. The second fill (or the lock) completes
+ * the fill before it. Each process then checks the data of the other.
+*/
+
+
+// Size of a page (in bytes).
+#define PAGE		4096
+
+// Number of fill rounds.
+#define ROUNDS		10
+
+
+int main (void) {
+    char *p = dsm_init("afill", 2, 2, 16 * PAGE);
+    int gid = dsm_get_gid(), ok = 1, lock = dsm_rwlock_open("afill", 0);
+
+    for (int r = 1; r <= ROUNDS; r++) {
+        char *part = p + gid * 8 * PAGE;
+
+        // Fill each partition as soon as it is computed.
+        for (int k = 0; k < 3; k++) {
+            char *q = part + k * 2 * PAGE;
+            int id = dsm_dig_hole(q, 2 * PAGE);
+
+            for (int i = 0; i < 2 * PAGE; i += 5) {
+                q[i] = (char)(r + k + i);
+            }
+            dsm_fill_hole_async(id);
+        }
+
+        // Take a lock with the last fill outstanding.
+        dsm_rwlock_wrlock(lock);
+        dsm_rwlock_unlock(lock);
+        dsm_barrier();
+
+        // All fills of both processes are visible.
+        for (int g = 0; g < 2; g++) {
+            for (int k = 0; k < 3; k++) {
+                char *q = p + g * 8 * PAGE + k * 2 * PAGE;
+                for (int i = 0; i < 2 * PAGE; i += 5) {
+                    ok = ok && (q[i] == (char)(r + k + i));
+                }
+            }
+        }
+        dsm_barrier();
+    }
+
+    dsm_exit();
+
+    assert(ok == 1);
+
+	// Print ending message.
+	printf("Ok!\n");
+
+    return 0;
+}
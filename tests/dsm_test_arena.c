@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "dsm/dsm.h"
+
+/* Test Description:
+ * Two processes allocate from arenas they set, next to a page carved by
+ * hand. The root allocates a block larger than an equal share of the map.
+ * The other process checks its contents.
+*/
+
+
+// Size of a page (in bytes).
+#define PAGE		4096
+
+// Pages in the map, and in the block of the root.
+#define NPAGES		16
+#define BLOCK_PAGES	12
+
+
+int main (void) {
+    char *p = dsm_init("arena", 2, 2, NPAGES * PAGE);
+    int *res = (int *)p, gid = dsm_get_gid(), ok = 1;
+    char *block, *arena = p + (gid == 0 ? 4 : 2) * PAGE;
+
+    // Page 0 is carved by hand: The arenas are set outside it.
+    dsm_set_arena(arena, (gid == 0 ? NPAGES - 4 : 1) * PAGE);
+
+    // The root holds a block of most of the map.
+    block = dsm_malloc((gid == 0) ? BLOCK_PAGES * PAGE : 100);
+    ok = ok && (block >= arena && block < arena + (NPAGES - 4) * PAGE);
+    if (gid == 0) {
+        for (int i = 0; i < BLOCK_PAGES * PAGE; i += 64) {
+            block[i] = (char)(i / 64);
+        }
+    } else {
+        ok = ok && (dsm_malloc(PAGE) == NULL);
+    }
+    dsm_barrier();
+
+    // Its contents are visible to the other.
+    for (int i = 0; gid == 1 && i < BLOCK_PAGES * PAGE; i += 64) {
+        ok = ok && (p[4 * PAGE + i] == (char)(i / 64));
+    }
+
+    // Share the result: Only the master checks after exiting.
+    res[gid] = ok;
+    dsm_barrier();
+    ok = ok && (res[0] == 1 && res[1] == 1);
+
+    dsm_exit();
+
+    assert(ok == 1);
+
+	// Print ending message.
+	printf("Ok!\n");
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "dsm/dsm.h"
+
+/* Test Description:
+ * Three processes broadcast, scatter and gather private buffers, with each
+ * process as the root in turn. The broadcast length is not a multiple of the
+ * chunk size (8 KiB). Each process checks what it received.
+*/
+
+
+// Number of processes.
+#define NPROC		3
+
+// Broadcast length (in bytes), and block length of scatter and gather.
+#define BCAST_LEN	(3 * 8192 + 100)
+#define BLOCK_LEN	1000
+
+
+static unsigned char g_buf[BCAST_LEN];
+static unsigned char g_all[NPROC * BLOCK_LEN];
+static unsigned char g_mine[BLOCK_LEN];
+
+
+int main (void) {
+    int *p = dsm_init("coll", NPROC, NPROC, 4096);
+    int gid = dsm_get_gid(), ok = 1;
+
+    for (int root = 0; root < NPROC; root++) {
+
+        // Broadcast: Only the root has the data beforehand.
+        for (int i = 0; i < BCAST_LEN; i++) {
+            g_buf[i] = (gid == root) ? (unsigned char)(i * 7 + root) : 0;
+        }
+        dsm_bcast(g_buf, BCAST_LEN, root);
+        for (int i = 0; i < BCAST_LEN; i++) {
+            ok = ok && (g_buf[i] == (unsigned char)(i * 7 + root));
+        }
+
+        // Scatter: Each process receives its block.
+        for (int i = 0; i < NPROC * BLOCK_LEN; i++) {
+            g_all[i] = (gid == root) ? (unsigned char)(i + root) : 0;
+        }
+        dsm_scatter(g_all, g_mine, BLOCK_LEN, root);
+        for (int i = 0; i < BLOCK_LEN; i++) {
+            ok = ok &&
+                (g_mine[i] == (unsigned char)(gid * BLOCK_LEN + i + root));
+        }
+
+        // Gather: The root receives all blocks, in order of GID.
+        memset(g_all, 0, sizeof(g_all));
+        for (int i = 0; i < BLOCK_LEN; i++) {
+            g_mine[i] = (unsigned char)(gid * 5 + i);
+        }
+        dsm_gather(g_mine, g_all, BLOCK_LEN, root);
+        for (int i = 0; gid == root && i < NPROC * BLOCK_LEN; i++) {
+            ok = ok && (g_all[i] ==
+                (unsigned char)((i / BLOCK_LEN) * 5 + i % BLOCK_LEN));
+        }
+    }
+
+    // Share the result: Only the master checks after exiting.
+    p[gid] = ok;
+    dsm_barrier();
+    for (int g = 0; g < NPROC; g++) {
+        ok = ok && (p[g] == 1);
+    }
+
+    dsm_exit();
+
+    assert(ok == 1);
+
+	// Print ending message.
+	printf("Ok!\n");
+
+    return 0;
+}
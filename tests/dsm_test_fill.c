@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "dsm/dsm.h"
+
+/* Test Description:
+ * Two processes each fill a clean hole and a dirty hole together, the clean
+ * one first. The dirty hole is written at its start, so its runs are only
+ * sent if the search for them starts over for each hole. Each process then
+ * checks the data of the other.
+*/
+
+
+// Size of a page (in bytes).
+#define PAGE		4096
+
+// Number of fill rounds.
+#define ROUNDS		10
+
+
+int main (void) {
+    char *p = dsm_init("fill", 2, 2, 16 * PAGE);
+    int gid = dsm_get_gid(), ok = 1, ids[2];
+
+    for (int r = 1; r <= ROUNDS; r++) {
+        char *clean = p + gid * 8 * PAGE, *dirty = clean + 4 * PAGE;
+
+        // Dig a large clean hole, and a small dirty one after it.
+        ids[0] = dsm_dig_hole(clean, 4 * PAGE);
+        ids[1] = dsm_dig_hole(dirty, PAGE);
+        for (int i = 0; i < 64; i++) {
+            dirty[i] = (char)(r + i);
+        }
+
+        dsm_fill_holes(ids, 2);
+        dsm_barrier();
+
+        // The dirty data of both processes is visible.
+        for (int g = 0; g < 2; g++) {
+            for (int i = 0; i < 64; i++) {
+                ok = ok && (p[g * 8 * PAGE + 4 * PAGE + i] == (char)(r + i));
+            }
+        }
+        dsm_barrier();
+    }
+
+    dsm_exit();
+
+    assert(ok == 1);
+
+	// Print ending message.
+	printf("Ok!\n");
+
+    return 0;
+}
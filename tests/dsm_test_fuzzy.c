@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "dsm/dsm.h"
+
+/* Test Description:
+ * Two processes store to the shared map between arriving at a split-phase
+ * barrier and waiting on it. The barrier may be released while the write
+ * request of such a store is still queued. Each process then checks the
+ * stores of the other.
+*/
+
+
+// Number of barrier rounds.
+#define ROUNDS		50
+
+
+int main (void) {
+    int *p = dsm_init("fuzzy", 2, 2, 4096);
+    int gid = dsm_get_gid(), ok = 1;
+
+    for (int r = 1; r <= ROUNDS; r++) {
+        dsm_barrier_arrive();
+
+        // Store while the barrier completes.
+        p[gid] = r;
+
+        dsm_barrier_wait();
+        dsm_barrier();
+
+        // Both stores of the round are visible.
+        ok = ok && (p[0] == r && p[1] == r);
+        dsm_barrier();
+    }
+
+    dsm_exit();
+
+    assert(ok == 1);
+
+	// Print ending message.
+	printf("Ok!\n");
+
+    return 0;
+}
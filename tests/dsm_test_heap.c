@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "dsm_heap.h"
+#include "dsm_util.h"
+
+/* Test Description:
+ * This program checks the heap allocator on a private buffer: Small blocks
+ * come from slabs of their size class, alignment is honoured, large blocks
+ * get whole pages, and released space is reused.
+*/
+
+
+// Page size of the test heap.
+#define PAGE		4096
+
+// Number of pages in the test heap.
+#define NPAGES		8
+
+
+int main (void) {
+	static unsigned char buf[PAGE * NPAGES] __attribute__((aligned(PAGE)));
+	void *a, *b, *c, *d, *big;
+
+	// Create heap.
+	dsm_heap *heap = dsm_new_heap(buf, NPAGES, PAGE);
+
+	// Zero-sized allocations return NULL.
+	assert(dsm_heap_alloc(heap, 0, 16) == NULL);
+
+	// Small blocks of one class share a slab. Different classes don't.
+	assert((a = dsm_heap_alloc(heap, 10, 16)) == buf);
+	assert((b = dsm_heap_alloc(heap, 16, 16)) == buf + 16);
+	assert((c = dsm_heap_alloc(heap, 17, 16)) == buf + PAGE);
+
+	// Alignment selects a class at least that large.
+	assert((d = dsm_heap_alloc(heap, 8, 64)) != NULL);
+	assert(((uintptr_t)d % 64) == 0 && d != c);
+
+	// Large blocks get whole pages, and are page aligned.
+	assert((big = dsm_heap_alloc(heap, 2 * PAGE + 1, 16)) != NULL);
+	assert(((uintptr_t)big % PAGE) == 0);
+	assert(heap->pages[((unsigned char *)big - buf) / PAGE].npages == 3);
+
+	// Only allocated blocks can be released, and only once.
+	assert(dsm_heap_release(heap, (unsigned char *)a + 1) != 0);
+	assert(dsm_heap_release(heap, (unsigned char *)big + PAGE) != 0);
+	assert(dsm_heap_release(heap, buf + PAGE * NPAGES) != 0);
+	assert(dsm_heap_release(heap, a) == 0);
+	assert(dsm_heap_release(heap, a) != 0);
+
+	// Released slots are reused.
+	assert(dsm_heap_alloc(heap, 12, 16) == a);
+
+	// Released pages are reused. The heap is then exhausted.
+	assert(dsm_heap_release(heap, big) == 0);
+	assert(dsm_heap_alloc(heap, NPAGES * PAGE, 16) == NULL);
+	assert(dsm_heap_alloc(heap, 5 * PAGE, PAGE) != NULL);
+	assert(dsm_heap_alloc(heap, PAGE, 16) == NULL);
+
+	// Emptied slabs become free pages.
+	assert(dsm_heap_release(heap, a) == 0 && dsm_heap_release(heap, b) == 0);
+	assert(dsm_heap_alloc(heap, PAGE, 16) == buf);
+
+	// Free the heap.
+	dsm_free_heap(heap);
+
+	// Print ending message.
+	printf("Ok!\n");
+
+	return 0;
+}
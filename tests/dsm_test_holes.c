@@ -4,7 +4,7 @@
 #include "dsm_holes.h"
 
 // Shared memory holes.
-dsm_hole *g_shm_holes;
+dsm_hole_tab g_shm_holes;
 
 
 // Main test program.
@@ -21,29 +21,29 @@ int main (void) {
 	assert((c = dsm_new_hole(6, 1, &g_shm_holes)) != -1);
 
 	// Assert that "a" is occupied.
-	assert(dsm_overlaps_hole(0, 3, g_shm_holes) != 0);
+	assert(dsm_overlaps_hole(0, 3, &g_shm_holes) != 0);
 
 	// Assert that "c" is occupied.
-	assert(dsm_overlaps_hole(5, 4, g_shm_holes) != 0);
+	assert(dsm_overlaps_hole(5, 4, &g_shm_holes) != 0);
 
 	// Assert space 7-9 is not occupied.
-	assert(dsm_overlaps_hole(7, 2, g_shm_holes) == 0);
+	assert(dsm_overlaps_hole(7, 2, &g_shm_holes) == 0);
 
 	// Ensure registering 5-8 fails.
 	assert(dsm_new_hole(5, 3, &g_shm_holes) == -1);
 
 	// Remove "a", ensure space is clear.
 	assert(dsm_del_hole(a, &g_shm_holes) != -1);
-	assert(dsm_overlaps_hole(0, 2, g_shm_holes) == 0);
+	assert(dsm_overlaps_hole(0, 2, &g_shm_holes) == 0);
 
 	// Ensure space 2-4 is completely within a hole (b).
-	assert(dsm_in_hole(2, 2, 0, g_shm_holes) != 0);
+	assert(dsm_in_hole(2, 2, 0, &g_shm_holes) != 0);
 
 	// Ensure space 1-3 is not completely within a hole.
-	assert(dsm_in_hole(1, 2, 0, g_shm_holes) == 0);
+	assert(dsm_in_hole(1, 2, 0, &g_shm_holes) == 0);
 
 	// Ensure space 3-7 is not completely within a hole.
-	assert(dsm_in_hole(3, 4, 0, g_shm_holes) == 0);
+	assert(dsm_in_hole(3, 4, 0, &g_shm_holes) == 0);
 
 	// Ensure registering 1 -> 5 fails.
 	assert((d = dsm_new_hole(1, 4, &g_shm_holes)) == -1);
@@ -56,8 +56,8 @@ int main (void) {
 
 	// Ensure "b" can be removed, and space is clear.
 	assert(dsm_del_hole(b, &g_shm_holes) != -1);
-	assert(dsm_overlaps_hole(0, 5, g_shm_holes) == 0);
-	assert(dsm_overlaps_hole(0, 6, g_shm_holes) == 0);
+	assert(dsm_overlaps_hole(0, 5, &g_shm_holes) == 0);
+	assert(dsm_overlaps_hole(0, 6, &g_shm_holes) == 0);
 
 	// Register 0 -> 6 as "d".
 	assert((d = dsm_new_hole(0, 6, &g_shm_holes)) != -1);
@@ -65,8 +65,64 @@ int main (void) {
 	// Ensure registering 2 -> 3 fails.
 	assert((e = dsm_new_hole(2, 1, &g_shm_holes)) == -1);
 
+	// Ensure offsets above 4GB don't wrap around.
+	off_t big = (off_t)1 << 33;
+	assert(dsm_new_hole(big, 8, &g_shm_holes) != -1);
+	assert(dsm_overlaps_hole(8, 1, &g_shm_holes) == 0);
+	assert(dsm_overlaps_hole(big + 4, 1, &g_shm_holes) != 0);
+	assert(dsm_in_hole(big, 8, 0, &g_shm_holes) != NULL);
+
+	// Register many holes out of order, then look each of them up.
+	for (int i = 999; i >= 0; i--) {
+		assert(dsm_new_hole(100 + 4 * i, 2, &g_shm_holes) != -1);
+	}
+	for (int i = 0; i < 1000; i++) {
+		dsm_hole *h = dsm_in_hole(100 + 4 * i + 1, 1, 0, &g_shm_holes);
+		assert(h != NULL && h->offset == 100 + 4 * i);
+		assert(dsm_in_hole(100 + 4 * i + 2, 1, 0, &g_shm_holes) == NULL);
+		assert(dsm_get_hole(h->id, &g_shm_holes) == h);
+	}
+
+	// Ensure a new hole has no modified runs.
+	size_t pos = 0, size;
+	off_t offset;
+	dsm_hole *h = dsm_get_hole(e = dsm_new_hole(big + 4096, 1000, &g_shm_holes),
+		&g_shm_holes);
+	assert(h != NULL && dsm_next_dirty_run(h, &pos, &offset, &size) == 0);
+
+	// Mark ranges: Adjacent blocks merge into a run. Ranges are clipped.
+	dsm_mark_hole(h, big + 4096 + 10, 4);
+	dsm_mark_hole(h, big + 4096 + 64, 64);
+	dsm_mark_hole(h, big + 4096 + 900, 500);
+	dsm_mark_hole(h, big, 8);
+	pos = 0;
+	assert(dsm_next_dirty_run(h, &pos, &offset, &size) != 0);
+	assert(offset == big + 4096 && size == 128);
+	assert(dsm_next_dirty_run(h, &pos, &offset, &size) != 0);
+	assert(offset == big + 4096 + 896 && size == 1000 - 896);
+	assert(dsm_next_dirty_run(h, &pos, &offset, &size) == 0);
+
+	// The dirty range spans from the first run to the end of the last.
+	assert(dsm_dirty_range(h, &offset, &size) != 0);
+	assert(offset == big + 4096 && size == 1000);
+
+	// An exact hole marks only the bytes of each range.
+	h = dsm_get_hole(dsm_new_exact_hole(big + 8192, 256, &g_shm_holes),
+		&g_shm_holes);
+	assert(h != NULL);
+	dsm_mark_hole(h, big + 8192 + 60, 8);
+	dsm_mark_hole(h, big + 8192 + 68, 4);
+	dsm_mark_hole(h, big + 8192 + 130, 1);
+	pos = 0;
+	assert(dsm_next_dirty_run(h, &pos, &offset, &size) != 0);
+	assert(offset == big + 8192 + 60 && size == 12);
+	assert(dsm_next_dirty_run(h, &pos, &offset, &size) != 0);
+	assert(offset == big + 8192 + 130 && size == 1);
+	assert(dsm_next_dirty_run(h, &pos, &offset, &size) == 0);
+
 	// Free holes.
-	dsm_free_holes(g_shm_holes);
+	dsm_free_holes(&g_shm_holes);
+	assert(dsm_overlaps_hole(0, 6, &g_shm_holes) == 0);
 
 	printf("Ok!\n");
 
@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <assert.h>
+#include "dsm/dsm.h"
+
+/* Test Description:
+ * Two processes store to the shared map under write leases. Both request
+ * the token at once, so one waits on the lease the other brings. Pauses
+ * between rounds let timed leases expire while idle. Each process then
+ * checks the stores of the other.
+*/
+
+
+// Number of rounds, and stores per round.
+#define ROUNDS		20
+#define STORES		10
+
+
+int main (void) {
+    dsm_cfg cfg = {
+        .lproc = 2,
+        .tproc = 2,
+        .sid_name = "lease",
+        .d_addr = "127.0.0.1",
+        .d_port = "4200",
+        .map_size = 4096,
+        .lease_writes = 4,
+        .lease_ms = 2
+    };
+    volatile int *p = dsm_init2(&cfg);
+    int gid = dsm_get_gid(), ok = 1;
+
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < STORES; i++) {
+            p[gid * 16] = p[gid * 16] + 1;
+        }
+
+        // Let the lease expire.
+        usleep(5000);
+        dsm_barrier();
+
+        // Both stores of the round are visible.
+        ok = ok && (p[0] == (r + 1) * STORES && p[16] == (r + 1) * STORES);
+        dsm_barrier();
+    }
+
+    dsm_exit();
+
+    assert(ok == 1);
+
+	// Print ending message.
+	printf("Ok!\n");
+
+    return 0;
+}
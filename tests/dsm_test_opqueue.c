@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "dsm_opqueue.h"
+#include "dsm_util.h"
+
+/* Test Description:
+ * This program checks the grant policies of the operation queue: FIFO grants
+ * in order, locality batching grants up to K requests of the last arbiter in
+ * a row, GID priority grants the lowest GID first, and fair share grants the
+ * arbiter granted least, unless a request waited past the deadline. Grants
+ * are counted in the statistics.
+*/
+
+
+// Dequeues the head, and returns the pid of the next head.
+static uint32_t next (dsm_opqueue *oq) {
+    dsm_dequeueOpQueue(oq);
+    return DSM_MASK_PID(dsm_getOpQueueHead(oq));
+}
+
+
+int main (void) {
+    struct timespec ms = {.tv_sec = 0, .tv_nsec = 2000000};
+
+    // FIFO: In the order queued, also past the initial length.
+    dsm_opqueue *oq = dsm_initOpQueue(2);
+    for (uint32_t i = 1; i <= 5; i++) {
+        dsm_enqueueOpQueue(i % 2 + 3, i, 0, oq);
+    }
+    assert(dsm_getOpQueueLength(oq) == 5);
+    assert(DSM_MASK_PID(dsm_getOpQueueHead(oq)) == 1);
+    for (uint32_t i = 2; i <= 5; i++) {
+        assert(next(oq) == i);
+    }
+    dsm_dequeueOpQueue(oq);
+    assert(dsm_isOpQueueEmpty(oq) == 1);
+    assert(oq->stats.ngrants == 5 && oq->stats.nswitches == 4);
+    dsm_freeOpQueue(oq);
+
+    // Locality: Up to K = 2 of the last arbiter in a row, then the oldest.
+    oq = dsm_initOpQueue(DSM_MIN_OPQUEUE_SIZE);
+    dsm_setOpQueuePolicy(oq, DSM_OPQUEUE_LOCAL, 2);
+    dsm_enqueueOpQueue(3, 1, 0, oq);
+    dsm_enqueueOpQueue(4, 2, 0, oq);
+    dsm_enqueueOpQueue(3, 3, 0, oq);
+    dsm_enqueueOpQueue(3, 4, 0, oq);
+    dsm_enqueueOpQueue(4, 5, 0, oq);
+    assert(next(oq) == 3);
+    assert(next(oq) == 2);
+    assert(next(oq) == 5);
+    assert(next(oq) == 4);
+    assert(oq->stats.nswitches == 2);
+    dsm_dequeueOpQueue(oq);
+    dsm_freeOpQueue(oq);
+
+    // GID priority: Lowest GID first, in order among equals.
+    oq = dsm_initOpQueue(DSM_MIN_OPQUEUE_SIZE);
+    dsm_setOpQueuePolicy(oq, DSM_OPQUEUE_GID, 0);
+    dsm_enqueueOpQueue(3, 1, 5, oq);
+    dsm_enqueueOpQueue(3, 2, 7, oq);
+    dsm_enqueueOpQueue(4, 3, 2, oq);
+    dsm_enqueueOpQueue(4, 4, 7, oq);
+    assert(next(oq) == 3);
+    assert(next(oq) == 2);
+    assert(next(oq) == 4);
+    dsm_dequeueOpQueue(oq);
+    dsm_freeOpQueue(oq);
+
+    // Shared: Only requests of another arbiter than the head's count.
+    oq = dsm_initOpQueue(DSM_MIN_OPQUEUE_SIZE);
+    dsm_enqueueOpQueue(3, 1, 0, oq);
+    assert(dsm_isOpQueueShared(oq) == 0);
+    dsm_enqueueOpQueue(3, 2, 0, oq);
+    assert(dsm_isOpQueueShared(oq) == 0);
+    dsm_enqueueOpQueue(4, 3, 0, oq);
+    assert(dsm_isOpQueueShared(oq) == 1);
+    dsm_freeOpQueue(oq);
+
+    // Fair share: The arbiter granted least first, until the deadline.
+    oq = dsm_initOpQueue(DSM_MIN_OPQUEUE_SIZE);
+    dsm_setOpQueuePolicy(oq, DSM_OPQUEUE_FAIR, 1000);
+    dsm_enqueueOpQueue(3, 1, 0, oq);
+    dsm_enqueueOpQueue(3, 2, 0, oq);
+    dsm_enqueueOpQueue(4, 3, 0, oq);
+    assert(next(oq) == 3);
+    assert(next(oq) == 2);
+    dsm_dequeueOpQueue(oq);
+
+    dsm_setOpQueuePolicy(oq, DSM_OPQUEUE_FAIR, 1);
+    dsm_enqueueOpQueue(3, 4, 0, oq);
+    dsm_enqueueOpQueue(3, 5, 0, oq);
+    dsm_enqueueOpQueue(4, 6, 0, oq);
+    nanosleep(&ms, NULL);
+    assert(next(oq) == 5);
+    dsm_freeOpQueue(oq);
+
+	// Print ending message.
+	printf("Ok!\n");
+
+    return 0;
+}
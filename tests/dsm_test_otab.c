@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "dsm_otab.h"
+#include "dsm_util.h"
+
+/* Test Description:
+ * This program checks the page ownership rules: Unowned pages are granted at
+ * once, the owner is asked to drop a wanted page only once, and dropped pages
+ * pass to waiting arbiters in the order they asked.
+*/
+
+
+int main (void) {
+    int revoke;
+
+    // Initialize table.
+    dsm_otab *otab = dsm_initOwnerTable();
+
+    // Unowned pages are granted at once, also far past the initial length.
+    assert(dsm_acquirePage(otab, 0, 4, &revoke) == 1);
+    assert(dsm_acquirePage(otab, 1000, 5, &revoke) == 1);
+    assert(otab->length > 1000 && otab->pages[1].fd == -1);
+
+    // The owner asking again still owns it.
+    assert(dsm_acquirePage(otab, 0, 4, &revoke) == 1);
+
+    // Others queue. The owner is asked to drop the page once.
+    assert(dsm_acquirePage(otab, 0, 5, &revoke) == 0 && revoke == 4);
+    assert(dsm_acquirePage(otab, 0, 6, &revoke) == 0 && revoke == -1);
+
+    // Dropping passes the page on. The new owner must drop it in turn.
+    assert(dsm_releasePage(otab, 0, 4, &revoke) == 5 && revoke == 5);
+    assert(dsm_releasePage(otab, 0, 5, &revoke) == 6 && revoke == -1);
+
+    // The last owner drops it: It is unowned again.
+    assert(dsm_releasePage(otab, 0, 6, &revoke) == -1 && revoke == -1);
+    assert(otab->pages[0].fd == -1 && otab->pages[0].head == NULL);
+
+    // Free the table (with a queued request).
+    assert(dsm_acquirePage(otab, 1000, 4, &revoke) == 0 && revoke == 5);
+    dsm_freeOwnerTable(otab);
+
+	// Print ending message.
+	printf("Ok!\n");
+
+    return 0;
+}
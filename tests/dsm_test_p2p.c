@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "dsm/dsm.h"
+
+/* Test Description:
+ * Three processes exchange point-to-point data:
+ * - Process 1 sends one stream in messages of several sizes. Process 0
+ *   receives it in pieces of other sizes, partly into the shared map.
+ * - Processes 1 and 2 each send a numbered sequence to process 0, which
+ *   receives them alternately. Each sequence arrives in order.
+*/
+
+
+// Number of processes.
+#define NPROC		3
+
+// Length of the stream (in bytes), and the offset it is split at by 0.
+#define STREAM_LEN	12100
+#define SPLIT		4000
+
+// Messages per sender in the sequences.
+#define NSEQ		50
+
+
+static unsigned char g_buf[STREAM_LEN];
+
+
+int main (void) {
+    unsigned char *p = dsm_init("p2p", NPROC, NPROC, 4 * 4096);
+    unsigned char *map_buf = p + 4096;
+    int *res = (int *)p;
+    int gid = dsm_get_gid(), ok = 1, seq[NSEQ], x;
+
+    for (int i = 0; i < STREAM_LEN; i++) {
+        g_buf[i] = (unsigned char)(i * 13 + 1);
+    }
+
+    // Stream: Sent as 5000 + 7000 + 100, received as 4000 + 8100.
+    if (gid == 1) {
+        dsm_send(0, g_buf, 5000);
+        dsm_send(0, g_buf + 5000, 7000);
+        dsm_send(0, g_buf + 12000, 100);
+    } else if (gid == 0) {
+        memset(g_buf, 0, sizeof(g_buf));
+        dsm_recv(1, g_buf, SPLIT);
+        dsm_recv(1, map_buf, STREAM_LEN - SPLIT);
+        for (int i = 0; i < STREAM_LEN; i++) {
+            x = (i < SPLIT) ? g_buf[i] : map_buf[i - SPLIT];
+            ok = ok && (x == (unsigned char)(i * 13 + 1));
+        }
+    }
+
+    // Sequences: Both senders send all at once, and are received in turns.
+    if (gid != 0) {
+        for (int i = 0; i < NSEQ; i++) {
+            seq[i] = gid * 1000 + i;
+            dsm_send(0, seq + i, sizeof(int));
+        }
+    } else {
+        for (int i = 0; i < NSEQ; i++) {
+            for (int g = 1; g < NPROC; g++) {
+                dsm_recv(g, &x, sizeof(int));
+                ok = ok && (x == g * 1000 + i);
+            }
+        }
+    }
+
+    // Share the result: Only the master checks after exiting.
+    res[gid] = ok;
+    dsm_barrier();
+    for (int g = 0; g < NPROC; g++) {
+        ok = ok && (res[g] == 1);
+    }
+
+    dsm_exit();
+
+    assert(ok == 1);
+
+	// Print ending message.
+	printf("Ok!\n");
+
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "dsm_pstore.h"
+#include "dsm_util.h"
+
+/* Test Description:
+ * This program checks the page store: Writes are only kept once a lazy
+ * arbiter registers, pages read back as written (or zeroed), and lazy
+ * arbiters hold only the pages they fetched, while others hold all pages.
+ * Pages in invalidate mode drop the copies of other lazy arbiters, which
+ * then fetch only the words written since. Pages in auto mode switch to
+ * invalidation when written while shared, and back if it doesn't pay off.
+ * Subscribed pages are never invalidated.
+*/
+
+
+// Number of invalidations, and the last one.
+static int g_ninv, g_inv_fd;
+static size_t g_inv_page;
+
+
+// Records an invalidation.
+static void inv (int fd, size_t page) {
+    g_ninv++;
+    g_inv_fd = fd;
+    g_inv_page = page;
+}
+
+
+int main (void) {
+    unsigned char buf[256], page[64];
+    size_t pos, start, size;
+
+    // Initialize a store with small pages.
+    dsm_pstore *pstore = dsm_initPageStore(64);
+    memset(buf, 0xab, sizeof(buf));
+
+    // Without lazy arbiters, nothing is kept. Everyone holds everything.
+    dsm_writePageStore(pstore, 3, 0, buf, 8, inv);
+    assert(pstore->npages == 0);
+    assert(dsm_holdsPageRange(pstore, 4, 1 << 20, 1) == 1);
+
+    // A lazy arbiter holds nothing until it fetches.
+    dsm_setLazyHolder(pstore, 5);
+    assert(dsm_holdsPageRange(pstore, 5, 0, 4096) == 0);
+
+    // Writes spanning pages are split across them. Unwritten pages are zero.
+    dsm_writePageStore(pstore, 3, 60, buf, 8, inv);
+    dsm_readPageStore(pstore, 0, page);
+    assert(page[59] == 0 && page[60] == 0xab && page[63] == 0xab);
+    dsm_readPageStore(pstore, 1, page);
+    assert(page[0] == 0xab && page[3] == 0xab && page[4] == 0);
+    dsm_readPageStore(pstore, 1000, page);
+    assert(page[0] == 0 && page[63] == 0);
+
+    // A fetched page is held: Writes to ranges touching it are sent.
+    dsm_setHeldPage(pstore, 5, 200);
+    assert(dsm_holdsPageRange(pstore, 5, 200 * 64, 1) == 1);
+    assert(dsm_holdsPageRange(pstore, 5, 199 * 64, 65) == 1);
+    assert(dsm_holdsPageRange(pstore, 5, 199 * 64, 64) == 0);
+    assert(dsm_holdsPageRange(pstore, 5, 201 * 64, 64) == 0);
+
+    // Fetching a page never invalidated yields one run: The whole page.
+    pos = 0;
+    assert(dsm_nextPageRun(pstore, 5, 200, &pos, &start, &size) == 1);
+    assert(start == 0 && size == 64);
+    assert(dsm_nextPageRun(pstore, 5, 200, &pos, &start, &size) == 0);
+
+    // In update mode, writes by others don't invalidate.
+    dsm_setPageMode(pstore, 200, DSM_PSTORE_UPDATE);
+    dsm_writePageStore(pstore, 3, 200 * 64, buf, 8, inv);
+    assert(g_ninv == 0 && dsm_holdsPageRange(pstore, 5, 200 * 64, 1) == 1);
+
+    // In invalidate mode, they do. The writer's own copy is kept.
+    dsm_setPageMode(pstore, 200, DSM_PSTORE_INVALIDATE);
+    dsm_writePageStore(pstore, 5, 200 * 64, buf, 8, inv);
+    assert(g_ninv == 0);
+    dsm_writePageStore(pstore, 3, 200 * 64 + 9, buf, 2, inv);
+    assert(g_ninv == 1 && g_inv_fd == 5 && g_inv_page == 200);
+    assert(dsm_holdsPageRange(pstore, 5, 200 * 64, 64) == 0);
+
+    // The next fetch yields only the words written since.
+    dsm_writePageStore(pstore, 3, 200 * 64 + 40, buf, 17, inv);
+    assert(g_ninv == 1);
+    pos = 0;
+    assert(dsm_nextPageRun(pstore, 5, 200, &pos, &start, &size) == 1);
+    assert(start == 8 && size == 8);
+    assert(dsm_nextPageRun(pstore, 5, 200, &pos, &start, &size) == 1);
+    assert(start == 40 && size == 24);
+    assert(dsm_nextPageRun(pstore, 5, 200, &pos, &start, &size) == 0);
+
+    // After the fetch, the whole page is held again.
+    dsm_setHeldPage(pstore, 5, 200);
+    pos = 0;
+    assert(dsm_nextPageRun(pstore, 5, 200, &pos, &start, &size) == 1);
+    assert(start == 0 && size == 64);
+
+    // In auto mode, shared writes switch the page to invalidation.
+    dsm_setLazyHolder(pstore, 6);
+    dsm_setHeldPage(pstore, 6, 300);
+    for (int i = 0; i < DSM_PSTORE_PROBE_WRITES; i++) {
+        assert(g_ninv == 1);
+        dsm_writePageStore(pstore, 3, 300 * 64, buf, 8, inv);
+    }
+    dsm_writePageStore(pstore, 3, 300 * 64, buf, 8, inv);
+    assert(g_ninv == 2 && g_inv_fd == 6 && g_inv_page == 300);
+
+    // Refetching after every write costs more than it saves: Back to updates.
+    for (int i = 0; i < DSM_PSTORE_WINDOW_WRITES; i++) {
+        dsm_setHeldPage(pstore, 6, 300);
+        dsm_writePageStore(pstore, 3, 300 * 64, buf, 64, inv);
+    }
+    assert(pstore->pages[300].is_invalidate == 0);
+    assert(pstore->pages[300].backoff == 1);
+
+    // Subscribed copies are updated instead, in any mode.
+    g_ninv = 0;
+    dsm_setSubscribedPage(pstore, 6, 400);
+    dsm_setHeldPage(pstore, 6, 400);
+    dsm_setPageMode(pstore, 400, DSM_PSTORE_INVALIDATE);
+    dsm_writePageStore(pstore, 3, 400 * 64, buf, 8, inv);
+    assert(g_ninv == 0 && dsm_holdsPageRange(pstore, 6, 400 * 64, 1) == 1);
+
+    // Subscribing arbiters that hold all pages anyway has no effect.
+    dsm_setSubscribedPage(pstore, 4, 400);
+    assert(dsm_holdsPageRange(pstore, 4, 0, 1) == 1);
+
+    // Removed arbiters no longer count as lazy.
+    dsm_remHolder(pstore, 6);
+    dsm_remHolder(pstore, 5);
+    assert(pstore->nlazy == 0 && dsm_holdsPageRange(pstore, 5, 0, 1) == 1);
+
+    // Free the store.
+    dsm_freePageStore(pstore);
+
+	// Print ending message.
+	printf("Ok!\n");
+
+    return 0;
+}
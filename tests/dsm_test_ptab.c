@@ -33,6 +33,11 @@ int main (void) {
     assert((p = dsm_getProcessTableEntry(ptab, 2, 8)) != NULL && p->pid == 8);
     assert((p = dsm_getProcessTableEntry(ptab, 4, 14)) != NULL && p->pid == 14);
 
+    // Check GIDs are assigned in order of registration.
+    assert((p = dsm_getProcessTableEntryWithGID(ptab, 8, &fd)) != NULL &&
+        p->pid == 8 && fd == 2);
+    assert(dsm_getProcessTableEntryWithGID(ptab, 15, NULL) == NULL);
+
     // Remove PID 1, 5, 9.
     dsm_remProcessTableEntry(ptab, 0, 1); assert(dsm_getProcessTableEntry(ptab, 0, 1) == NULL);
     dsm_remProcessTableEntry(ptab, 1, 5); assert(dsm_getProcessTableEntry(ptab, 1, 5) == NULL);
@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "dsm_msg.h"
+#include "dsm_util.h"
+
+/* Test Description:
+ * This program checks multi-range write messages: Runs are read back in the
+ * order added with their data, a run continuing the last one extends it,
+ * runs are split once a message is full, and the message is the same after
+ * being packed and unpacked.
+*/
+
+
+int main (void) {
+    unsigned char buf[DSM_MSG_RUNS_BUF_SIZE], data[4 * DSM_MAX_DATA_SIZE];
+    unsigned char packed[DSM_MSG_SIZE];
+    const unsigned char *p;
+    int64_t offset, size, n;
+    dsm_msg msg, copy;
+    int i = 0;
+
+    for (size_t j = 0; j < sizeof(data); j++) {
+        data[j] = (unsigned char)(j * 7);
+    }
+
+    // Runs are read back in order, with their data.
+    dsm_init_runs(&msg, buf);
+    assert(dsm_add_run(&msg, 100, 10, data + 100) == 10);
+    assert(dsm_add_run(&msg, 40, 5, data + 40) == 5);
+    assert(dsm_add_run(&msg, 200, 3, data + 200) == 3);
+    dsm_end_runs(&msg);
+    assert(msg.runs.nruns == 3 && msg.runs.size == 3 * DSM_MSG_RUN_SIZE + 18);
+
+    // Packing and unpacking keeps the message.
+    dsm_pack_msg(&msg, packed);
+    dsm_unpack_msg(&copy, packed);
+    assert(copy.type == DSM_MSG_WRT_RUNS && copy.runs.nruns == 3 &&
+        copy.runs.size == msg.runs.size);
+    copy.runs.buf = msg.runs.buf;
+
+    assert((p = dsm_next_run(&copy, &i, &offset, &size)) != NULL);
+    assert(offset == 100 && size == 10 && memcmp(p, data + 100, 10) == 0);
+    assert((p = dsm_next_run(&copy, &i, &offset, &size)) != NULL);
+    assert(offset == 40 && size == 5 && memcmp(p, data + 40, 5) == 0);
+    assert((p = dsm_next_run(&copy, &i, &offset, &size)) != NULL);
+    assert(offset == 200 && size == 3 && memcmp(p, data + 200, 3) == 0);
+    assert(dsm_next_run(&copy, &i, &offset, &size) == NULL);
+
+    // A run continuing the last one extends it.
+    dsm_init_runs(&msg, buf);
+    assert(dsm_add_run(&msg, 0, 8, data) == 8);
+    assert(dsm_add_run(&msg, 8, 8, data + 8) == 8);
+    dsm_end_runs(&msg);
+    i = 0;
+    assert((p = dsm_next_run(&msg, &i, &offset, &size)) != NULL);
+    assert(msg.runs.nruns == 1 && offset == 0 && size == 16);
+    assert(memcmp(p, data, 16) == 0);
+
+    // A full message takes no more: Large runs are split.
+    dsm_init_runs(&msg, buf);
+    n = dsm_add_run(&msg, 0, sizeof(data), data);
+    assert(n == DSM_MAX_DATA_SIZE - DSM_MSG_RUN_SIZE);
+    assert(dsm_add_run(&msg, 2 * DSM_MAX_DATA_SIZE, 1, data) == 0);
+    dsm_end_runs(&msg);
+    assert(msg.runs.size == DSM_MAX_DATA_SIZE);
+
+    // So are runs past the last one allowed.
+    dsm_init_runs(&msg, buf);
+    for (int j = 0; j < DSM_MSG_MAX_RUNS; j++) {
+        assert(dsm_add_run(&msg, 2 * j, 1, data + 2 * j) == 1);
+    }
+    assert(dsm_add_run(&msg, 2 * DSM_MSG_MAX_RUNS, 1, data) == 0);
+    assert(dsm_add_run(&msg, 2 * DSM_MSG_MAX_RUNS - 1, 1, data) == 1);
+    dsm_end_runs(&msg);
+    i = 0;
+    while ((p = dsm_next_run(&msg, &i, &offset, &size)) != NULL) {
+        assert(offset == 2 * (i - 1) && *p == data[offset]);
+    }
+    assert(i == DSM_MSG_MAX_RUNS && size == 2);
+
+	// Print ending message.
+	printf("Ok!\n");
+
+    return 0;
+}
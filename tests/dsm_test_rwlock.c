@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "dsm_rwlock.h"
+#include "dsm_util.h"
+
+/* Test Description:
+ * This program checks the reader-writer lock grant rules: Readers share,
+ * writers are exclusive, queued requests are granted in order, and writer
+ * preference holds back new readers (and has read grants drained).
+*/
+
+
+int main (void) {
+    dsm_rwlock_t *lock, *wlock;
+    int fd, pid, w;
+
+    // Initialize table, register two locks.
+    dsm_rwlock_htab *htab = dsm_initRWLockHashTable();
+    lock = dsm_setRWLockHashTableEntry(htab, "table", 0);
+    wlock = dsm_setRWLockHashTableEntry(htab, "writer-preferred", 1);
+    assert(dsm_getHashTableEntry(htab, "table") == lock);
+
+    // Readers share the lock. A writer queues behind them.
+    assert(dsm_acquireRWLock(lock, 4, 1, 0) == 1);
+    assert(dsm_acquireRWLock(lock, 5, 2, 0) == 1);
+    assert(dsm_acquireRWLock(lock, 5, 3, 1) == 0);
+
+    // Without writer preference, new readers still join.
+    assert(dsm_acquireRWLock(lock, 6, 4, 0) == 1 && lock->nreaders == 3);
+
+    // Writer is granted only once the last reader leaves.
+    dsm_releaseRWLock(lock, 4, 1);
+    dsm_releaseRWLock(lock, 5, 2);
+    assert(dsm_nextRWLockGrant(lock, &fd, &pid, &w) == 0);
+    dsm_releaseRWLock(lock, 6, 4);
+    assert(dsm_nextRWLockGrant(lock, &fd, &pid, &w) == 1);
+    assert(fd == 5 && pid == 3 && w == 1);
+
+    // Readers queue behind the writer, then are all granted together.
+    assert(dsm_acquireRWLock(lock, 4, 1, 0) == 0);
+    assert(dsm_acquireRWLock(lock, 6, 4, 0) == 0);
+    dsm_releaseRWLock(lock, 5, 3);
+    assert(dsm_nextRWLockGrant(lock, &fd, &pid, &w) == 1 && pid == 1 && !w);
+    assert(dsm_nextRWLockGrant(lock, &fd, &pid, &w) == 1 && pid == 4 && !w);
+    assert(dsm_nextRWLockGrant(lock, &fd, &pid, &w) == 0);
+    assert(lock->nreaders == 2 && lock->head == NULL);
+
+    // With writer preference, a queued writer holds back new readers.
+    assert(dsm_acquireRWLock(wlock, 4, 1, 0) == 1);
+    assert(dsm_acquireRWLock(wlock, 5, 2, 1) == 0);
+    assert(dsm_acquireRWLock(wlock, 6, 3, 0) == 0);
+    dsm_releaseRWLock(wlock, 4, 1);
+    assert(dsm_nextRWLockGrant(wlock, &fd, &pid, &w) == 1 && pid == 2 && w);
+    assert(dsm_nextRWLockGrant(wlock, &fd, &pid, &w) == 0);
+    dsm_releaseRWLock(wlock, 5, 2);
+    assert(dsm_nextRWLockGrant(wlock, &fd, &pid, &w) == 1 && pid == 3 && !w);
+
+    // A reader granted between two preferred writers must drain its grant.
+    assert(dsm_mustDrainRWLock(wlock) == 0);
+    dsm_releaseRWLock(wlock, 6, 3);
+    assert(dsm_acquireRWLock(wlock, 4, 1, 1) == 1);
+    assert(dsm_acquireRWLock(wlock, 5, 2, 0) == 0);
+    assert(dsm_acquireRWLock(wlock, 6, 3, 1) == 0);
+    dsm_releaseRWLock(wlock, 4, 1);
+    assert(dsm_nextRWLockGrant(wlock, &fd, &pid, &w) == 1 && pid == 2 && !w);
+    assert(dsm_nextRWLockGrant(wlock, &fd, &pid, &w) == 0);
+    assert(dsm_mustDrainRWLock(wlock) == 1);
+    dsm_releaseRWLock(wlock, 5, 2);
+    assert(dsm_nextRWLockGrant(wlock, &fd, &pid, &w) == 1 && pid == 3 && w);
+    assert(dsm_mustDrainRWLock(wlock) == 0);
+
+    // Free the table (with the locks).
+    dsm_freeHashTable(htab);
+
+	// Print ending message.
+	printf("Ok!\n");
+
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "dsm_sem_htab.h"
+#include "dsm_ptab.h"
+#include "dsm_stab.h"
+#include "dsm_util.h"
+
+/* Test Description:
+ * This program registers named semaphores and checks that processes queued
+ * on a semaphore are granted in the order they arrived.
+*/
+
+
+// String table (referenced by the semaphore table).
+dsm_stab *g_str_tab;
+
+
+int main (void) {
+    dsm_sem_t *sem, *other;
+    dsm_proc *p;
+
+    // Initialize tables.
+    dsm_ptab *ptab = dsm_initProcessTable(3);
+    dsm_sem_htab *htab = dsm_initSemHashTable();
+    g_str_tab = dsm_initStringTable(32);
+
+    // Register two semaphores. Verify lookup.
+    sem = dsm_setSemHashTableEntry(htab, "lock");
+    other = dsm_setSemHashTableEntry(htab, "other");
+    assert(dsm_getHashTableEntry(htab, "lock") == sem && sem->value == 1);
+    assert(dsm_dequeueSemWaiter(sem) == NULL);
+
+    // Queue processes across file-descriptors in order of pid.
+    for (int i = 0; i < 6; i++) {
+        dsm_enqueueSemWaiter(sem, dsm_setProcessTableEntry(ptab, i % 3, i));
+    }
+    dsm_enqueueSemWaiter(other, dsm_setProcessTableEntry(ptab, 0, 42));
+
+    // Verify first-come first-served order, and fd is retained.
+    for (int i = 0; i < 6; i++) {
+        assert((p = dsm_dequeueSemWaiter(sem)) != NULL);
+        assert(p->pid == i && p->fd == i % 3 && p->sem_next == NULL);
+    }
+    assert(dsm_dequeueSemWaiter(sem) == NULL && sem->tail == NULL);
+
+    // Verify a drained queue may be reused.
+    dsm_enqueueSemWaiter(sem, dsm_getProcessTableEntry(ptab, 1, 4));
+    assert((p = dsm_dequeueSemWaiter(sem)) != NULL && p->pid == 4);
+
+    // Verify other semaphore is unaffected.
+    assert((p = dsm_dequeueSemWaiter(other)) != NULL && p->pid == 42);
+
+    // Free the tables.
+    dsm_freeHashTable(htab);
+    dsm_freeStringTable(g_str_tab);
+    dsm_freeProcessTable(ptab);
+
+	// Print ending message.
+	printf("Ok!\n");
+
+    return 0;
+}
@@ -66,6 +66,7 @@ void send_message (dsm_msg *mp) {
 
 int main (int argc, const char *argv[]) {
 	int gid = -1, rank = 0, narb = 4;
+	int32_t seq = 0;
 	dsm_msg msg = {0};
 	char port[6] = {0};
 
@@ -141,6 +142,7 @@ int main (int argc, const char *argv[]) {
 		// If go-ahead: verify rank and send data.
 		if (recv_msg.type == DSM_MSG_WRT_NOW) {
 			assert((rank % 2) == 1);
+			seq = recv_msg.proc.seq;
 			memset(&msg, 0, sizeof(dsm_msg));
 			msg.type = DSM_MSG_WRT_DATA;
 			msg.data.buf = data;
@@ -151,6 +153,7 @@ int main (int argc, const char *argv[]) {
 			// Signal end of data.
 			memset(&msg, 0, sizeof(dsm_msg));
 			msg.type = DSM_MSG_WRT_END;
+			msg.task.seq = seq;
 			send_message(&msg);
 			
 		} else {
@@ -159,11 +162,13 @@ int main (int argc, const char *argv[]) {
 			// Receive end of data message.
 			recv_message(NULL);
 			assert(recv_msg.type == DSM_MSG_WRT_END);
+			seq = recv_msg.task.seq;
 		}
 
 		// Send acknowledgment.
 		msg.type = DSM_MSG_GOT_DATA;
 		msg.task.nproc = 1;
+		msg.task.seq = seq;
 		send_message(&msg);
 
 
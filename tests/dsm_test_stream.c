@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "dsm/dsm.h"
+
+/* Test Description:
+ * Two processes store streams to the shared map, which open automatic holes.
+ * First each fills one of two adjacent ranges, split off a block boundary.
+ * Then each fills every other element of an array. Each hole must only send
+ * the bytes its process wrote, or it overwrites the data of the other.
+*/
+
+
+// Size of a page (in bytes).
+#define PAGE		4096
+
+// End of the first range (and start of the second).
+#define SPLIT		1000
+
+// Number of elements in the interleaved array.
+#define NELEMS		1024
+
+// Number of rounds.
+#define ROUNDS		10
+
+
+int main (void) {
+    volatile char *p = dsm_init("stream", 2, 2, 4 * PAGE);
+    volatile int *a = (volatile int *)(p + 2 * PAGE);
+    int gid = dsm_get_gid(), ok = 1;
+    int lo = (gid == 0) ? 0 : SPLIT, hi = (gid == 0) ? SPLIT : 2 * SPLIT;
+
+    for (int r = 1; r <= ROUNDS; r++) {
+
+        // Fill adjacent ranges.
+        for (int i = lo; i < hi; i++) {
+            p[i] = (char)(r + i);
+        }
+        dsm_barrier();
+
+        for (int i = 0; i < 2 * SPLIT; i++) {
+            ok = ok && (p[i] == (char)(r + i));
+        }
+        dsm_barrier();
+
+        // Fill interleaved elements.
+        for (int i = gid; i < NELEMS; i += 2) {
+            a[i] = r * NELEMS + i;
+        }
+        dsm_barrier();
+
+        for (int i = 0; i < NELEMS; i++) {
+            ok = ok && (a[i] == r * NELEMS + i);
+        }
+        dsm_barrier();
+    }
+
+    dsm_exit();
+
+    assert(ok == 1);
+
+	// Print ending message.
+	printf("Ok!\n");
+
+    return 0;
+}
@@ -13,8 +13,23 @@ dsm_daemon >> test.log &
 ./dsm_test_server 127.0.0.1 4200
 ./dsm_test_ptab
 ./dsm_test_stab
+./dsm_test_sem
+./dsm_test_rwlock
+./dsm_test_otab
+./dsm_test_opqueue
+./dsm_test_runs
+./dsm_test_pstore
 ./dsm_test_holes
+./dsm_test_heap
 ./dsm_test_signals
+./dsm_test_fuzzy
+./dsm_test_fill
+./dsm_test_stream
+./dsm_test_afill
+./dsm_test_lease
+./dsm_test_coll
+./dsm_test_p2p
+./dsm_test_arena
 echo Done.
 make clean >> test.log
 kill $(pgrep -f dsm_daemon)